@@ -7,11 +7,16 @@ KoolApi::KoolApi(const char *urlBase) : _urlBase(urlBase)
 
 KoolApi::~KoolApi()
 {
-  for (int i = 0; i < _handlersLength; i++)
-    delete _handlerList[i];
+  // Handlers are owned by the caller, only the lists belong to us
+  delete[] _handlerList;
+  delete[] _routeIndex;
 }
 
-const size_t KoolApi::uriCount() const { return _handlersLength; }
+const size_t KoolApi::uriCount() const
+{
+  KoolApiSharedLock::Guard guard(_routesLock);
+  return _handlersLength + _staticRoutesLength;
+}
 
 const char *const KoolApi::getUrlBase() const { return _urlBase; }
 
@@ -33,33 +38,182 @@ KoolApi &KoolApi::setDesriberUri(const char *uri)
 
 const char *const KoolApi::getDesriberUri() const { return _describerUri; }
 
-KoolApi &KoolApi::on(const char *uri, KoolApiPath &handler)
+#ifdef KOOLAPI_METRICS
+
+KoolApi &KoolApi::setMetricsUri(const char *uri)
+{
+  _metricsUri = uri;
+  return *this;
+}
+
+const char *const KoolApi::getMetricsUri() const { return _metricsUri; }
+
+#endif
+
+#ifdef KOOLAPI_ACCESS_LOG
+
+KoolApi &KoolApi::setAccessLog(KoolApiAccessLog &log)
+{
+  _accessLog = &log;
+  return *this;
+}
+
+void KoolApi::_log(ApiRequest &request, uint32_t latency)
+{
+  // Items of a batch are logged as requests of their own
+  if (!_accessLog || !request._batch.isNull())
+    return;
+
+  ApiAccessEntry entry;
+
+  entry.time = koolApiMillis();
+  entry.client = request._remoteAddress();
+  entry.latency = latency;
+  entry.bytesIn = request._bytesIn;
+  entry.bytesOut = request._bytesOut;
+  entry.status = request._status;
+  entry.method = request._method;
+  snprintf(entry.uri, sizeof(entry.uri), "%s", (request.uri) ? request.uri : "");
+
+  _accessLog->record(entry);
+}
+
+#endif
+
+KoolApi &KoolApi::setCors(const KoolApiCors &policy)
+{
+  _cors = &policy;
+  return *this;
+}
+
+KoolApi &KoolApi::setEnvelopeFirst(bool envelopeFirst)
+{
+  _envelopeFirst = envelopeFirst;
+  return *this;
+}
+
+KoolApi &KoolApi::setCoalescing(bool coalesce)
+{
+  _coalesce = coalesce;
+  return *this;
+}
+
+#ifdef KOOLAPI_HAS_EXECUTOR
+
+KoolApi &KoolApi::setExecutor(KoolApiExecutor &executor)
+{
+  // Every worker holds a pair while running, batch items borrow another
+  if (_docPool.reserve((size_t)executor.workers() + 1))
+    _executor = &executor;
+
+  return *this;
+}
+
+#endif
+
+KoolApi &KoolApi::on(const char *uri, KoolApiPath &handler, api_priority_t priority)
 {
+  // Requests being routed finish first, later ones wait for the new route
+  KoolApiSharedLock::Guard guard(_routesLock, true);
+
   handler._path = uri;
-  KoolApiPath **replaceArr = new KoolApiPath *[_handlersLength + 1];
+  handler._priority = priority;
+  _reserveHandlers(_handlersLength + 1);
 
-  if (!_handlersLength)
+  // Rebuilt with the new route when next requested, requests sending it keep theirs
+  _description.reset();
+
+  _handlerList[_handlersLength++] = &handler;
+
+  if (KoolApiRouteTree::isTemplate(uri))
   {
-    replaceArr[0] = &handler;
+    _routeTree.insert(uri, &handler);
+    return *this;
   }
-  else
+
+  KoolApiRoute route = {
+      .hash = koolutils::hash(uri),
+      .path = uri,
+      .handler = &handler};
+
+  // Insertion keeps the index sorted so lookups can binary search
+  size_t pos = _routeIndexLength;
+
+  while (pos && (_routeIndex[pos - 1].hash > route.hash ||
+                 (_routeIndex[pos - 1].hash == route.hash && strcmp(_routeIndex[pos - 1].path, uri) > 0)))
   {
-    for (int i = 0; i < _handlersLength; i++)
-    {
-      replaceArr[i] = _handlerList[i];
-    }
-    replaceArr[_handlersLength] = &handler;
+    _routeIndex[pos] = _routeIndex[pos - 1];
+    --pos;
   }
 
-  _handlersLength++;
-  _handlerList = replaceArr;
+  _routeIndex[pos] = route;
+  _routeIndexLength++;
 
   return *this;
 }
 
+void KoolApi::_reserveHandlers(size_t required)
+{
+  if (required <= _handlersCapacity)
+    return;
+
+  size_t capacity = (_handlersCapacity) ? _handlersCapacity * 2 : 8;
+
+  while (capacity < required)
+    capacity *= 2;
+
+  KoolApiPath **handlers = new KoolApiPath *[capacity];
+  KoolApiRoute *index = new KoolApiRoute[capacity];
+
+  for (size_t i = 0; i < _handlersLength; i++)
+    handlers[i] = _handlerList[i];
+
+  for (size_t i = 0; i < _routeIndexLength; i++)
+    index[i] = _routeIndex[i];
+
+  delete[] _handlerList;
+  delete[] _routeIndex;
+
+  _handlerList = handlers;
+  _routeIndex = index;
+  _handlersCapacity = capacity;
+}
+
 void KoolApi::process(ApiRequest &request, int methodsAccepted)
 {
-  auto errParseCode = request.parse(_urlBase, _requestKey);
+  KoolApiTrace::trace(API_TRACE_RECEIVE, &request, request.uri, nullptr);
+
+#ifdef KOOLAPI_ACCESS_LOG
+  uint32_t start = koolApiMicros();
+#endif
+
+#ifdef KOOLAPI_COUNTS_RESPONSES
+  // Measured first as parsing may change the input in place
+  request._bytesIn = request._inputLength();
+#endif
+
+#ifdef KOOLAPI_METRICS
+  _record(request, _process(request, methodsAccepted));
+#else
+  _process(request, methodsAccepted);
+#endif
+
+#ifdef KOOLAPI_ACCESS_LOG
+  _log(request, koolApiMicros() - start);
+#endif
+}
+
+KoolApiPath *KoolApi::_process(ApiRequest &request, int methodsAccepted)
+{
+  request._cors = _cors;
+
+  if (!request._acquireDocs(_docPool))
+  {
+    request._error(503);
+    return nullptr;
+  }
+
+  int errParseCode = _parse(request, _envelopeFirst);
 
   if (errParseCode)
   {
@@ -70,23 +224,40 @@ void KoolApi::process(ApiRequest &request, int methodsAccepted)
     //   Serial.printf("Json Error: %s\n", request._deserializationError.c_str());
     // }
 
-    return;
+    return nullptr;
+  }
+
+  if (!request._batch.isNull())
+  {
+    _processBatch(request, methodsAccepted);
+    return nullptr;
   }
 
   if (!request.uri)
   {
     request._error(400);
-    return;
+    return nullptr;
   }
 
-  auto handler = _findHandler(request.uri);
+  const char *routePath = nullptr;
+  auto handler = _route(request.uri, request._pathParams, &routePath);
+
+  request._routePath = routePath;
+  KoolApiTrace::trace(API_TRACE_ROUTED, &request, request.uri, routePath);
 
   if (!handler && _describerUri && request._method == API_METHOD_GET && strncmp(request.uri, _describerUri, strlen(_describerUri)) == 0)
   {
-    _describeApi(request._out);
-    request._dispatch(200);
-    return;
+    _sendDescription(request);
+    return nullptr;
+  }
+
+#ifdef KOOLAPI_METRICS
+  if (!handler && _metricsUri && request._method == API_METHOD_GET && strcmp(request.uri, _metricsUri) == 0)
+  {
+    _sendMetrics(request);
+    return nullptr;
   }
+#endif
 
   int errMethod = (!handler) ? 404 : (request._method == API_METHOD_UNKNOWN) ? 400
                                  : (!(methodsAccepted & request._method))    ? 405
@@ -95,15 +266,142 @@ void KoolApi::process(ApiRequest &request, int methodsAccepted)
   if (errMethod)
   {
     request._error(errMethod);
-    return;
+    return handler;
   }
 
+  if (!request._parsed)
+  {
+    errParseCode = _parse(request, false);
+
+    if (errParseCode)
+    {
+      request._error(errParseCode);
+      return handler;
+    }
+
+    // Captures pointed into the envelope, point them at the parsed uri
+    if (request._pathParams.length())
+      _route(request.uri, request._pathParams);
+  }
+
+  if (request.params)
+    request.params->_pathParams = &request._pathParams;
+
+  if (handler->_cors)
+    request._cors = handler->_cors;
+
   KoolApiPath::handle_t h = {
       .method = (api_method_t)request._method,
       .request = &request,
-      .uriKey = _uriKey};
+      .uriKey = _uriKey,
+      .path = routePath,
+      .flights = (_coalesce) ? &_flights : nullptr};
+
+  {
+    KOOLAPI_TIME_PHASE(request, API_PHASE_HANDLE);
+    handler->_handle(h);
+  }
+
+  KoolApiTrace::trace(API_TRACE_HANDLED, &request, request.uri, routePath);
+
+  return handler;
+}
+
+int KoolApi::_parse(ApiRequest &request, bool envelope)
+{
+  int errParseCode;
+
+  {
+    KOOLAPI_TIME_PHASE(request, API_PHASE_PARSE);
+
+    if (envelope)
+    {
+      errParseCode = request.parseEnvelope(_urlBase, _requestKey);
+    }
+    else
+    {
+      errParseCode = request.parse(_urlBase, _requestKey);
+      request._parsed = true;
+    }
+  }
 
-  handler->_handle(h);
+  KoolApiTrace::trace(API_TRACE_PARSED, &request, request.uri, nullptr, errParseCode);
+
+  return errParseCode;
+}
+
+bool KoolApi::submit(ApiRequest *request, int methodsAccepted)
+{
+#ifdef KOOLAPI_HAS_EXECUTOR
+  if (_executor)
+  {
+    // Borrowed input is copied as the transport's buffers go when it returns
+    if (request->_retainInput() && _executor->submit({this, request, methodsAccepted, _priorityOf(*request)}))
+      return true;
+
+    request->_error(503);
+    delete request;
+    return false;
+  }
+#endif
+
+  process(*request, methodsAccepted);
+  delete request;
+  return true;
+}
+
+api_priority_t KoolApi::_priorityOf(ApiRequest &request)
+{
+  KoolApiPathParams captures;
+
+  const char *uri = request._peekUri(_urlBase, _requestKey);
+  auto handler = (uri) ? _route(uri, captures) : nullptr;
+
+  return (handler) ? handler->_priority : API_PRIORITY_NORMAL;
+}
+
+void KoolApi::_run(ApiRequest *request, int methodsAccepted)
+{
+  // The client may have gone while queued, there is then no one to answer
+  if (request->_connected())
+    process(*request, methodsAccepted);
+
+  delete request;
+}
+
+void KoolApi::_reject(ApiRequest *request)
+{
+  if (request->_connected())
+    request->_error(503);
+
+  delete request;
+}
+
+void KoolApi::_processBatch(ApiRequest &request, int methodsAccepted)
+{
+  bool shortKeys = request._usesShortKeys();
+
+  // Items take no pool slot. Each builds its answer in the batch's output
+  // document, then replaces itself with it in the input array.
+  for (JsonVariant item : request._batch)
+  {
+    // A failing item only answers its error
+    ApiJsonRequest itemRequest(item, shortKeys);
+    itemRequest.format = request.format;
+    itemRequest.doc = request.doc;
+    itemRequest.outdoc = request.outdoc;
+    process(itemRequest, methodsAccepted);
+
+    if (!itemRequest._dispatched)
+      item.set(nullptr);
+  }
+
+  // The input array now holds the answers, so is what gets sent
+  std::swap(request.doc, request.outdoc);
+
+  request._dispatch(200);
+  request._sentOutput(200);
+  request._dispatched = true;
 }
 
 bool KoolApi::startsWithUriKey(const char *url) const
@@ -111,35 +409,266 @@ bool KoolApi::startsWithUriKey(const char *url) const
   return strncmp(url, _urlBase, strlen(_urlBase)) == 0;
 }
 
-KoolApiPath *KoolApi::_findHandler(const char *path)
+KoolApiPath *KoolApi::_route(const char *uri, KoolApiPathParams &captures, const char **routePath)
 {
-  if (path)
+  KoolApiSharedLock::Guard guard(_routesLock);
+
+  auto handler = _findHandler(uri, routePath);
+
+  if (!handler)
+  {
+    handler = _routeTree.find(uri, captures);
+
+    if (handler && routePath)
+      *routePath = handler->_path;
+  }
+
+  return handler;
+}
+
+KoolApiPath *KoolApi::_findHandler(const char *path, const char **routePath)
+{
+  if (!path)
+    return nullptr;
+
+  uint32_t h = koolutils::hash(path);
+  auto route = _searchRoutes(_staticRoutes, _staticRoutesLength, _staticRoutesSorted, path, h);
+
+  if (!route)
+    route = _searchRoutes(_routeIndex, _routeIndexLength, true, path, h);
+
+  if (route)
+  {
+    if (routePath)
+      *routePath = route->path;
+
+    return route->handler;
+  }
+
+  return nullptr;
+}
+
+const KoolApiRoute *KoolApi::_searchRoutes(const KoolApiRoute *routes, size_t length, bool sorted, const char *path, uint32_t hash)
+{
+  size_t lo = 0;
+
+  if (sorted)
   {
+    size_t hi = length;
 
-    for (uint8_t i = 0; i < _handlersLength; ++i)
+    // Lower bound of the hash, then walk any collisions
+    while (lo < hi)
     {
+      size_t mid = lo + (hi - lo) / 2;
 
-      if (strcmp(_handlerList[i]->_path, path) == 0)
-      {
-        return _handlerList[i];
-      }
+      if (routes[mid].hash < hash)
+        lo = mid + 1;
+      else
+        hi = mid;
     }
   }
 
+  for (; lo < length; ++lo)
+  {
+    if (routes[lo].hash == hash && strcmp(routes[lo].path, path) == 0)
+      return &routes[lo];
+
+    if (sorted && routes[lo].hash != hash)
+      break;
+  }
+
   return nullptr;
 }
 
-void KoolApi::_describeApi(JsonObject &out)
+void KoolApi::_sendDescription(ApiRequest &request)
+{
+  std::shared_ptr<const char> description;
+  size_t length = 0;
+
+  {
+    // Exclusive as the description is built on first use and released by `on`
+    KoolApiSharedLock::Guard guard(_routesLock, true);
+
+    if (_describeApi())
+    {
+      description = _description;
+      length = _descriptionLength;
+    }
+  }
+
+  if (!description)
+  {
+    request._error(503);
+    return;
+  }
+
+  // Sent as is, so the description is not limited by the output document
+  request._sendBody(200, description.get(), length, API_FORMAT_JSON);
+}
+
+#ifdef KOOLAPI_METRICS
+
+void KoolApi::_record(ApiRequest &request, KoolApiPath *handler)
+{
+  // Items of a batch are counted against their own routes
+  if (!request._batch.isNull())
+    return;
+
+  uint32_t *phases = request._phases;
+
+  // Sending is timed within the handler, count it only once
+  phases[API_PHASE_HANDLE] = (phases[API_PHASE_HANDLE] > phases[API_PHASE_SERIALISE])
+                                 ? phases[API_PHASE_HANDLE] - phases[API_PHASE_SERIALISE]
+                                 : 0;
+
+  KoolApiRouteMetrics &metrics = (handler) ? handler->_metrics : _unroutedMetrics;
+  metrics.record(request._status, request._bytesIn, request._bytesOut, phases);
+}
+
+void KoolApi::_sendMetrics(ApiRequest &request)
 {
-  auto h = out.createNestedArray("handlers");
+  // Params are needed for the format, so the envelope is not enough
+  int errParseCode = (request._parsed) ? 0 : _parse(request, false);
 
-  for (uint8_t i = 0; i < _handlersLength; ++i)
+  if (errParseCode)
   {
+    request._error(errParseCode);
+    return;
+  }
+
+  auto format = (request.params) ? request.params->getView("format") : ApiParamView{nullptr, 0};
+  bool prometheus = format && format.length == 10 && strncmp(format.data, "prometheus", 10) == 0;
+
+  char *buffer = nullptr;
+  size_t length = 0;
+  bool complete = false;
 
-    JsonObject p = h.createNestedObject();
-    p["path"] = _handlerList[i]->_path;
-    _handlerList[i]->_createOptions(p, false);
+  {
+    // Routes cannot be added while their metrics are written
+    KoolApiSharedLock::Guard guard(_routesLock);
+
+    length = _writeMetrics(nullptr, 0, prometheus);
+
+    // Counts keep growing on other tasks, so what was measured may no longer
+    // fit. Retried at the length the cut short attempt needed.
+    for (uint8_t attempt = 0; attempt < KOOLAPI_METRICS_ATTEMPTS && !complete; ++attempt)
+    {
+      size_t size = length + 64;
+
+      free(buffer);
+      buffer = (char *)malloc(size);
+
+      if (!buffer)
+        break;
+
+      length = _writeMetrics(buffer, size, prometheus);
+      complete = length < size;
+    }
   }
+
+  if (!complete)
+  {
+    free(buffer);
+    request._error((buffer) ? 507 : 503);
+    return;
+  }
+
+  if (prometheus)
+  {
+    request._dispatchText(200, buffer, length);
+    request._sent(200, length);
+    request._dispatched = true;
+  }
+  else
+  {
+    request._sendBody(200, buffer, length, API_FORMAT_JSON);
+  }
+
+  free(buffer);
+}
+
+size_t KoolApi::_writeMetrics(char *buffer, size_t size, bool prometheus)
+{
+  KoolApiMetricsWriter out(buffer, size, prometheus);
+
+  for (uint8_t section = 0; section < out.sections(); ++section)
+  {
+    out.begin(section);
+
+    for (size_t i = 0; i < _staticRoutesLength; ++i)
+      out.route(section, _staticRoutes[i].path, _staticRoutes[i].handler->_metrics);
+
+    for (size_t i = 0; i < _handlersLength; ++i)
+      out.route(section, _handlerList[i]->_path, _handlerList[i]->_metrics);
+
+    out.route(section, "*", _unroutedMetrics);
+    out.end(section);
+  }
+
+  return out.length();
+}
+
+#endif
+
+bool KoolApi::_describeApi()
+{
+  if (_description)
+    return true;
+
+  // Measured first so only the description itself is allocated
+  size_t length = _writeDescription(nullptr, 0);
+
+  char *description = (char *)malloc(length + 1);
+
+  if (!description)
+    return false;
+
+  _description = std::shared_ptr<char>(description, free);
+  _descriptionLength = _writeDescription(description, length + 1);
+
+  return true;
+}
+
+size_t KoolApi::_writeDescription(char *buffer, size_t size)
+{
+  size_t pos = 0;
+
+  auto text = [&](const char *s)
+  {
+    size_t len = strlen(s);
+
+    if (buffer)
+      memcpy(buffer + pos, s, len + 1);
+
+    pos += len;
+  };
+
+  // Each handler is built in a small document of its own
+  auto handler = [&](KoolApiPath *h, const char *path)
+  {
+    StaticJsonDocument<JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(8)> entry;
+    JsonObject p = entry.to<JsonObject>();
+
+    p["path"] = path;
+    h->_createOptions(p, false);
+
+    if (pos > sizeof("{\"handlers\":[") - 1)
+      text(",");
+
+    pos += (buffer) ? serializeJson(entry, buffer + pos, size - pos) : measureJson(entry);
+  };
+
+  text("{\"handlers\":[");
+
+  for (size_t i = 0; i < _staticRoutesLength; ++i)
+    handler(_staticRoutes[i].handler, _staticRoutes[i].path);
+
+  for (size_t i = 0; i < _handlersLength; ++i)
+    handler(_handlerList[i], _handlerList[i]->_path);
+
+  text("]}");
+
+  return pos;
 }
 
 KoolApi &KoolApi::setUriKey(const char *key)
@@ -156,38 +685,207 @@ bool KoolApi::apiFilter(const AsyncWebServerRequest *r)
   return startsWithUriKey(rs);
 }
 
-void KoolApi::registerWith(AsyncWebServer &server, void (*logfunc)(AsyncWebServerRequest *request, const char *msg))
+void KoolApi::registerWith(AsyncWebServer &server)
 {
-  server.on(
-            _urlBase, HTTP_GET | HTTP_DELETE, [this, logfunc](AsyncWebServerRequest *request)
-            {
-              if (logfunc)
-                logfunc(request, "");
+  auto filter = [this](AsyncWebServerRequest *request)
+  {
+    if (!apiFilter(request))
+      return false;
 
-              ApiAsyncWebRequest apiRequest(request);
-              process(apiRequest); })
-      .setFilter(std::bind(&KoolApi::apiFilter, this, std::placeholders::_1));
+    // Headers not asked for are dropped by the webserver once a handler is chosen
+    request->addInterestingHeader("If-None-Match");
+    return true;
+  };
+
+  server.on(
+            _urlBase, HTTP_GET | HTTP_DELETE | HTTP_HEAD, [this](AsyncWebServerRequest *request)
+            { _processWeb(request); })
+      .setFilter(filter);
 
   server.on(
             _urlBase,
-            HTTP_ANY, [this, logfunc](AsyncWebServerRequest *request)
+            HTTP_ANY, [this](AsyncWebServerRequest *request)
             {
-              if (logfunc)
-                logfunc(request, "");
-
               if (request->method() == HTTP_OPTIONS)
-              {
-                ApiAsyncWebRequest apiRequest(request);
-                process(apiRequest);
-              } },
-            NULL, [this, logfunc](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
-            {
-              if (logfunc)
-                logfunc(request, "");
+                _processWeb(request); },
+            NULL, [this](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+            { _onBody(request, data, len, index, total); })
+      .setFilter(filter);
+}
+
+void KoolApi::_onBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+  if (_onStreamedBody(request, data, len, index, total))
+    return;
+
+  if (!index)
+  {
+    if (total > KOOLAPI_MAX_BODY_SIZE)
+    {
+      ApiAsyncWebRequest apiRequest(request);
+      apiRequest._error(413);
+      return;
+    }
+
+    // Whole body in one chunk needs no copy, unless queued
+    if (len == total)
+    {
+      _processWeb(request, data, len);
+      return;
+    }
+
+    // Sized once from Content-Length, freed by the webserver with the request
+    auto body = (ApiAsyncBody *)malloc(sizeof(ApiAsyncBody) + total);
+    request->_tempObject = body;
+
+    if (!body)
+    {
+      ApiAsyncWebRequest apiRequest(request);
+      apiRequest._error(503);
+      return;
+    }
+
+    body->streamedTo = nullptr;
+    body->client = nullptr;
+  }
+
+  auto body = (ApiAsyncBody *)request->_tempObject;
+
+  // Already rejected
+  if (!body || index + len > total)
+    return;
+
+  memcpy(body->data() + index, data, len);
+
+  if (index + len == total)
+    _processWeb(request, body->data(), total);
+}
+
+namespace
+{
+  struct streamed_body_t
+  {
+    ApiAsyncBody head;
+    KoolApiBodyParser parser;
+
+    /**
+     * @brief Set once the handler has had the body or an error event
+     *
+     */
+    bool ended;
+  };
+
+  void streamedBodyEvent(void *arg, const ApiBodyEvent &event)
+  {
+    ((streamed_body_t *)arg)->head.streamedTo->bodyEvent(event);
+  }
+
+  // Lets the handler release any state, the request is not processed
+  void endStreamedBody(streamed_body_t *body)
+  {
+    ApiBodyEvent event = {API_BODY_ERROR, nullptr, nullptr, 0, 0, &body->parser.context};
+    body->ended = true;
+    body->head.streamedTo->bodyEvent(event);
+  }
+
+  // The relay is deleted with the request, whether answered or disconnected part way
+  void streamedBodyGone(void *arg)
+  {
+    auto body = (streamed_body_t *)arg;
+    body->head.client = nullptr;
+
+    if (!body->ended)
+      endStreamedBody(body);
+  }
+}
+
+bool KoolApi::_onStreamedBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+{
+  auto body = (streamed_body_t *)request->_tempObject;
+
+  // Routed on the first chunk only, later ones follow what it chose
+  if (index)
+  {
+    if (body && !body->head.streamedTo)
+      return false;
+
+    if (!body || body->ended)
+      return true;
+  }
+  else
+  {
+    auto method = request->method();
+
+    if (!(method & (HTTP_POST | HTTP_PUT | HTTP_PATCH)))
+      return false;
+
+    KoolApiPathParams captures;
+    const char *uri = request->url().c_str() + strlen(_urlBase) + 1;
+    auto handler = _route(uri, captures);
+
+    if (!handler || !handler->streamsBody())
+      return false;
+
+    body = (streamed_body_t *)malloc(sizeof(streamed_body_t));
+    request->_tempObject = body;
+
+    if (!body)
+    {
+      ApiAsyncWebRequest apiRequest(request);
+      apiRequest._error(503);
+      return true;
+    }
+
+    // Relayed from the start, so the handler learns of a disconnect without taking onDisconnect
+    auto client = ApiAsyncClient::attach(request);
+
+    if (!client)
+    {
+      free(body);
+      request->_tempObject = nullptr;
+
+      ApiAsyncWebRequest apiRequest(request);
+      apiRequest._error(503);
+      return true;
+    }
+
+    new (&body->parser) KoolApiBodyParser(streamedBodyEvent, body);
+    body->head.streamedTo = handler;
+    body->head.client = client.get();
+    body->ended = false;
+
+    // Called before the webserver frees the body
+    client->onGone = streamedBodyGone;
+    client->goneArg = body;
+  }
+
+  if (!body->parser.feed(data, len) || (index + len == total && !body->parser.finish()))
+  {
+    endStreamedBody(body);
+
+    ApiAsyncWebRequest apiRequest(request);
+    apiRequest._error(400);
+    return true;
+  }
+
+  if (index + len < total)
+    return true;
+
+  body->ended = true;
+
+  if (_executor)
+  {
+    auto apiRequest = new ApiAsyncWebRequest(request);
+    apiRequest->bodyContext = body->parser.context;
+    submit(apiRequest);
+    return true;
+  }
+
+  ApiAsyncWebRequest apiRequest(request);
+  apiRequest.bodyContext = body->parser.context;
+  process(apiRequest);
 
-              ApiAsyncWebRequest apiRequest(request, data, len);
-              process(apiRequest); })
-      .setFilter(std::bind(&KoolApi::apiFilter, this, std::placeholders::_1));
+  return true;
 }
 
 #endif
@@ -34,8 +34,16 @@ https://restfulapi.net/resource-naming/
     The request method is known by the server but is not supported by the target resource. For example, an API may forbid DELETE-ing a resource.
 */
 
+#include "KoolApiAccessLog.h"
+#include "KoolApiExecutor.h"
+#include "KoolApiJobs.h"
 #include "KoolApiPath.h"
 #include "KoolApiRequests.h"
+#include "KoolApiRouteTree.h"
+#include "KoolApiStatic.h"
+#include "KoolApiTask.h"
+
+class KoolApiExecutor;
 
 /**
  * @brief Handles processing of requests
@@ -52,12 +60,29 @@ public:
 
   KoolApi(const char *urlBase);
 
+  /**
+   * @brief Construct a KoolApi object serving a compile time route table
+   *
+   * Routes from the table need no registration. More may still be added with `on`.
+   *
+   * @param urlBase uri to mount api on. Eg "/_api"
+   * @param routes Table from `koolApiRoutes`. Must outlive the api, declare it `constexpr`.
+   */
+  template <size_t N>
+  KoolApi(const char *urlBase, const KoolApiRouteTable<N> &routes)
+      : _urlBase(urlBase),
+        _staticRoutes(routes.routes),
+        _staticRoutesLength(N),
+        _staticRoutesSorted(routes.sorted)
+  {
+  }
+
   virtual ~KoolApi();
 
   /**
    * @brief Returns number of uri endpoints registered
    *
-   * @return const uint8_t
+   * @return const size_t
    */
   const size_t uriCount() const;
 
@@ -117,24 +142,136 @@ public:
    */
   const char *const getDesriberUri() const;
 
+#ifdef KOOLAPI_METRICS
+
+  /**
+   * @brief If set will serve per route metrics on the uri specified for GET requests.
+   *
+   * Json by default, Prometheus text with the param `format=prometheus`.
+   * Requests for unknown uris are counted under the path "*".
+   *
+   * @param uri eg `__metrics__`. Default: nullptr
+   * @return KoolApi&
+   */
+  KoolApi &setMetricsUri(const char *uri);
+
+  /**
+   * @brief Return the uri metrics are served on
+   *
+   * @return const char* The uri. Returns nullptr if not set.
+   */
+  const char *const getMetricsUri() const;
+
+#endif
+
+#ifdef KOOLAPI_ACCESS_LOG
+
+  /**
+   * @brief Record every request processed in `log`
+   *
+   * Requests only add an entry to its ring, drain it with `begin` or from `loop`.
+   *
+   * @param log Must outlive the api
+   * @return KoolApi&
+   */
+  KoolApi &setAccessLog(KoolApiAccessLog &log);
+
+#endif
+
+  /**
+   * @brief Set the CORS policy of webserver responses. Routes may set their own with `KoolApiPath::setCors`
+   *
+   * @param policy Must outlive the api. Default: koolApiDefaultCors
+   * @return KoolApi&
+   */
+  KoolApi &setCors(const KoolApiCors &policy);
+
+  /**
+   * @brief Parse only the uri, method and id before routing.
+   *
+   * Requests for unknown uris or methods are then rejected without parsing
+   * the body and params, which are parsed once a handler has matched.
+   * Costs a second pass over the input for accepted requests.
+   *
+   * @param envelopeFirst Default: false
+   * @return KoolApi&
+   */
+  KoolApi &setEnvelopeFirst(bool envelopeFirst);
+
+  /**
+   * @brief Share one response between identical GETs handled at the same time.
+   *
+   * A GET for the same route and params as one already running waits for its
+   * response rather than calling `get` again. Only useful when requests are
+   * processed concurrently, eg by an executor. Requests with an id are never shared.
+   *
+   * @param coalesce Default: false
+   * @return KoolApi&
+   */
+  KoolApi &setCoalescing(bool coalesce);
+
   /**
    * @brief Add a uri handler
    *
+   * The uri may be a template with `{name}` segments, eg "relays/{id}/state".
+   * Captured segments are available to the handler via `request->params`.
+   *
+   * Safe to call while requests are processed, which wait for it to finish.
+   *
    * @param uri uri path. Eg "/puppet"
    * @param handler uri handling class
+   * @param priority Class requests are queued in when run by an executor, control
+   * routes are run before others waiting. Default: API_PRIORITY_NORMAL
    */
-  KoolApi &on(const char *uri, KoolApiPath &handler);
+  KoolApi &on(const char *uri, KoolApiPath &handler, api_priority_t priority = API_PRIORITY_NORMAL);
 
   /**
    * @brief Process the request.
    *
    * If the methods `methodsAccepted` is set, anything other than those methods will respond 405 Not Allowed.
    *
+   * Json documents are borrowed from a pool of `KOOLAPI_DOC_POOL_SIZE`, when none
+   * are free the request is answered 503 Service Unavailable.
+   *
+   * A json array of requests is processed as a batch, each item with its own `id`.
+   * Responses, including any per item errors, are returned together in one array.
+   *
+   * May be called from several tasks at once, a handler can then run for
+   * more than one request at a time.
+   *
    * @param request The request object
    * @param methodsAccepted bitwise accepted methods. eg  (API_METHOD_GET | API_METHOD_PUT)
    */
   void process(ApiRequest &request, int methodsAccepted = (int)API_METHOD_ANY);
 
+  /**
+   * @brief Process a request on the executor, if one is set, or at once.
+   *
+   * The request must be created with `new`, it is deleted once answered.
+   * If the executor's queue is full it is answered 503 Service Unavailable.
+   *
+   * @param request
+   * @param methodsAccepted bitwise accepted methods. eg  (API_METHOD_GET | API_METHOD_PUT)
+   * @return bool false if answered 503
+   */
+  bool submit(ApiRequest *request, int methodsAccepted = (int)API_METHOD_ANY);
+
+#ifdef KOOLAPI_HAS_EXECUTOR
+
+  /**
+   * @brief Run handlers on the workers of `executor` rather than the task delivering requests.
+   *
+   * Webserver requests are then queued by `registerWith`, use `submit` for others.
+   * The document pool is grown to a pair per worker plus one for batch items,
+   * so the workers are not turned away with 503 while the pool is exhausted.
+   *
+   * @param executor Must outlive the api, started with `begin`
+   * @return KoolApi& the executor is not set if the documents cannot be allocated
+   */
+  KoolApi &setExecutor(KoolApiExecutor &executor);
+
+#endif
+
   /**
    * @brief Checks if the url supplied starts with the base url
    *
@@ -158,10 +295,11 @@ public:
   /**
    * @brief Register api with AsyncWebserver instance
    *
+   * Requests are traced like those of any other source, see `KOOLAPI_TRACE_POLICY`.
+   *
    * @param server
-   * @param logfunc
    */
-  void registerWith(AsyncWebServer &server, void (*logfunc)(AsyncWebServerRequest *request, const char *msg) = nullptr);
+  void registerWith(AsyncWebServer &server);
 
 #endif
 
@@ -186,16 +324,50 @@ protected:
   const char *_uriKey = nullptr;
 
   /**
-   * Handler class list
+   * Handler class list in registration order
    */
 
-  KoolApiPath **_handlerList;
+  KoolApiPath **_handlerList = nullptr;
+
+  /**
+   * @brief Route index sorted by path hash for binary search lookups
+   *
+   */
+  KoolApiRoute *_routeIndex = nullptr;
+
+  /**
+   * @brief Compile time route table, if supplied
+   *
+   */
+  const KoolApiRoute *_staticRoutes = nullptr;
+
+  size_t _staticRoutesLength = 0;
+
+  bool _staticRoutesSorted = false;
+
+  /**
+   * @brief Routes registered with `{name}` segments
+   *
+   */
+  KoolApiRouteTree _routeTree;
+
+  /**
+   * @brief Number of exact routes in `_routeIndex`
+   *
+   */
+  size_t _routeIndexLength = 0;
 
   /**
    * @brief The number of handlers used;
    *
    */
-  uint8_t _handlersLength = 0;
+  size_t _handlersLength = 0;
+
+  /**
+   * @brief Number of slots allocated in `_handlerList` & `_routeIndex`
+   *
+   */
+  size_t _handlersCapacity = 0;
 
   /**
    * @brief If set will enable the describer on the uri specified
@@ -203,22 +375,261 @@ protected:
    */
   const char *_describerUri = nullptr;
 
+  /**
+   * @brief CORS policy of routes without their own
+   *
+   */
+  const KoolApiCors *_cors = &koolApiDefaultCors;
+
+  /**
+   * @brief Serialised describer output, built on first use and released when routes change
+   *
+   * Shared so requests send it without holding `_routesLock`.
+   */
+  std::shared_ptr<char> _description;
+  size_t _descriptionLength = 0;
+
+  /**
+   * @brief Documents lent to requests while they are processed
+   *
+   */
+  KoolApiDocPool _docPool;
+
+  /**
+   * @brief Shared while routes are looked up, exclusive while added or described
+   *
+   */
+  mutable KoolApiSharedLock _routesLock;
+
+  /**
+   * @brief Whether requests are routed before the body is parsed
+   *
+   */
+  bool _envelopeFirst = false;
+
+  /**
+   * @brief GETs being handled, shared by identical requests
+   *
+   */
+  KoolApiFlights _flights;
+
+  bool _coalesce = false;
+
+  /**
+   * @brief Workers handlers are run on, nullptr to run them at once
+   *
+   */
+  KoolApiExecutor *_executor = nullptr;
+
+#ifdef KOOLAPI_METRICS
+
+  /**
+   * @brief If set will serve metrics on the uri specified
+   *
+   */
+  const char *_metricsUri = nullptr;
+
+  /**
+   * @brief Counters of requests not routed to a handler
+   *
+   */
+  KoolApiRouteMetrics _unroutedMetrics;
+
+  /**
+   * @brief Count a processed request against its route
+   *
+   * @param request
+   * @param handler nullptr if not routed
+   */
+  void _record(ApiRequest &request, KoolApiPath *handler);
+
+  /**
+   * @brief Send the metrics of every route
+   *
+   * @param request
+   */
+  void _sendMetrics(ApiRequest &request);
+
+  /**
+   * @brief Writes the metrics of every route into `buffer`
+   *
+   * @param buffer nullptr to only measure
+   * @param size Size of buffer
+   * @param prometheus Write Prometheus text rather than json
+   * @return size_t Length of the whole metrics, `size` or more if they were cut short
+   */
+  size_t _writeMetrics(char *buffer, size_t size, bool prometheus);
+
+#endif
+
+#ifdef KOOLAPI_ACCESS_LOG
+
+  /**
+   * @brief Log of processed requests, nullptr if none
+   *
+   */
+  KoolApiAccessLog *_accessLog = nullptr;
+
+  /**
+   * @brief Add a processed request to the access log
+   *
+   * @param request
+   * @param latency Microseconds taken
+   */
+  void _log(ApiRequest &request, uint32_t latency);
+
+#endif
+
+  /**
+   * @brief Route, parse & handle a request
+   *
+   * @param request
+   * @param methodsAccepted
+   * @return KoolApiPath* Handler the request was routed to, nullptr if none
+   */
+  KoolApiPath *_process(ApiRequest &request, int methodsAccepted);
+
+  /**
+   * @brief Parse the request, or only its envelope
+   *
+   * @param request
+   * @param envelope
+   * @return int error code if any
+   */
+  int _parse(ApiRequest &request, bool envelope);
+
+  /**
+   * @brief Class of the route a request is for, without processing it
+   *
+   * The request keeps the envelope read, so it is not parsed again by a worker.
+   *
+   * @param request
+   * @return api_priority_t API_PRIORITY_NORMAL if not known
+   */
+  api_priority_t _priorityOf(ApiRequest &request);
+
+  /**
+   * @brief Process a submitted request, then delete it
+   *
+   * @param request
+   * @param methodsAccepted
+   */
+  void _run(ApiRequest *request, int methodsAccepted);
+
+  /**
+   * @brief Answer a submitted request 503, then delete it
+   *
+   * @param request
+   */
+  static void _reject(ApiRequest *request);
+
+  /**
+   * @brief Grows handler storage so at least `required` entries fit
+   *
+   * @param required
+   */
+  void _reserveHandlers(size_t required);
+
   /**
    * @brief Returns the handler for the path specified
    *
    * @param path Path to search for
+   * @param routePath Set to the path the handler was registered with
    * @return ApiPath* || nullptr if not found
    */
-  KoolApiPath *_findHandler(const char *path);
+  KoolApiPath *_findHandler(const char *path, const char **routePath = nullptr);
+
+  /**
+   * @brief Find the handler of an exact or template uri
+   *
+   * @param uri
+   * @param captures Populated with any segments captured by a template
+   * @param routePath Set to the path the handler was registered with
+   * @return KoolApiPath* nullptr if not found
+   */
+  KoolApiPath *_route(const char *uri, KoolApiPathParams &captures, const char **routePath = nullptr);
 
   /**
-   * @brief Adds options for describing the api
+   * @brief Search a route table for an exact path
    *
-   * @param out
+   * @param routes
+   * @param length
+   * @param sorted Whether routes are ordered by hash
+   * @param path
+   * @param hash hash of `path`
+   * @return const KoolApiRoute* nullptr if not found
    */
-  void _describeApi(JsonObject &out);
+  static const KoolApiRoute *_searchRoutes(const KoolApiRoute *routes, size_t length, bool sorted, const char *path, uint32_t hash);
+
+  /**
+   * @brief Processes each item of a batch envelope and dispatches all responses as one array
+   *
+   * @param request Request holding the batch
+   * @param methodsAccepted
+   */
+  void _processBatch(ApiRequest &request, int methodsAccepted);
+
+  /**
+   * @brief Send the api description, building it if not already held
+   *
+   * @param request
+   */
+  void _sendDescription(ApiRequest &request);
+
+  /**
+   * @brief Builds `_description` if not already held
+   *
+   * @return bool false if out of memory
+   */
+  bool _describeApi();
+
+  /**
+   * @brief Writes the api description into `buffer`
+   *
+   * @param buffer nullptr to only measure
+   * @param size Size of buffer
+   * @return size_t Length of the description
+   */
+  size_t _writeDescription(char *buffer, size_t size);
+
+#ifdef _ESPAsyncWebServer_H_
+
+  /**
+   * @brief Process a webserver request, queued when there is an executor
+   *
+   * @param args ApiAsyncWebRequest constructor arguments
+   */
+  template <class... A>
+  void _processWeb(A... args)
+  {
+    if (_executor)
+    {
+      submit(new ApiAsyncWebRequest(args...));
+      return;
+    }
+
+    ApiAsyncWebRequest apiRequest(args...);
+    process(apiRequest);
+  }
+
+  /**
+   * @brief Reassembles webserver body chunks, processing the request once complete
+   *
+   * Bodies over `KOOLAPI_MAX_BODY_SIZE` are answered 413 from the first chunk.
+   */
+  void _onBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+
+  /**
+   * @brief Feeds body chunks to the handler's `bodyEvent`, processing the request once complete
+   *
+   * @return false if the handler does not stream bodies
+   */
+  bool _onStreamedBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total);
+
+#endif
 
 private:
+  friend class KoolApiExecutor;
 };
 
 #endif // __KOOLAPI_H__
@@ -0,0 +1,160 @@
+#include "KoolApiAccessLog.h"
+
+#include "KoolApiBases.h"
+
+KoolApiAccessLog &KoolApiAccessLog::setSink(Print &out)
+{
+  _out = &out;
+  _sink = nullptr;
+  return *this;
+}
+
+KoolApiAccessLog &KoolApiAccessLog::setSink(sink_t sink)
+{
+  _sink = sink;
+  _out = nullptr;
+  return *this;
+}
+
+bool KoolApiAccessLog::record(const ApiAccessEntry &entry)
+{
+  if (_entries.push(entry))
+    return true;
+
+  _dropped.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+size_t KoolApiAccessLog::drain(size_t max)
+{
+  ApiAccessEntry entry;
+  char line[KOOLAPI_ACCESS_LOG_URI_SIZE + 80];
+  size_t written = 0;
+
+  while (written < max && _entries.pop(entry))
+  {
+    if (_sink)
+    {
+      _sink(entry);
+    }
+    else if (_out)
+    {
+      size_t length = format(entry, line, sizeof(line));
+      _out->write((const uint8_t *)line, length);
+    }
+
+    ++written;
+  }
+
+  _logged.fetch_add(written, std::memory_order_relaxed);
+  return written;
+}
+
+size_t KoolApiAccessLog::format(const ApiAccessEntry &entry, char *buffer, size_t size)
+{
+  const char *method = koolApiMethodMap.codeToText(entry.method);
+
+  int length = snprintf(buffer, size, "%u %u.%u.%u.%u %s /%s %d %u %u %u\n",
+                        (unsigned)entry.time,
+                        // Addresses are held in network order
+                        (unsigned)(entry.client & 0xff),
+                        (unsigned)((entry.client >> 8) & 0xff),
+                        (unsigned)((entry.client >> 16) & 0xff),
+                        (unsigned)(entry.client >> 24),
+                        (method) ? method : "-",
+                        entry.uri,
+                        entry.status,
+                        (unsigned)entry.latency,
+                        (unsigned)entry.bytesIn,
+                        (unsigned)entry.bytesOut);
+
+  if (length < 0)
+    return 0;
+
+  return ((size_t)length < size) ? length : size - 1;
+}
+
+#ifdef KOOLAPI_HAS_ACCESS_LOG_TASK
+
+void KoolApiAccessLog::_work()
+{
+  while (_running.load(std::memory_order_acquire))
+  {
+    drain();
+
+#ifdef ARDUINO
+    vTaskDelay(pdMS_TO_TICKS(KOOLAPI_ACCESS_LOG_INTERVAL));
+#else
+    std::this_thread::sleep_for(std::chrono::milliseconds(KOOLAPI_ACCESS_LOG_INTERVAL));
+#endif
+  }
+
+  drain();
+}
+
+#ifdef ARDUINO
+
+bool KoolApiAccessLog::begin()
+{
+  if (_running.exchange(true, std::memory_order_acq_rel))
+    return true;
+
+  _draining.store(true, std::memory_order_release);
+
+  if (xTaskCreate(_task, "koolapilog", KOOLAPI_ACCESS_LOG_STACK_SIZE, this, tskIDLE_PRIORITY + 1, nullptr) != pdPASS)
+  {
+    _draining.store(false, std::memory_order_release);
+    _running.store(false, std::memory_order_release);
+    return false;
+  }
+
+  return true;
+}
+
+void KoolApiAccessLog::end()
+{
+  if (!_running.exchange(false, std::memory_order_acq_rel))
+    return;
+
+  while (_draining.load(std::memory_order_acquire))
+    vTaskDelay(1);
+}
+
+void KoolApiAccessLog::_task(void *log)
+{
+  auto self = (KoolApiAccessLog *)log;
+
+  self->_work();
+  self->_draining.store(false, std::memory_order_release);
+  vTaskDelete(nullptr);
+}
+
+#else
+
+bool KoolApiAccessLog::begin()
+{
+  if (_running.exchange(true, std::memory_order_acq_rel))
+    return true;
+
+  _thread = std::thread(&KoolApiAccessLog::_work, this);
+  return true;
+}
+
+void KoolApiAccessLog::end()
+{
+  if (!_running.exchange(false, std::memory_order_acq_rel))
+    return;
+
+  if (_thread.joinable())
+    _thread.join();
+}
+
+#endif
+
+#else
+
+void KoolApiAccessLog::end()
+{
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef __KOOLAPIACCESSLOG_H__
+#define __KOOLAPIACCESSLOG_H__
+
+#include "KoolApiClock.h"
+#include "KoolApiQueue.h"
+
+#include <Arduino.h>
+
+#ifndef KOOLAPI_ACCESS_LOG_SIZE
+#define KOOLAPI_ACCESS_LOG_SIZE 32 // Entries held until drained, a power of 2
+#endif
+
+#ifndef KOOLAPI_ACCESS_LOG_URI_SIZE
+#define KOOLAPI_ACCESS_LOG_URI_SIZE 40 // Bytes of the uri kept in each entry, longer are truncated
+#endif
+
+#ifndef KOOLAPI_ACCESS_LOG_INTERVAL
+#define KOOLAPI_ACCESS_LOG_INTERVAL 100 // Milliseconds between drains by the background task
+#endif
+
+#ifndef KOOLAPI_ACCESS_LOG_STACK_SIZE
+#define KOOLAPI_ACCESS_LOG_STACK_SIZE 3072 // Stack of the drain task, in bytes
+#endif
+
+// Draining in the background needs tasks, so is not available on the ESP8266
+#if defined(ESP32) || !defined(ARDUINO)
+#define KOOLAPI_HAS_ACCESS_LOG_TASK
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#else
+#include <thread>
+#endif
+#endif
+
+/**
+ * @brief A request as logged, fixed size so it is copied without allocating
+ *
+ */
+struct ApiAccessEntry
+{
+  /**
+   * @brief Milliseconds since start when answered
+   *
+   */
+  uint32_t time;
+
+  /**
+   * @brief IPv4 address of the client, 0 if not known
+   *
+   */
+  uint32_t client;
+
+  /**
+   * @brief Microseconds from receiving to answering
+   *
+   */
+  uint32_t latency;
+
+  uint32_t bytesIn;
+  uint32_t bytesOut;
+
+  /**
+   * @brief Code answered, 0 if none
+   *
+   */
+  int16_t status;
+
+  /**
+   * @brief api_method_t of the request
+   *
+   */
+  int8_t method;
+
+  char uri[KOOLAPI_ACCESS_LOG_URI_SIZE];
+};
+
+/**
+ * @brief Access log kept off the request path.
+ *
+ * Requests only copy an entry into a lock free ring, which is written to the
+ * sink later by `drain`, so slow sinks such as Serial or files never hold up
+ * the network stack. Entries arriving while the ring is full are dropped & counted.
+ */
+class KoolApiAccessLog
+{
+public:
+  typedef void (*sink_t)(const ApiAccessEntry &entry);
+
+  KoolApiAccessLog() {}
+
+  KoolApiAccessLog(const KoolApiAccessLog &) = delete;
+  KoolApiAccessLog &operator=(const KoolApiAccessLog &) = delete;
+
+  ~KoolApiAccessLog() { end(); }
+
+  /**
+   * @brief Write entries as lines of text, eg to Serial or a file
+   *
+   * @param out Must outlive the log
+   * @return KoolApiAccessLog&
+   */
+  KoolApiAccessLog &setSink(Print &out);
+
+  /**
+   * @brief Pass entries to a function, eg to keep them for a log endpoint
+   *
+   * @param sink
+   * @return KoolApiAccessLog&
+   */
+  KoolApiAccessLog &setSink(sink_t sink);
+
+  /**
+   * @brief Add an entry, safe from any task
+   *
+   * @param entry
+   * @return bool false if the ring is full, the entry is then dropped
+   */
+  bool record(const ApiAccessEntry &entry);
+
+  /**
+   * @brief Write waiting entries to the sink. Call from `loop` if not drained in the background.
+   *
+   * Only one task may drain at a time.
+   *
+   * @param max Most entries to write
+   * @return size_t Number written
+   */
+  size_t drain(size_t max = KOOLAPI_ACCESS_LOG_SIZE);
+
+#ifdef KOOLAPI_HAS_ACCESS_LOG_TASK
+
+  /**
+   * @brief Drain every `KOOLAPI_ACCESS_LOG_INTERVAL` milliseconds on a task of its own
+   *
+   * @return bool false if the task could not be started
+   */
+  bool begin();
+
+#endif
+
+  /**
+   * @brief Stop draining in the background, once the entries waiting are written
+   *
+   */
+  void end();
+
+  /**
+   * @brief Number of entries written to the sink
+   *
+   */
+  uint32_t logged() const { return _logged.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Number of entries dropped because the ring was full
+   *
+   */
+  uint32_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Number of entries waiting to be drained
+   *
+   */
+  size_t pending() const { return _entries.size(); }
+
+  /**
+   * @brief Format an entry as a line of text:
+   * time client method /uri status latency bytesIn bytesOut
+   *
+   * @param entry
+   * @param buffer
+   * @param size
+   * @return size_t Length of the line, truncated to fit
+   */
+  static size_t format(const ApiAccessEntry &entry, char *buffer, size_t size);
+
+private:
+  KoolApiQueue<ApiAccessEntry, KOOLAPI_ACCESS_LOG_SIZE> _entries;
+
+  std::atomic<uint32_t> _logged{0};
+  std::atomic<uint32_t> _dropped{0};
+
+  Print *_out = nullptr;
+  sink_t _sink = nullptr;
+
+  std::atomic<bool> _running{false};
+
+#ifdef KOOLAPI_HAS_ACCESS_LOG_TASK
+
+  /**
+   * @brief Drain loop of the background task
+   *
+   */
+  void _work();
+
+#ifdef ARDUINO
+  std::atomic<bool> _draining{false};
+
+  static void _task(void *log);
+#else
+  std::thread _thread;
+#endif
+#endif
+};
+
+#endif // __KOOLAPIACCESSLOG_H__
@@ -1,28 +1,433 @@
 #include "KoolApiBases.h"
 
+namespace
+{
+  // Copies a view to a null terminated buffer for the C conversion functions
+  bool viewToBuffer(const ApiParamView &v, char *buffer, size_t size)
+  {
+    if (!v || !v.length || v.length >= size)
+      return false;
+
+    memcpy(buffer, v.data, v.length);
+    buffer[v.length] = 0;
+    return true;
+  }
+
+  bool viewEquals(const ApiParamView &v, const char *text)
+  {
+    return strlen(text) == v.length && strncasecmp(v.data, text, v.length) == 0;
+  }
+}
+
+long ApiParamBase::getInt(const char *name, long fallback) const
+{
+  char buffer[24];
+  char *end;
+
+  if (!viewToBuffer(getView(name), buffer, sizeof(buffer)))
+    return fallback;
+
+  long value = strtol(buffer, &end, 10);
+  return (*end) ? fallback : value;
+}
+
+float ApiParamBase::getFloat(const char *name, float fallback) const
+{
+  char buffer[32];
+  char *end;
+
+  if (!viewToBuffer(getView(name), buffer, sizeof(buffer)))
+    return fallback;
+
+  float value = strtof(buffer, &end);
+  return (*end) ? fallback : value;
+}
+
+bool ApiParamBase::getBool(const char *name, bool fallback) const
+{
+  auto v = getView(name);
+
+  if (!v)
+    return fallback;
+
+  if (viewEquals(v, "true") || viewEquals(v, "1") || viewEquals(v, "on") || viewEquals(v, "yes"))
+    return true;
+
+  if (viewEquals(v, "false") || viewEquals(v, "0") || viewEquals(v, "off") || viewEquals(v, "no"))
+    return false;
+
+  return fallback;
+}
+
+ApiParamView ApiJsonParams::getView(const char *name) const
+{
+  auto v = _pathView(name);
+
+  if (v)
+    return v;
+
+  const char *str = _params[name].as<const char *>();
+  return {str, (str) ? strlen(str) : 0};
+}
+
+long ApiJsonParams::getInt(const char *name, long fallback) const
+{
+  JsonVariant v = _params[name];
+
+  // Json numbers are read directly, strings & path segments are converted
+  return (!_pathFind(name) && v.is<float>()) ? v.as<long>() : ApiParamBase::getInt(name, fallback);
+}
+
+float ApiJsonParams::getFloat(const char *name, float fallback) const
+{
+  JsonVariant v = _params[name];
+  return (!_pathFind(name) && v.is<float>()) ? v.as<float>() : ApiParamBase::getFloat(name, fallback);
+}
+
+bool ApiJsonParams::getBool(const char *name, bool fallback) const
+{
+  JsonVariant v = _params[name];
+  return (!_pathFind(name) && v.is<bool>()) ? v.as<bool>() : ApiParamBase::getBool(name, fallback);
+}
+
+bool ApiJsonParams::serialize(char *buffer, size_t size, size_t &length) const
+{
+  // Measured first, serializeJson cuts short what does not fit without saying so
+  if (measureJson(_params) >= size)
+    return false;
+
+  length = serializeJson(_params, buffer, size);
+  return true;
+}
+
 void ApiRequest::send(int code)
+{
+  KOOLAPI_TIME_PHASE(*this, API_PHASE_SERIALISE);
+  _send(code);
+}
+
+void ApiRequest::_send(int code)
+{
+  if (_dispatched) return;
+
+  if (code >= 400)
+  {
+    if (_flight)
+      KoolApiFlights::fail(_flight, code);
+
+    _error(code, true);
+  }
+  else if (_flight && _sendShared(code))
+    return;
+  else if (_cache && code == 200 && _sendStored(code))
+    return;
+  else if (_method == API_METHOD_HEAD)
+  {
+    _dispatchHead(code, koolApiMeasure(*outdoc, format));
+    _sent(code, 0);
+  }
+  else
+  {
+    _dispatch(code);
+    _sentOutput(code);
+  }
+
+  _dispatched = true;
+}
+
+bool ApiRequest::_sendStored(int code)
+{
+  std::shared_ptr<const char> body;
+  size_t length;
+
+  {
+    // Another request for the route may be replacing the body
+    KoolApiLock::Guard guard(_cache->lock);
+
+    if (!_cache->store(*outdoc, _etag, _enveloped, format))
+      return false;
+
+    body = _cache->body();
+    length = _cache->length();
+  }
+
+  _sendBody(code, body.get(), length, format);
+  return true;
+}
+
+bool ApiRequest::_sendShared(int code)
+{
+  if (!KoolApiFlights::store(_flight, code, *outdoc))
+    return false;
+
+  if (_cache && code == 200)
+  {
+    KoolApiLock::Guard guard(_cache->lock);
+    _cache->store(*outdoc, _etag, _enveloped, format);
+  }
+
+  // Held by this request until it leaves the flight
+  _sendBody(code, _flight->body, _flight->length, format);
+  return true;
+}
+
+void ApiRequest::_sendBody(int code, const char *body, size_t length, api_format_t bodyFormat)
+{
+  if (_method == API_METHOD_HEAD)
+    _dispatchHead(code, length);
+  else if (bodyFormat == format)
+    _dispatchEncoded(code, body, length);
+  else
+    _dispatchRaw(code, body, length);
+
+  _sent(code, (_method == API_METHOD_HEAD) ? 0 : length);
+  _dispatched = true;
+}
+
+void ApiRequest::_dispatchHead(int code, size_t length) const
+{
+  outdoc->clear();
+
+  if (_id)
+    (*outdoc)["id"] = _id;
+
+  (*outdoc)["length"] = length;
+  _dispatch(code);
+}
+
+void ApiRequest::stream(int code, KoolApiStreamFiller filler)
 {
   if (_dispatched) return;
-  (code < 400) ? _dispatch(code) : _error(code, true);
+
+  if (code >= 400)
+  {
+    send(code);
+    return;
+  }
+
+  // Items replace any `data` object, the rest of the envelope is kept
+  if (_enveloped)
+    outdoc->remove("data");
+
+  // Streamed lengths are not known until sent
+  _dispatchStream(code, std::make_shared<KoolApiStream>(filler));
+  _sent(code, 0);
   _dispatched = true;
 }
 
+void ApiRequest::_dispatchStream(int code, std::shared_ptr<KoolApiStream> stream)
+{
+  JsonArray items = (_enveloped) ? outdoc->createNestedArray("data") : outdoc->to<JsonArray>();
+
+  while (stream->next())
+  {
+    if (!items.add(stream->item()))
+      break;
+  }
+
+  _dispatch(code);
+}
+
+KoolApiDeferred ApiRequest::defer()
+{
+  if (_dispatched)
+    return KoolApiDeferred();
+
+  ApiRequest *detached = _detach();
+
+  if (!detached)
+    return KoolApiDeferred();
+
+  detached->_id = _id;
+  detached->_method = _method;
+  detached->format = format;
+  detached->_cors = _cors;
+  detached->_enveloped = _enveloped;
+  detached->_uriKey = _uriKey;
+  detached->_routePath = _routePath;
+
+  // Answered only through the handle from now on
+  _dispatched = true;
+
+  return KoolApiDeferred(detached);
+}
+
+uint8_t *ApiRequest::_retain(const uint8_t *data, size_t length)
+{
+  _retained.reset(new (std::nothrow) uint8_t[length]);
+
+  if (_retained)
+    memcpy(_retained.get(), data, length);
+
+  return _retained.get();
+}
+
+bool ApiRequest::_acquireDocs(KoolApiDocPool &pool)
+{
+  if (!_slot && !outdoc)
+  {
+    _slot = pool.acquire();
+
+    if (!_slot)
+      return false;
+
+    doc = &_slot->doc;
+    outdoc = &_slot->outdoc;
+  }
+
+  return true;
+}
+
 void ApiRequest::_error(int code, bool complete)
 {
-  outdoc.clear();
-  const char *msg = "message";
+  // Errors are never cached, so must not be sent with the tag of the response they replace
+  _etag[0] = 0;
 
-  if (code)
+  if (!complete)
   {
-    const char *txt = _statusMap.codeToText(code);
+    if (outdoc)
+    {
+      outdoc->clear();
 
-    if (_id)
-      outdoc["id"] = _id;
+      if (_id)
+        (*outdoc)["id"] = _id;
 
-    outdoc["error"] = code;
-    outdoc[msg] = txt ? txt : "Unspecified condition.";
+      (*outdoc)["error"] = code;
+      (*outdoc)["message"] = koolApiError(code).message;
+    }
+
+    return;
   }
 
-  if (complete)
-    _dispatch(code);
+  const KoolApiError &error = koolApiError(code);
+
+  // Sent from the constant body when nothing needs splicing in, no documents are touched
+  if (format == API_FORMAT_JSON && !_id && error.body)
+  {
+    _dispatchEncoded(code, error.body, error.length);
+    _sent(code, error.length);
+  }
+  else
+  {
+    char body[KOOLAPI_ERROR_BODY_SIZE];
+    size_t length = (format == API_FORMAT_MSGPACK) ? koolApiErrorMsgPack(body, code, _id)
+                                                   : koolApiErrorJson(body, code, _id);
+
+    _dispatchEncoded(code, body, length);
+    _sent(code, length);
+  }
+
+  _dispatched = true;
+}
+
+void ApiRequest::_readEnvelope(JsonObject jParse, const char *requestKey, bool shortKeys)
+{
+  this->_id = jParse["id"];
+
+  // Use brief json keys if in that mode
+  if (shortKeys)
+  {
+    const char *surl = jParse["U"];
+    this->_method = koolApiMethodMap.textToCode(surl, API_METHOD_UNKNOWN);
+    const char *urlPos = (surl) ? strchr(surl, '|') : nullptr;
+    this->uri = (urlPos) ? urlPos + 1 : nullptr;
+  }
+  else
+  {
+    this->uri = jParse[requestKey];
+    const char *methodStr = jParse["method"];
+    this->_method = koolApiMethodMap.textToCode(methodStr, API_METHOD_UNKNOWN);
+  }
+}
+
+void ApiRequest::_readBody(JsonObject jParse, bool shortKeys)
+{
+  // Get requests should have no json body
+  if (_method != API_METHOD_GET)
+    this->json = jParse[(shortKeys) ? "B" : "body"];
+
+  this->_out = outdoc->to<JsonObject>();
+
+  _emplaceParams<ApiJsonParams>(jParse[(shortKeys) ? "P" : "params"].as<JsonObject>());
+}
+
+void ApiRequest::_envelopeFilter(JsonDocument &filter, const char *requestKey)
+{
+  filter["id"] = true;
+  filter["method"] = true;
+  filter["U"] = true;
+  filter[requestKey] = true;
+}
+
+bool ApiRequest::_isBatchInput(const char *input, size_t length, api_format_t format)
+{
+  if (!input)
+    return false;
+
+  if (format == API_FORMAT_MSGPACK)
+  {
+    // fixarray, array 16 or array 32
+    uint8_t marker = (uint8_t)input[0];
+    return (marker & 0xf0) == 0x90 || marker == 0xdc || marker == 0xdd;
+  }
+
+  for (size_t i = 0; !length || i < length; ++i)
+  {
+    if (input[i] != ' ' && input[i] != '\t' && input[i] != '\r' && input[i] != '\n')
+      return input[i] == '[';
+  }
+
+  return false;
+}
+
+const char *ApiRequest::_peekInput(const char *input, size_t length, const char *requestKey, bool shortKeys)
+{
+  if (!input || _isBatchInput(input, length, format))
+    return nullptr;
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(4)> filter;
+  StaticJsonDocument<KOOLAPI_PEEK_DOC_SIZE> envelope;
+
+  _envelopeFilter(filter, requestKey);
+
+  // Input is const so is left intact for the full parse. Invalid input is left
+  // for parseEnvelope to reject as it would without queueing.
+  if (_deserializeInput(envelope, input, length, DeserializationOption::Filter(filter)) || !envelope.is<JsonObject>())
+    return nullptr;
+
+  _readEnvelope(envelope.as<JsonObject>(), requestKey, shortKeys);
+
+  if (uri)
+  {
+    size_t uriLength = strlen(uri) + 1;
+    _peekedUri.reset(new (std::nothrow) char[uriLength]);
+
+    if (!_peekedUri)
+      return uri = nullptr;
+
+    memcpy(_peekedUri.get(), uri, uriLength);
+    uri = _peekedUri.get();
+  }
+
+  _envelopeRead = true;
+  return uri;
+}
+
+JsonDocument *ApiRequest::_rawDocument(const char *body, size_t length, JsonDocument &fallback) const
+{
+  // Raw bodies are built before the output document is needed, so it is free to reuse
+  JsonDocument *target = (outdoc) ? outdoc : &fallback;
+  DeserializationError error = deserializeJson(*target, body, length);
+
+  if (!error)
+    return target;
+
+  // The client still gets an answer, in its own format
+  char errorBody[KOOLAPI_ERROR_BODY_SIZE];
+  int code = (error == DeserializationError::NoMemory) ? 507 : 500;
+  size_t errorLength = (format == API_FORMAT_MSGPACK) ? koolApiErrorMsgPack(errorBody, code, _id)
+                                                      : koolApiErrorJson(errorBody, code, _id);
+
+  _dispatchEncoded(code, errorBody, errorLength);
+  return nullptr;
 }
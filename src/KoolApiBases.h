@@ -1,7 +1,17 @@
 #ifndef __KOOLAPIBASES_H__
 #define __KOOLAPIBASES_H__
 
+#include "KoolApiBodyParser.h"
+#include "KoolApiCache.h"
+#include "KoolApiCors.h"
+#include "KoolApiDeferred.h"
 #include "KoolApiDocuments.h"
+#include "KoolApiErrors.h"
+#include "KoolApiFlights.h"
+#include "KoolApiLock.h"
+#include "KoolApiMetrics.h"
+#include "KoolApiStream.h"
+#include "KoolApiTrace.h"
 #include "KoolUtils.h"
 
 #include "ESPAsyncWebServer.h"
@@ -16,12 +26,26 @@ typedef enum
   API_METHOD_DELETE = 0b00000100,
   API_METHOD_PUT = 0b00001000,
   API_METHOD_PATCH = 0b00010000,
+  API_METHOD_HEAD = 0b00100000,
   API_METHOD_OPTIONS = 0b01000000,
   API_METHOD_ANY = 0b01111111,
 
   API_METHOD_UNKNOWN = -1
 } api_method_t;
 
+/**
+ * @brief Scheduling class of a route, lower classes are run first when requests wait
+ *
+ */
+typedef enum
+{
+  API_PRIORITY_CONTROL, // Short actions needing low latency, eg relays
+  API_PRIORITY_NORMAL,
+  API_PRIORITY_BULK, // Slow or large responses, eg history & logs
+
+  API_PRIORITY_CLASSES
+} api_priority_t;
+
 template <class T, uint8_t S>
 class KoolApiTextMapper
 {
@@ -105,34 +129,104 @@ public:
 };
 
 // Method map
-const KoolApiTextMapper<api_method_t, 6> koolApiMethodMap = {
+const KoolApiTextMapper<api_method_t, 7> koolApiMethodMap = {
     {API_METHOD_GET,
      API_METHOD_PUT,
      API_METHOD_POST,
      API_METHOD_PATCH,
      API_METHOD_DELETE,
+     API_METHOD_HEAD,
      API_METHOD_OPTIONS},
     {"GET",
      "PUT",
      "POST",
      "PATCH",
      "DELETE",
+     "HEAD",
      "OPTIONS"}};
 
-// Error status map
-const KoolApiTextMapper<int, 6> _statusMap = {
-    {400,
-     401,
-     403,
-     404,
-     405,
-     406},
-    {"Bad Request",
-     "Unauthorized",
-     "Forbidden",
-     "Not Found",
-     "Method Not Allowed",
-     "Not Acceptable"}};
+#include <new>
+
+#ifndef KOOLAPI_MAX_QUERY_PARAMS
+#define KOOLAPI_MAX_QUERY_PARAMS 8 // Webserver params indexed per request, any others are searched
+#endif
+
+#ifndef KOOLAPI_PARAMS_STORAGE_SIZE
+#define KOOLAPI_PARAMS_STORAGE_SIZE (48 + KOOLAPI_MAX_QUERY_PARAMS * (sizeof(void *) + sizeof(uint32_t))) // Bytes reserved in each request for its params object
+#endif
+
+#ifndef KOOLAPI_PEEK_DOC_SIZE
+#define KOOLAPI_PEEK_DOC_SIZE (JSON_OBJECT_SIZE(4) + 96) // Document reading the uri of requests to be queued
+#endif
+
+// Responses are counted for both metrics & the access log
+#if defined(KOOLAPI_METRICS) || defined(KOOLAPI_ACCESS_LOG)
+#define KOOLAPI_COUNTS_RESPONSES
+#endif
+
+#ifndef KOOLAPI_MAX_PATH_PARAMS
+#define KOOLAPI_MAX_PATH_PARAMS 4 // Maximum captured segments of a path template
+#endif
+
+/**
+ * @brief Segments captured by a path template such as "relays/{id}/state"
+ *
+ * Names point into the registered template and values into the request uri,
+ * so nothing is copied or allocated.
+ */
+class KoolApiPathParams
+{
+public:
+  struct param_t
+  {
+    const char *name;
+    const char *value;
+    uint8_t nameLength;
+    uint8_t valueLength;
+  };
+
+  const uint8_t length() const { return _length; }
+
+  /**
+   * @brief Find a captured segment by name
+   *
+   * @param name
+   * @return const param_t* nullptr if not captured
+   */
+  const param_t *find(const char *name) const
+  {
+    if (name)
+    {
+      for (uint8_t i = 0; i < _length; ++i)
+      {
+        if (strncmp(_params[i].name, name, _params[i].nameLength) == 0 && name[_params[i].nameLength] == 0)
+          return &_params[i];
+      }
+    }
+
+    return nullptr;
+  }
+
+private:
+  friend class KoolApiRouteTree;
+
+  param_t _params[KOOLAPI_MAX_PATH_PARAMS];
+  uint8_t _length = 0;
+};
+
+/**
+ * @brief Non owning view of a param value, valid while the request is.
+ *
+ * Not null terminated.
+ */
+struct ApiParamView
+{
+  const char *data;
+  size_t length;
+
+  explicit operator bool() const { return data != nullptr; }
+};
+
 /**
  * @brief Base class for api params
  *
@@ -146,7 +240,81 @@ public:
   virtual bool has(const char *name) const = 0;
   virtual String get(const char *name) const = 0;
 
+  /**
+   * @brief Get a param value without copying it
+   *
+   * @param name
+   * @return ApiParamView data is nullptr if not found or not a string
+   */
+  virtual ApiParamView getView(const char *name) const = 0;
+
+  /**
+   * @brief Get a param as an integer
+   *
+   * @param name
+   * @param fallback Returned if missing or not a number
+   * @return long
+   */
+  virtual long getInt(const char *name, long fallback = 0) const;
+
+  /**
+   * @brief Get a param as a float
+   *
+   * @param name
+   * @param fallback Returned if missing or not a number
+   * @return float
+   */
+  virtual float getFloat(const char *name, float fallback = 0) const;
+
+  /**
+   * @brief Get a param as a bool. Accepts true/false, 1/0, on/off & yes/no.
+   *
+   * @param name
+   * @param fallback Returned if missing or not recognised
+   * @return bool
+   */
+  virtual bool getBool(const char *name, bool fallback = false) const;
+
+  /**
+   * @brief Write every param to `buffer`, so requests with equal params can share a response
+   *
+   * Only compared with the output of the same class, so any form will do as
+   * long as equal params give equal bytes.
+   *
+   * @param buffer
+   * @param size
+   * @param length Set to the length written
+   * @return bool false if params cannot be written or do not fit, the request is then never shared
+   */
+  virtual bool serialize(char *buffer, size_t size, size_t &length) const { return false; }
+
   friend class KoolApi;
+
+protected:
+  /**
+   * @brief Segments captured from the path template, if any
+   *
+   */
+  const KoolApiPathParams *_pathParams = nullptr;
+
+  const int _pathLength() const { return (_pathParams) ? _pathParams->length() : 0; }
+
+  const KoolApiPathParams::param_t *_pathFind(const char *name) const
+  {
+    return (_pathParams) ? _pathParams->find(name) : nullptr;
+  }
+
+  /**
+   * @brief View of a captured path segment
+   *
+   * @param name
+   * @return ApiParamView data is nullptr if not captured
+   */
+  ApiParamView _pathView(const char *name) const
+  {
+    auto p = _pathFind(name);
+    return (p) ? ApiParamView{p->value, p->valueLength} : ApiParamView{nullptr, 0};
+  }
 };
 
 /**
@@ -162,7 +330,7 @@ public:
    * @brief The uri of the request
    *
    */
-  const char *uri;
+  const char *uri = nullptr;
 
   /**
    * @brief The request input JsonObject.
@@ -170,19 +338,35 @@ public:
    */
   JsonObject json;
 
+  /**
+   * @brief State left by `KoolApiPath::bodyEvent` for a streamed body
+   *
+   */
+  void *bodyContext = nullptr;
+
   /**
    * @brief The request params populated by api handlers.
    *
+   * Includes any segments captured by a path template.
    */
   ApiParamBase *params = nullptr;
 
-  // std::unique_ptr<ApiParamBase> params; - Couldnt get make_un
+  /**
+   * @brief Format input is read & output written in.
+   *
+   * MessagePack is honoured by char and websocket requests, webserver requests are always json.
+   */
+  api_format_t format = API_FORMAT_JSON;
 
   /**
    * @brief Destroy the Api Request object
    *
    */
-  virtual ~ApiRequest() { if (params) delete params; }
+  virtual ~ApiRequest()
+  {
+    _destroyParams();
+    KoolApiDocPool::release(_slot);
+  }
 
   /**
 	 * @brief Send code and response data to request client
@@ -193,11 +377,92 @@ public:
 	 */
   void send(int code);
 
+  /**
+   * @brief Send code and stream a json array produced one item at a time by `filler`.
+   *
+   * For output too large for the output document. Items are wrapped in the `data`
+   * key when the uri or id are returned. `filler` may be called after the handler
+   * returns, so must not capture anything that goes out of scope.
+   *
+   * @param code HTTP Response code.
+   * @param filler Called for each item until it returns false
+   */
+  void stream(int code, KoolApiStreamFiller filler);
+
+  /**
+   * @brief Answer later, from any task, through the handle returned.
+   *
+   * For handlers that take too long to finish before returning. The handler
+   * returns without sending and the request is answered by `KoolApiDeferred::send`.
+   * Webserver & websocket requests can be deferred, others must be answered at once.
+   * The handle may be sent or dropped by the handler itself, no lock is held around it.
+   *
+   * @return KoolApiDeferred empty if the request cannot be deferred or is already answered
+   */
+  KoolApiDeferred defer();
+
 protected:
-  KOOLAPI_create_IN_doc;
-  KOOLAPI_create_OUT_outdoc;
+  /**
+   * @brief Input & output documents, borrowed from the api pool while processed
+   *
+   */
+  JsonDocument *doc = nullptr;
+  JsonDocument *outdoc = nullptr;
+
+  KoolApiDocPool::slot_t *_slot = nullptr;
+
+  /**
+   * @brief Storage `params` is constructed in, so requests need no heap allocation
+   *
+   */
+  alignas(void *) uint8_t _paramsStorage[KOOLAPI_PARAMS_STORAGE_SIZE];
+
+  /**
+   * @brief Construct the params object in place
+   *
+   * @tparam T ApiParamBase type
+   * @param args constructor arguments
+   */
+  template <class T, class... A>
+  void _emplaceParams(A... args)
+  {
+    static_assert(sizeof(T) <= KOOLAPI_PARAMS_STORAGE_SIZE, "Params type too large, increase KOOLAPI_PARAMS_STORAGE_SIZE");
+    static_assert(alignof(T) <= alignof(void *), "Params type alignment not supported");
+
+    _destroyParams();
+    params = new (_paramsStorage) T(args...);
+  }
+
+  /**
+   * @brief Destroy the params object, its storage belongs to the request
+   *
+   */
+  void _destroyParams()
+  {
+    if (params)
+      params->~ApiParamBase();
+
+    params = nullptr;
+  }
+
+  /**
+   * @brief Borrow documents from `pool` if not already holding some
+   *
+   * Requests given documents by their caller, such as batch items, take none.
+   *
+   * @param pool
+   * @return true if documents are available
+   */
+  bool _acquireDocs(KoolApiDocPool &pool);
 
   DeserializationError _deserializationError;
+
+  /**
+   * @brief Segments captured when routed through a path template
+   *
+   */
+  KoolApiPathParams _pathParams;
+
   /**
    * @brief Called by the processor to parse the request
    *
@@ -206,12 +471,176 @@ protected:
    */
   virtual int parse(const char *urlBase, const char *requestKey) = 0;
 
+  /**
+   * @brief Called by the processor in envelope first mode to parse only
+   * what is needed to route the request: uri, method and id.
+   *
+   * The full `parse` follows once a handler has matched. Defaults to a full parse.
+   *
+   * @param urlBase
+   * @param requestKey
+   * @return int error code if any
+   */
+  virtual int parseEnvelope(const char *urlBase, const char *requestKey)
+  {
+    _parsed = true;
+    return parse(urlBase, requestKey);
+  }
+
+  /**
+   * @brief Whether the full request, including body and params, has been parsed
+   *
+   */
+  bool _parsed = false;
+
+  /**
+   * @brief Requests of a batch envelope, null unless the input was an array
+   *
+   */
+  JsonArray _batch;
+
+  /**
+   * @brief Checks for a batch envelope, a json array of requests
+   *
+   * @param input
+   * @param length Length of input, 0 if null terminated
+   * @param format Format of input
+   * @return true if the first non whitespace character, or msgpack byte, opens an array
+   */
+  static bool _isBatchInput(const char *input, size_t length = 0, api_format_t format = API_FORMAT_JSON);
+
+  /**
+   * @brief Parse input in the request's format
+   *
+   * @param target
+   * @param input
+   * @param length Length of input, 0 if null terminated (json only)
+   * @param options Any ArduinoJson deserialization options
+   * @return DeserializationError
+   */
+  template <class TInput, class... TOptions>
+  DeserializationError _deserializeInput(JsonDocument &target, TInput input, size_t length, TOptions... options) const
+  {
+    if (format == API_FORMAT_MSGPACK)
+      return (length) ? deserializeMsgPack(target, input, length, options...) : deserializeMsgPack(target, input, options...);
+
+    return (length) ? deserializeJson(target, input, length, options...) : deserializeJson(target, input, options...);
+  }
+
+  /**
+   * @brief Parse a raw json body so it can be re-encoded by non json transports
+   *
+   * @param body
+   * @param length
+   * @param fallback Used when no output document is borrowed
+   * @return JsonDocument* nullptr if the body could not be parsed, an error has then been sent instead
+   */
+  JsonDocument *_rawDocument(const char *body, size_t length, JsonDocument &fallback) const;
+
+  /**
+   * @brief Whether the request uses short keys, inherited by batch items
+   *
+   */
+  virtual bool _usesShortKeys() const { return false; }
+
+  /**
+   * @brief Reads id, method and uri from a parsed request object
+   *
+   * @param jParse
+   * @param requestKey
+   * @param shortKeys Read the combined "U" key instead
+   */
+  void _readEnvelope(JsonObject jParse, const char *requestKey, bool shortKeys = false);
+
+  /**
+   * @brief Reads the body and params from a parsed request object
+   *
+   * @param jParse
+   * @param shortKeys Read "B" and "P" keys instead
+   */
+  void _readBody(JsonObject jParse, bool shortKeys = false);
+
+  /**
+   * @brief Filter keeping only the envelope keys of a request
+   *
+   * @param filter Document to populate
+   * @param requestKey
+   */
+  static void _envelopeFilter(JsonDocument &filter, const char *requestKey);
+
   /**
    * @brief Whether the request has been dispatched
    *
    */
   bool _dispatched = false;
 
+  /**
+   * @brief Decendants copy any input they only borrow, so the request can be
+   * processed after the transport's callback returns.
+   *
+   * @return bool false if out of memory
+   */
+  virtual bool _retainInput() { return true; }
+
+  /**
+   * @brief Copy of borrowed input made by `_retainInput`
+   *
+   */
+  std::unique_ptr<uint8_t[]> _retained;
+
+  /**
+   * @brief Copy `length` bytes of `data` into `_retained`
+   *
+   * @param data
+   * @param length
+   * @return uint8_t* The copy, nullptr if out of memory
+   */
+  uint8_t *_retain(const uint8_t *data, size_t length);
+
+  /**
+   * @brief Decendants find the uri of the request without processing it, so it can be queued by class
+   *
+   * What is read to find it is kept, `parseEnvelope` then need not read it again.
+   *
+   * @param urlBase
+   * @param requestKey
+   * @return const char* Valid while the request lives, nullptr if not known, eg for batches
+   */
+  virtual const char *_peekUri(const char *urlBase, const char *requestKey) { return nullptr; }
+
+  /**
+   * @brief Read only the envelope of a json or msgpack request, keeping its id, method and uri
+   *
+   * @param input
+   * @param length 0 if null terminated
+   * @param requestKey
+   * @param shortKeys
+   * @return const char* The uri, nullptr if not found
+   */
+  const char *_peekInput(const char *input, size_t length, const char *requestKey, bool shortKeys);
+
+  /**
+   * @brief Set once `_peekInput` has read the envelope
+   *
+   */
+  bool _envelopeRead = false;
+
+  /**
+   * @brief Copy of the uri read by `_peekInput`, the envelope it was read from is gone
+   *
+   */
+  std::unique_ptr<char[]> _peekedUri;
+
+  /**
+   * @brief Decendants tell whether a retained request's client is still there to answer
+   *
+   * Only a hint, the client can go straight after. Answers to a client that
+   * has gone are dropped by the transport.
+   *
+   * @return bool false if the client has already gone
+   */
+  virtual bool _connected() const { return true; }
+
   /**
    * @brief Identifier for the message
    *
@@ -233,25 +662,240 @@ protected:
    */
   virtual void _dispatch(int code) const = 0;
 
+  /**
+   * @brief Decendants stream output to destination if supported.
+   *
+   * Default collects as many items as fit the output document and dispatches that.
+   *
+   * @param code
+   * @param stream
+   */
+  virtual void _dispatchStream(int code, std::shared_ptr<KoolApiStream> stream);
+
+  /**
+   * @brief Whether output is wrapped with the uri and/or id keys
+   *
+   */
+  bool _enveloped = false;
+
+  /**
+   * @brief Decendants send an already serialised body to destination
+   *
+   * @param code
+   * @param body json
+   * @param length
+   */
+  virtual void _dispatchRaw(int code, const char *body, size_t length) const = 0;
+
+  /**
+   * @brief Decendants send a body already encoded in the request's `format`, eg an error
+   *
+   * Default sends it as raw json, for transports that only speak json.
+   *
+   * @param code
+   * @param body
+   * @param length
+   */
+  virtual void _dispatchEncoded(int code, const char *body, size_t length) const { _dispatchRaw(code, body, length); }
+
+  /**
+   * @brief Decendants send a plain text body, eg Prometheus metrics
+   *
+   * Default sends it as raw json, for transports without content types.
+   *
+   * @param code
+   * @param body Null terminated
+   * @param length
+   */
+  virtual void _dispatchText(int code, const char *body, size_t length) const { _dispatchRaw(code, body, length); }
+
   /**
    * @brief Decendants send OPTIONS to destination if supported
    *
+   * @param body Prebuilt json options list
+   * @param length
+   * @param methods Prebuilt Allow-Methods value
+   */
+  virtual void _sendOptions(const char *body, size_t length, const char *methods) const {};
+
+  /**
+   * @brief CORS policy of the route, or of the api until routed
+   *
+   */
+  const KoolApiCors *_cors = &koolApiDefaultCors;
+
+  /**
+   * @brief Decendants answer a HEAD request with the size of the body a GET would send.
+   *
+   * Default sends `{"length": n}` as transports without headers have nowhere else to put it.
+   *
+   * @param code
+   * @param length
+   */
+  virtual void _dispatchHead(int code, size_t length) const;
+
+  /**
+   * @brief Decendants check whether the client already holds the response tagged `_etag`
+   *
+   * @return bool true to answer 304 Not Modified
+   */
+  virtual bool _matchesETag() const { return false; }
+
+  /**
+   * @brief Send a serialised body, or only its size to a HEAD request
+   *
+   * @param code
+   * @param body
+   * @param length
+   * @param bodyFormat Format of body, json is re-encoded for clients using another
+   */
+  void _sendBody(int code, const char *body, size_t length, api_format_t bodyFormat);
+
+  /**
+   * @brief Store the output in `_cache` and send it from there
+   *
+   * @param code
+   * @return bool false if it could not be stored, nothing is then sent
+   */
+  bool _sendStored(int code);
+
+  /**
+   * @brief GET being shared with identical requests, if leading one
+   *
+   */
+  KoolApiFlights::flight_t *_flight = nullptr;
+
+  /**
+   * @brief Serialise the output into `_flight` and send it from there
+   *
+   * @param code
+   * @return bool false if out of memory, nothing is then sent
+   */
+  bool _sendShared(int code);
+
+  /**
+   * @brief Route cache a successful GET response is stored in, set if not fresh
+   *
+   */
+  KoolApiResponseCache *_cache = nullptr;
+
+  /**
+   * @brief Entity tag of a cacheable response, empty if none
+   *
+   */
+  char _etag[KoolApiResponseCache::ETAG_SIZE] = {0};
+
+  /**
+   * @brief Length of the input, for metrics & the access log
+   *
+   */
+  virtual size_t _inputLength() const { return 0; }
+
+  /**
+   * @brief Decendants return the IPv4 address of the client, for the access log
+   *
+   * @return uint32_t 0 if not known
+   */
+  virtual uint32_t _remoteAddress() const { return 0; }
+
+#ifdef KOOLAPI_COUNTS_RESPONSES
+
+  /**
+   * @brief Code answered & bytes received & sent, 0 until answered
+   *
+   */
+  int _status = 0;
+  size_t _bytesIn = 0;
+  size_t _bytesOut = 0;
+
+#endif
+
+#ifdef KOOLAPI_METRICS
+
+  /**
+   * @brief Microseconds spent in each phase
+   *
+   */
+  uint32_t _phases[API_PHASES] = {0};
+
+#endif
+
+  /**
+   * @brief Path of the route the request was for, nullptr until routed
+   *
+   */
+  const char *_routePath = nullptr;
+
+  /**
+   * @brief Key the output is wrapped with the route path in, if any
+   *
+   */
+  const char *_uriKey = nullptr;
+
+  /**
+   * @brief Decendants create a request that answers the same client, without
+   * borrowing anything from the transport's callback
+   *
+   * @return ApiRequest* nullptr if the transport cannot answer later
+   */
+  virtual ApiRequest *_detach() const { return nullptr; }
+
+  /**
+   * @brief Note the response for metrics, the access log & tracing, nothing unless compiled in
+   *
    * @param code
+   * @param length Bytes sent
    */
-  virtual void _sendOptions() const {};
+  void _sent(int code, size_t length)
+  {
+#ifdef KOOLAPI_COUNTS_RESPONSES
+    _status = code;
+    _bytesOut += length;
+#endif
+
+    if (code >= 400)
+      KoolApiTrace::trace(API_TRACE_ERROR, this, uri, _routePath, code);
+
+    KoolApiTrace::trace(API_TRACE_DISPATCHED, this, uri, _routePath, code, length);
+  }
 
   /**
-   * @brief Clears any output add sends an error message with code.
+   * @brief Note the output document was sent, measuring it only if responses are counted or traced
    *
+   * @param code
+   */
+  void _sentOutput(int code)
+  {
+#ifndef KOOLAPI_COUNTS_RESPONSES
+    if (!KoolApiTrace::enabled)
+      return;
+#endif
+
+    _sent(code, koolApiMeasure(*outdoc, format));
+  }
+
+  /**
+   * @brief Send code and the output, `send` times it
    *
    * @param code
-   * @param complete Whether the response should be immediately dispatched. Default true
+   */
+  void _send(int code);
+
+  /**
+   * @brief Sends the prebuilt error body of code, with the id spliced in.
+   *
+   * Output documents are left untouched unless not completing. Any entity tag is cleared.
+   *
+   * @param code
+   * @param complete Whether the response should be immediately dispatched, otherwise
+   * the error replaces the output document. Default true
    */
   void _error(int code, bool complete = true);
 
-  private:
+private:
   friend class KoolApiPath;
   friend class KoolApi;
+  friend class KoolApiDeferred;
 };
 
 
@@ -266,11 +910,25 @@ public:
 
   virtual ~ApiJsonParams(){}
 
-  const int length() const override { return _params.size(); }
+  const int length() const override { return _params.size() + _pathLength(); }
+
+  bool has(const char *name) const override { return _pathFind(name) || _params.containsKey(name); }
+
+  String get(const char *name) const override
+  {
+    auto p = _pathFind(name);
+    return (p) ? String(p->value, p->valueLength) : _params[name].as<String>();
+  }
+
+  ApiParamView getView(const char *name) const override;
+
+  long getInt(const char *name, long fallback = 0) const override;
+
+  float getFloat(const char *name, float fallback = 0) const override;
 
-  bool has(const char *name) const override { return _params.containsKey(name); }
+  bool getBool(const char *name, bool fallback = false) const override;
 
-  String get(const char *name) const override { return _params[name].as<String>(); }
+  bool serialize(char *buffer, size_t size, size_t &length) const override;
 };
 
 #endif // __KOOLAPIBASES_H__
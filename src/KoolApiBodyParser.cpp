@@ -0,0 +1,317 @@
+#include "KoolApiBodyParser.h"
+
+#include <string.h>
+
+namespace
+{
+  const char *digits(const char *s)
+  {
+    while (*s >= '0' && *s <= '9')
+      ++s;
+
+    return s;
+  }
+
+  /**
+   * @brief Whether `s` is a json number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+   *
+   */
+  bool isNumber(const char *s)
+  {
+    if (*s == '-')
+      ++s;
+
+    if (*s == '0')
+      ++s;
+    else if (*s >= '1' && *s <= '9')
+      s = digits(s);
+    else
+      return false;
+
+    if (*s == '.')
+    {
+      const char *start = ++s;
+
+      if ((s = digits(s)) == start)
+        return false;
+    }
+
+    if (*s == 'e' || *s == 'E')
+    {
+      if (*++s == '+' || *s == '-')
+        ++s;
+
+      const char *start = s;
+
+      if ((s = digits(s)) == start)
+        return false;
+    }
+
+    return !*s;
+  }
+}
+
+bool KoolApiBodyParser::feed(const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len && _state != STATE_ERROR; ++i)
+  {
+    if (!_consume((char)data[i]))
+      _state = STATE_ERROR;
+  }
+
+  return _state != STATE_ERROR;
+}
+
+bool KoolApiBodyParser::finish()
+{
+  // A number at the root has no terminating character
+  if (_state == STATE_NUMBER || _state == STATE_LITERAL)
+  {
+    if (!_endToken())
+      _state = STATE_ERROR;
+  }
+
+  return _state == STATE_DONE;
+}
+
+bool KoolApiBodyParser::_consume(char c)
+{
+  switch (_state)
+  {
+  case STATE_STRING:
+    if (c == '"')
+    {
+      _state = STATE_IDLE;
+      _token[_tokenLength] = 0;
+
+      if (_isKey)
+      {
+        memcpy(_key, _token, _tokenLength + 1);
+        _hasKey = true;
+        _expect = EXPECT_COLON;
+        return true;
+      }
+
+      _emit(API_BODY_STRING, _token, _tokenLength);
+      _valueDone();
+      return true;
+    }
+
+    if (c == '\\')
+    {
+      _state = STATE_ESCAPE;
+      return true;
+    }
+
+    // Control characters must be escaped
+    if ((uint8_t)c < 0x20)
+      return false;
+
+    return _push(c);
+
+  case STATE_ESCAPE:
+  {
+    const char *from = "\"\\/bfnrt";
+    const char *to = "\"\\/\b\f\n\r\t";
+    const char *pos = strchr(from, c);
+
+    if (c == 'u')
+    {
+      _unicode = 0;
+      _unicodeDigits = 0;
+      _state = STATE_UNICODE;
+      return true;
+    }
+
+    if (!c || !pos)
+      return false;
+
+    _state = STATE_STRING;
+    return _push(to[pos - from]);
+  }
+
+  case STATE_UNICODE:
+  {
+    uint8_t digit = (c >= '0' && c <= '9')   ? c - '0'
+                    : (c >= 'a' && c <= 'f') ? c - 'a' + 10
+                    : (c >= 'A' && c <= 'F') ? c - 'A' + 10
+                                             : 0xFF;
+
+    if (digit == 0xFF)
+      return false;
+
+    _unicode = (_unicode << 4) | digit;
+
+    if (++_unicodeDigits < 4)
+      return true;
+
+    _state = STATE_STRING;
+
+    // Encoded as UTF-8
+    if (_unicode < 0x80)
+      return _push(_unicode);
+
+    if (_unicode < 0x800)
+      return _push(0xC0 | (_unicode >> 6)) && _push(0x80 | (_unicode & 0x3F));
+
+    return _push(0xE0 | (_unicode >> 12)) && _push(0x80 | ((_unicode >> 6) & 0x3F)) && _push(0x80 | (_unicode & 0x3F));
+  }
+
+  case STATE_NUMBER:
+    if ((c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-')
+      return _push(c);
+
+    return _endToken() && _consume(c);
+
+  case STATE_LITERAL:
+    if (c >= 'a' && c <= 'z')
+      return _push(c);
+
+    return _endToken() && _consume(c);
+
+  case STATE_DONE:
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+
+  case STATE_IDLE:
+  {
+    bool value = _expect == EXPECT_VALUE || _expect == EXPECT_VALUE_OR_CLOSE;
+
+    switch (c)
+    {
+    case ' ':
+    case '\t':
+    case '\r':
+    case '\n':
+      return true;
+    case ':':
+      if (_expect != EXPECT_COLON)
+        return false;
+
+      _expect = EXPECT_VALUE;
+      return true;
+    case ',':
+      if (_expect != EXPECT_COMMA_OR_CLOSE)
+        return false;
+
+      _expect = (_inObject()) ? EXPECT_KEY : EXPECT_VALUE;
+      return true;
+    case '{':
+      return value && _open(true);
+    case '[':
+      return value && _open(false);
+    case '}':
+      return (_expect == EXPECT_KEY_OR_CLOSE || _expect == EXPECT_COMMA_OR_CLOSE) && _close(true);
+    case ']':
+      return (_expect == EXPECT_VALUE_OR_CLOSE || _expect == EXPECT_COMMA_OR_CLOSE) && _close(false);
+    case '"':
+      _isKey = _expect == EXPECT_KEY || _expect == EXPECT_KEY_OR_CLOSE;
+
+      if (!_isKey && !value)
+        return false;
+
+      _tokenLength = 0;
+      _state = STATE_STRING;
+      return true;
+    default:
+      if (!value)
+        return false;
+
+      _tokenLength = 0;
+
+      if ((c >= '0' && c <= '9') || c == '-')
+        _state = STATE_NUMBER;
+      else if (c == 't' || c == 'f' || c == 'n')
+        _state = STATE_LITERAL;
+      else
+        return false;
+
+      return _push(c);
+    }
+  }
+
+  default:
+    return false;
+  }
+}
+
+bool KoolApiBodyParser::_push(char c)
+{
+  if (_tokenLength + 1 >= sizeof(_token))
+    return false;
+
+  _token[_tokenLength++] = c;
+  return true;
+}
+
+bool KoolApiBodyParser::_open(bool isObject)
+{
+  if (_depth >= 32)
+    return false;
+
+  if (isObject)
+    _stack |= (1UL << _depth);
+  else
+    _stack &= ~(1UL << _depth);
+
+  ++_depth;
+  _emit((isObject) ? API_BODY_OBJECT_START : API_BODY_ARRAY_START, nullptr, 0);
+  _expect = (isObject) ? EXPECT_KEY_OR_CLOSE : EXPECT_VALUE_OR_CLOSE;
+
+  return true;
+}
+
+bool KoolApiBodyParser::_close(bool isObject)
+{
+  if (!_depth || _inObject() != isObject)
+    return false;
+
+  _hasKey = false;
+  _emit((isObject) ? API_BODY_OBJECT_END : API_BODY_ARRAY_END, nullptr, 0);
+  --_depth;
+  _valueDone();
+
+  return true;
+}
+
+bool KoolApiBodyParser::_endToken()
+{
+  _token[_tokenLength] = 0;
+
+  if (_tokenLength == 4 && strcmp(_token, "null") == 0)
+    _emit(API_BODY_NULL, nullptr, 0);
+  else if (strcmp(_token, "true") == 0 || strcmp(_token, "false") == 0)
+    _emit(API_BODY_BOOL, _token, _tokenLength);
+  else if (isNumber(_token))
+    _emit(API_BODY_NUMBER, _token, _tokenLength);
+  else
+    return false;
+
+  _state = STATE_IDLE;
+  _valueDone();
+  return true;
+}
+
+void KoolApiBodyParser::_valueDone()
+{
+  if (_depth)
+    _expect = EXPECT_COMMA_OR_CLOSE;
+  else
+    _state = STATE_DONE;
+}
+
+void KoolApiBodyParser::_emit(api_body_event_t type, const char *value, size_t length)
+{
+  ApiBodyEvent event = {
+      .type = type,
+      .key = (_hasKey) ? _key : nullptr,
+      .value = value,
+      .length = length,
+      .depth = _depth,
+      .context = &context};
+
+  // A key applies to the one element following it
+  if (type != API_BODY_OBJECT_END && type != API_BODY_ARRAY_END)
+    _hasKey = false;
+
+  _callback(_arg, event);
+}
@@ -0,0 +1,170 @@
+#ifndef __KOOLAPIBODYPARSER_H__
+#define __KOOLAPIBODYPARSER_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef KOOLAPI_MAX_BODY_TOKEN
+#define KOOLAPI_MAX_BODY_TOKEN 64 // Longest key or value, in bytes, of a streamed body
+#endif
+
+typedef enum
+{
+  API_BODY_OBJECT_START,
+  API_BODY_OBJECT_END,
+  API_BODY_ARRAY_START,
+  API_BODY_ARRAY_END,
+  API_BODY_STRING,
+  API_BODY_NUMBER,
+  API_BODY_BOOL,
+  API_BODY_NULL,
+  API_BODY_ERROR // Body invalid or the client gone, the handler method will not be called
+} api_body_event_t;
+
+/**
+ * @brief An element of a json body, as delivered to `KoolApiPath::bodyEvent`
+ *
+ */
+struct ApiBodyEvent
+{
+  api_body_event_t type;
+
+  /**
+   * @brief Member name when the element is within an object, otherwise nullptr
+   *
+   */
+  const char *key;
+
+  /**
+   * @brief Null terminated text of strings, numbers and bools, otherwise nullptr
+   *
+   */
+  const char *value;
+  size_t length;
+
+  /**
+   * @brief Nesting depth. The root container is 1, as are its members.
+   *
+   */
+  uint8_t depth;
+
+  /**
+   * @brief Slot for handler state kept between events of one request.
+   *
+   * Handed to the handler as `request->bodyContext` once the body is complete.
+   */
+  void **context;
+};
+
+/**
+ * @brief Incremental json tokenizer.
+ *
+ * Input may be fed in chunks of any size, split anywhere, and is reported as
+ * events using constant memory. Usable with any source, eg a Stream.
+ */
+class KoolApiBodyParser
+{
+public:
+  typedef void (*callback_t)(void *arg, const ApiBodyEvent &event);
+
+  /**
+   * @brief Construct a new parser
+   *
+   * @param callback Receives each event
+   * @param arg Passed to callback
+   */
+  KoolApiBodyParser(callback_t callback, void *arg) : _callback(callback), _arg(arg) {}
+
+  /**
+   * @brief Parse the next chunk of input
+   *
+   * @param data
+   * @param len
+   * @return false if the input is invalid or a token too long
+   */
+  bool feed(const uint8_t *data, size_t len);
+
+  /**
+   * @brief Signal the end of input
+   *
+   * @return true if the input was one complete json value
+   */
+  bool finish();
+
+  bool failed() const { return _state == STATE_ERROR; }
+
+  /**
+   * @brief Whether a complete json value has been read
+   *
+   */
+  bool done() const { return _state == STATE_DONE; }
+
+  /**
+   * @brief Slot for handler state, see ApiBodyEvent::context
+   *
+   */
+  void *context = nullptr;
+
+private:
+  enum state_t : uint8_t
+  {
+    STATE_IDLE,
+    STATE_STRING,
+    STATE_ESCAPE,
+    STATE_UNICODE,
+    STATE_NUMBER,
+    STATE_LITERAL,
+    STATE_DONE,
+    STATE_ERROR
+  };
+
+  /**
+   * @brief Token allowed next, outside of strings and numbers
+   *
+   */
+  enum expect_t : uint8_t
+  {
+    EXPECT_VALUE,
+    EXPECT_VALUE_OR_CLOSE, // After '['
+    EXPECT_KEY,
+    EXPECT_KEY_OR_CLOSE, // After '{'
+    EXPECT_COLON,
+    EXPECT_COMMA_OR_CLOSE
+  };
+
+  callback_t _callback;
+  void *_arg;
+
+  state_t _state = STATE_IDLE;
+
+  /**
+   * @brief One bit per open container, set for objects
+   *
+   */
+  uint32_t _stack = 0;
+  uint8_t _depth = 0;
+
+  expect_t _expect = EXPECT_VALUE;
+  bool _isKey = false;
+  bool _hasKey = false;
+
+  uint16_t _unicode = 0;
+  uint8_t _unicodeDigits = 0;
+
+  char _token[KOOLAPI_MAX_BODY_TOKEN];
+  size_t _tokenLength = 0;
+
+  char _key[KOOLAPI_MAX_BODY_TOKEN];
+
+  bool _consume(char c);
+  bool _push(char c);
+  bool _open(bool isObject);
+  bool _close(bool isObject);
+  bool _endToken();
+  void _valueDone();
+  void _emit(api_body_event_t type, const char *value, size_t length);
+
+  bool _inObject() const { return _depth && (_stack >> (_depth - 1)) & 1; }
+};
+
+#endif // __KOOLAPIBODYPARSER_H__
@@ -0,0 +1,48 @@
+#include "KoolApiCache.h"
+#include "KoolUtils.h"
+
+void KoolApiResponseCache::etag(char *buffer, uint32_t version, const char *path)
+{
+  snprintf(buffer, ETAG_SIZE, "\"%08x%08x\"", (unsigned)koolutils::hash(path ? path : ""), (unsigned)version);
+}
+
+bool KoolApiResponseCache::fresh(const char *etag, bool enveloped, api_format_t format) const
+{
+  return _body && _enveloped == enveloped && _format == format && strcmp(_etag, etag) == 0;
+}
+
+bool KoolApiResponseCache::store(JsonVariantConst source, const char *etag, bool enveloped, api_format_t format)
+{
+  size_t length = koolApiMeasure(source, format);
+
+  if (length > KOOLAPI_CACHE_MAX_SIZE)
+  {
+    clear();
+    return false;
+  }
+
+  // Always a new buffer: one handed out may still be sent by a request that
+  // dropped the lock, and use_count() does not order its reads before our writes
+  char *body = (char *)malloc(length + 1);
+
+  if (!body)
+  {
+    clear();
+    return false;
+  }
+
+  _length = koolApiSerialize(source, body, length + 1, format);
+  _body = std::shared_ptr<const char>(body, free);
+  memcpy(_etag, etag, ETAG_SIZE);
+  _enveloped = enveloped;
+  _format = format;
+
+  return true;
+}
+
+void KoolApiResponseCache::clear()
+{
+  _body.reset();
+  _length = 0;
+  _etag[0] = 0;
+}
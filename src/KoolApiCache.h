@@ -0,0 +1,95 @@
+#ifndef __KOOLAPICACHE_H__
+#define __KOOLAPICACHE_H__
+
+#include "KoolApiDocuments.h"
+#include "KoolApiLock.h"
+
+#include <memory>
+
+#ifndef KOOLAPI_CACHE_MAX_SIZE
+#define KOOLAPI_CACHE_MAX_SIZE 1024 // Largest serialised GET response a route keeps
+#endif
+
+/**
+ * @brief Serialised GET response of a route, kept while its version is unchanged.
+ *
+ * Identified by an entity tag made from the route and the handler's version,
+ * and held in the format of the client that stored it.
+ * Callers hold `lock` as requests for the route may be processed concurrently,
+ * but not while sending: they take a reference to the body and send that.
+ */
+class KoolApiResponseCache
+{
+public:
+  /**
+   * @brief Size of an entity tag, quoted hex plus terminator
+   *
+   */
+  static const size_t ETAG_SIZE = 19;
+
+  KoolApiResponseCache() {}
+  KoolApiResponseCache(const KoolApiResponseCache &) = delete;
+  KoolApiResponseCache &operator=(const KoolApiResponseCache &) = delete;
+
+  /**
+   * @brief Write the entity tag of `version` of `path` into `buffer`
+   *
+   * @param buffer At least ETAG_SIZE chars
+   * @param version
+   * @param path
+   */
+  static void etag(char *buffer, uint32_t version, const char *path);
+
+  /**
+   * @brief Whether the body held is the one tagged `etag`
+   *
+   * @param etag
+   * @param enveloped Whether the body wraps its output in `data`
+   * @param format
+   * @return bool
+   */
+  bool fresh(const char *etag, bool enveloped, api_format_t format) const;
+
+  /**
+   * @brief Serialise and keep `source`, replacing any body held
+   *
+   * @param source
+   * @param etag
+   * @param enveloped
+   * @param format
+   * @return bool false if too large or out of memory, nothing is then held
+   */
+  bool store(JsonVariantConst source, const char *etag, bool enveloped, api_format_t format);
+
+  /**
+   * @brief The body held, kept alive by the caller's reference after it is replaced
+   *
+   */
+  std::shared_ptr<const char> body() const { return _body; }
+  size_t length() const { return _length; }
+
+  /**
+   * @brief Free the body held
+   *
+   */
+  void clear();
+
+  /**
+   * @brief Held while the body is checked and sent, or replaced
+   *
+   */
+  KoolApiLock lock;
+
+private:
+  /**
+   * @brief Never written once published, replaced whole by `store`
+   *
+   */
+  std::shared_ptr<const char> _body;
+  size_t _length = 0;
+  char _etag[ETAG_SIZE] = {0};
+  bool _enveloped = false;
+  api_format_t _format = API_FORMAT_JSON;
+};
+
+#endif // __KOOLAPICACHE_H__
@@ -0,0 +1,40 @@
+#ifndef __KOOLAPICLOCK_H__
+#define __KOOLAPICLOCK_H__
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+/**
+ * @brief Microseconds since start, wrapping every ~71 minutes
+ *
+ * @return uint32_t
+ */
+inline uint32_t koolApiMicros()
+{
+#ifdef ARDUINO
+  return micros();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+/**
+ * @brief Milliseconds since start
+ *
+ * @return uint32_t
+ */
+inline uint32_t koolApiMillis()
+{
+#ifdef ARDUINO
+  return millis();
+#else
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+#endif // __KOOLAPICLOCK_H__
@@ -0,0 +1,41 @@
+#ifndef __KOOLAPICORS_H__
+#define __KOOLAPICORS_H__
+
+#include <stdint.h>
+
+/**
+ * @brief CORS headers added to webserver responses, for the whole api or a route.
+ *
+ * Values are sent as given so must outlive the api, string literals are ideal.
+ */
+struct KoolApiCors
+{
+  /**
+   * @brief Access-Control-Allow-Origin. nullptr sends no CORS headers
+   *
+   */
+  const char *origin;
+
+  /**
+   * @brief Access-Control-Allow-Headers. nullptr to omit
+   *
+   */
+  const char *headers;
+
+  /**
+   * @brief Whether to send Access-Control-Allow-Credentials
+   *
+   */
+  bool credentials;
+
+  /**
+   * @brief Access-Control-Max-Age of preflight responses in seconds. nullptr to omit
+   *
+   */
+  const char *maxAge;
+};
+
+// Policy used unless another is set
+const KoolApiCors koolApiDefaultCors = {"*", "*", true, nullptr};
+
+#endif // __KOOLAPICORS_H__
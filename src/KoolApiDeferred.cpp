@@ -0,0 +1,234 @@
+#include "KoolApiDeferred.h"
+
+#include "KoolApiBases.h"
+
+namespace
+{
+  // Writes to `buffer`, or only measures when it is nullptr
+  struct encoder_t
+  {
+    char *buffer;
+    size_t pos;
+
+    void bytes(const void *data, size_t length)
+    {
+      if (buffer)
+        memcpy(buffer + pos, data, length);
+
+      pos += length;
+    }
+
+    void byte(uint8_t b) { bytes(&b, 1); }
+
+    void text(const char *str) { bytes(str, strlen(str)); }
+
+    void msgPackString(const char *str)
+    {
+      size_t length = strlen(str);
+
+      // fixstr, str8, str16 or str32, lengths are big endian
+      if (length < 32)
+      {
+        byte(0xa0 | length);
+      }
+      else if (length <= 0xff)
+      {
+        byte(0xd9);
+        byte(length);
+      }
+      else if (length <= 0xffff)
+      {
+        byte(0xda);
+        byte(length >> 8);
+        byte(length);
+      }
+      else
+      {
+        byte(0xdb);
+        byte(length >> 24);
+        byte(length >> 16);
+        byte(length >> 8);
+        byte(length);
+      }
+
+      bytes(str, length);
+    }
+  };
+}
+
+struct KoolApiDeferred::state_t
+{
+  KoolApiLock lock;
+  std::unique_ptr<ApiRequest> request;
+  bool sent = false;
+
+  ~state_t()
+  {
+    // Dropped without an answer, so the client is not left waiting
+    if (!sent)
+      _answer(*this, 503, JsonVariantConst());
+  }
+};
+
+KoolApiDeferred::KoolApiDeferred(ApiRequest *request) : _state(std::make_shared<state_t>())
+{
+  _state->request.reset(request);
+}
+
+bool KoolApiDeferred::send(int code, JsonVariantConst data)
+{
+  if (!_state)
+    return false;
+
+  {
+    KoolApiLock::Guard guard(_state->lock);
+
+    if (_state->sent)
+      return false;
+
+    _state->sent = true;
+  }
+
+  // Only the caller that set `sent` gets here, so it answers without the lock
+  return _answer(*_state, code, data);
+}
+
+bool KoolApiDeferred::send(int code)
+{
+  StaticJsonDocument<16> empty;
+  return send(code, empty.to<JsonObject>());
+}
+
+bool KoolApiDeferred::_sendBody(int code, const char *body, size_t length)
+{
+  if (!_state)
+    return false;
+
+  {
+    KoolApiLock::Guard guard(_state->lock);
+
+    if (_state->sent)
+      return false;
+
+    _state->sent = true;
+  }
+
+  ApiRequest &request = *_state->request;
+
+  if (request._connected())
+    request._sendBody(code, body, length, request.format);
+
+  return true;
+}
+
+bool KoolApiDeferred::sent() const
+{
+  if (!_state)
+    return true;
+
+  KoolApiLock::Guard guard(_state->lock);
+  return _state->sent;
+}
+
+bool KoolApiDeferred::_answer(state_t &state, int code, JsonVariantConst data)
+{
+  ApiRequest &request = *state.request;
+  bool answered = true;
+
+  // The client may have gone meanwhile, there is then no one to answer
+  if (request._connected())
+  {
+    if (code >= 400)
+    {
+      request._error(code);
+    }
+    else
+    {
+      size_t length = _encode(request, data, nullptr);
+      char *body = (char *)malloc(length + 1);
+
+      if (body)
+      {
+        _encode(request, data, body);
+        request._dispatchEncoded(code, body, length);
+        request._sent(code, length);
+        request._dispatched = true;
+        free(body);
+      }
+      else
+      {
+        request._error(503);
+        answered = false;
+      }
+    }
+  }
+
+  return answered;
+}
+
+size_t KoolApiDeferred::_encode(const ApiRequest &request, JsonVariantConst data, char *buffer)
+{
+  encoder_t out = {buffer, 0};
+  bool msgPack = request.format == API_FORMAT_MSGPACK;
+  bool uri = request._uriKey && request._routePath;
+  uint32_t id = request._id;
+
+  // Same envelope as `KoolApiPath::_handle` builds
+  if (request._enveloped && msgPack)
+  {
+    out.byte(0x80 | (((uri) ? 1 : 0) + ((id) ? 1 : 0) + 1));
+
+    if (uri)
+    {
+      out.msgPackString(request._uriKey);
+      out.msgPackString(request._routePath);
+    }
+
+    if (id)
+    {
+      out.msgPackString("id");
+      out.byte(0xce);
+      out.byte(id >> 24);
+      out.byte(id >> 16);
+      out.byte(id >> 8);
+      out.byte(id);
+    }
+
+    out.msgPackString("data");
+  }
+  else if (request._enveloped)
+  {
+    out.byte('{');
+
+    if (uri)
+    {
+      out.byte('"');
+      out.text(request._uriKey);
+      out.text("\":\"");
+      out.text(request._routePath);
+      out.text("\",");
+    }
+
+    if (id)
+    {
+      char number[20];
+      snprintf(number, sizeof(number), "\"id\":%u,", (unsigned)id);
+      out.text(number);
+    }
+
+    out.text("\"data\":");
+  }
+
+  size_t length = koolApiMeasure(data, request.format);
+
+  // Room for the null terminator json adds was allocated
+  if (buffer)
+    koolApiSerialize(data, buffer + out.pos, length + 1, request.format);
+
+  out.pos += length;
+
+  if (request._enveloped && !msgPack)
+    out.byte('}');
+
+  return out.pos;
+}
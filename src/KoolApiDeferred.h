@@ -0,0 +1,105 @@
+#ifndef __KOOLAPIDEFERRED_H__
+#define __KOOLAPIDEFERRED_H__
+
+#include "KoolApiDocuments.h"
+
+#include <memory>
+
+class ApiRequest;
+
+/**
+ * @brief Completion handle of a request answered after its handler returns.
+ *
+ * Returned by `ApiRequest::defer`. Holds only what the transport needs to
+ * answer, no documents, so is cheap to keep while slow work runs elsewhere.
+ * Copies share the request, which is answered once by whichever sends first.
+ * If every copy goes without sending, the request is answered 503.
+ */
+class KoolApiDeferred
+{
+public:
+  /**
+   * @brief An empty handle, nothing can be sent with it
+   *
+   */
+  KoolApiDeferred() {}
+
+  /**
+   * @brief Whether there is a request to answer
+   *
+   */
+  explicit operator bool() const { return _state != nullptr; }
+
+  /**
+   * @brief Send code and `data` in the request's format, from any task.
+   *
+   * `data` is wrapped with the uri and/or id as the handler's output would be.
+   * Codes of 400 or more send the error body instead.
+   *
+   * @param code HTTP Response code.
+   * @param data
+   * @return bool false if already sent or out of memory, clients that have gone are treated as sent
+   */
+  bool send(int code, JsonVariantConst data);
+
+  /**
+   * @brief Send code with an empty object
+   *
+   * @param code HTTP Response code.
+   * @return bool false if already sent
+   */
+  bool send(int code);
+
+  /**
+   * @brief Whether the request has been answered
+   *
+   */
+  bool sent() const;
+
+private:
+  friend class ApiRequest;
+  friend class KoolApiFlights;
+
+  struct state_t;
+
+  std::shared_ptr<state_t> _state;
+
+  /**
+   * @brief Take ownership of a request detached from its transport's callback
+   *
+   * @param request
+   */
+  explicit KoolApiDeferred(ApiRequest *request);
+
+  /**
+   * @brief Encode `data` in its envelope, as the handler's output would be
+   *
+   * @param request
+   * @param data
+   * @param buffer nullptr to only measure
+   * @return size_t Length of the body
+   */
+  static size_t _encode(const ApiRequest &request, JsonVariantConst data, char *buffer);
+
+  /**
+   * @brief Send a body already serialised in the request's format, for shared GETs
+   *
+   * @param code
+   * @param body
+   * @param length
+   * @return bool false if already sent
+   */
+  bool _sendBody(int code, const char *body, size_t length);
+
+  /**
+   * @brief Answer unless the client has already gone
+   *
+   * @param state
+   * @param code
+   * @param data
+   * @return bool false if out of memory
+   */
+  static bool _answer(state_t &state, int code, JsonVariantConst data);
+};
+
+#endif // __KOOLAPIDEFERRED_H__
@@ -24,4 +24,201 @@
 #define KOOLAPI_create_OUT_outdoc StaticJsonDocument<KOOLAPI_MAX_OUT_SIZE> outdoc;
 #endif
 
+#ifndef KOOLAPI_DOC_POOL_SIZE
+#define KOOLAPI_DOC_POOL_SIZE 2 // Number of requests that can hold json documents at once, grown for an executor's workers
+#endif
+
+#include "KoolApiLock.h"
+
+#include <atomic>
+#include <memory>
+#include <new>
+
+/**
+ * @brief Wire format of a request's input & output
+ *
+ */
+typedef enum
+{
+  API_FORMAT_JSON,
+  API_FORMAT_MSGPACK
+} api_format_t;
+
+/**
+ * @brief Length of `source` serialised in `format`, without a terminator
+ *
+ */
+inline size_t koolApiMeasure(JsonVariantConst source, api_format_t format)
+{
+  return (format == API_FORMAT_MSGPACK) ? measureMsgPack(source) : measureJson(source);
+}
+
+/**
+ * @brief Serialise `source` in `format` into `buffer`
+ *
+ * @param source
+ * @param buffer
+ * @param size Size of buffer, json is truncated to leave room for its terminator
+ * @param format
+ * @return size_t Bytes written
+ */
+inline size_t koolApiSerialize(JsonVariantConst source, char *buffer, size_t size, api_format_t format)
+{
+  return (format == API_FORMAT_MSGPACK) ? serializeMsgPack(source, buffer, size) : serializeJson(source, buffer, size);
+}
+
+/**
+ * @brief Pool of input & output documents borrowed by requests while processed.
+ *
+ * Keeps the documents off the stack of the task delivering the request. Holds
+ * `KOOLAPI_DOC_POOL_SIZE` slots, more can be added with `reserve` but none are
+ * ever removed.
+ */
+class KoolApiDocPool
+{
+public:
+  struct slot_t
+  {
+    KOOLAPI_create_IN_doc
+    KOOLAPI_create_OUT_outdoc
+    std::atomic<bool> used;
+  };
+
+  KoolApiDocPool()
+  {
+    for (auto &slot : _slots)
+      slot.used = false;
+  }
+
+  ~KoolApiDocPool()
+  {
+    block_t *block = _blocks.load(std::memory_order_acquire);
+
+    while (block)
+    {
+      block_t *next = block->next;
+      delete block;
+      block = next;
+    }
+  }
+
+  KoolApiDocPool(const KoolApiDocPool &) = delete;
+  KoolApiDocPool &operator=(const KoolApiDocPool &) = delete;
+
+  /**
+   * @brief Grow the pool to at least `length` slots, safe while slots are borrowed
+   *
+   * @param length
+   * @return bool false if out of memory, the pool is then left as it was
+   */
+  bool reserve(size_t length)
+  {
+    KoolApiLock::Guard guard(_lock);
+
+    if (length <= _length)
+      return true;
+
+    std::unique_ptr<block_t> block(new (std::nothrow) block_t);
+
+    if (!block)
+      return false;
+
+    block->length = length - _length;
+    block->slots.reset(new (std::nothrow) slot_t[block->length]);
+
+    if (!block->slots)
+      return false;
+
+    for (size_t i = 0; i < block->length; ++i)
+      block->slots[i].used = false;
+
+    // Published whole, `acquire` may walk the list meanwhile
+    block->next = _blocks.load(std::memory_order_relaxed);
+    _blocks.store(block.release(), std::memory_order_release);
+    _length = length;
+    return true;
+  }
+
+  /**
+   * @brief Number of slots
+   *
+   */
+  size_t length()
+  {
+    KoolApiLock::Guard guard(_lock);
+    return _length;
+  }
+
+  /**
+   * @brief Borrow a free slot, with its documents cleared
+   *
+   * @return slot_t* nullptr if all are in use
+   */
+  slot_t *acquire()
+  {
+    for (auto &slot : _slots)
+    {
+      if (_take(slot))
+        return &slot;
+    }
+
+    for (block_t *block = _blocks.load(std::memory_order_acquire); block; block = block->next)
+    {
+      for (size_t i = 0; i < block->length; ++i)
+      {
+        if (_take(block->slots[i]))
+          return &block->slots[i];
+      }
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * @brief Return a slot to its pool
+   *
+   * @param slot
+   */
+  static void release(slot_t *slot)
+  {
+    if (slot)
+      slot->used.store(false, std::memory_order_release);
+  }
+
+private:
+  /**
+   * @brief Slots added by `reserve`, newest first
+   *
+   */
+  struct block_t
+  {
+    std::unique_ptr<slot_t[]> slots;
+    size_t length;
+    block_t *next;
+  };
+
+  slot_t _slots[KOOLAPI_DOC_POOL_SIZE];
+  std::atomic<block_t *> _blocks{nullptr};
+
+  KoolApiLock _lock;
+
+  /**
+   * @brief Slots in all, guarded by `_lock`
+   *
+   */
+  size_t _length = KOOLAPI_DOC_POOL_SIZE;
+
+  static bool _take(slot_t &slot)
+  {
+    bool expected = false;
+
+    if (!slot.used.compare_exchange_strong(expected, true, std::memory_order_acquire))
+      return false;
+
+    slot.doc.clear();
+    slot.outdoc.clear();
+    return true;
+  }
+};
+
 #endif // __KOOLAPIDOCUMENTS_H__
@@ -0,0 +1,123 @@
+#include "KoolApiErrors.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Body of an error, built by the preprocessor so nothing is serialised at runtime.
+// A constant like any string literal: in flash on ESP32, but copied to RAM on
+// ESP8266 which would need PROGMEM and _P reads to keep it out.
+#define KOOLAPI_ERROR_JSON(code, message) "{\"error\":" #code ",\"message\":\"" message "\"}"
+
+#define KOOLAPI_ERROR(code, message) \
+  { code, message, KOOLAPI_ERROR_JSON(code, message), sizeof(KOOLAPI_ERROR_JSON(code, message)) - 1 }
+
+namespace
+{
+  const KoolApiError errors[] = {
+      KOOLAPI_ERROR(400, "Bad Request"),
+      KOOLAPI_ERROR(401, "Unauthorized"),
+      KOOLAPI_ERROR(403, "Forbidden"),
+      KOOLAPI_ERROR(404, "Not Found"),
+      KOOLAPI_ERROR(405, "Method Not Allowed"),
+      KOOLAPI_ERROR(406, "Not Acceptable"),
+      KOOLAPI_ERROR(413, "Payload Too Large"),
+      KOOLAPI_ERROR(429, "Too Many Requests"),
+      KOOLAPI_ERROR(503, "Service Unavailable"),
+      KOOLAPI_ERROR(507, "Insufficient Storage")};
+
+  // Codes we have no body for are written with their code at runtime
+  const KoolApiError unspecified = {0, "Unspecified condition.", nullptr, 0};
+
+  size_t writeUint(char *buffer, uint8_t marker, uint32_t value, uint8_t bytes)
+  {
+    buffer[0] = (char)marker;
+
+    for (uint8_t i = 0; i < bytes; ++i)
+      buffer[1 + i] = (char)(value >> (8 * (bytes - 1 - i)));
+
+    return bytes + 1;
+  }
+
+  size_t writeStr(char *buffer, const char *str, size_t length)
+  {
+    size_t pos = 0;
+
+    // fixstr, or str 8 for longer messages
+    if (length < 32)
+    {
+      buffer[pos++] = (char)(0xa0 | length);
+    }
+    else
+    {
+      buffer[pos++] = (char)0xd9;
+      buffer[pos++] = (char)length;
+    }
+
+    memcpy(buffer + pos, str, length);
+    return pos + length;
+  }
+}
+
+const KoolApiError &koolApiError(int code)
+{
+  switch (code)
+  {
+  case 400: return errors[0];
+  case 401: return errors[1];
+  case 403: return errors[2];
+  case 404: return errors[3];
+  case 405: return errors[4];
+  case 406: return errors[5];
+  case 413: return errors[6];
+  case 429: return errors[7];
+  case 503: return errors[8];
+  case 507: return errors[9];
+  default: return unspecified;
+  }
+}
+
+size_t koolApiErrorJson(char *buffer, int code, uint32_t id)
+{
+  const KoolApiError &error = koolApiError(code);
+
+  if (!error.body)
+  {
+    int len = (id) ? snprintf(buffer, KOOLAPI_ERROR_BODY_SIZE, "{\"id\":%u,\"error\":%d,\"message\":\"%s\"}", (unsigned)id, code, error.message)
+                   : snprintf(buffer, KOOLAPI_ERROR_BODY_SIZE, "{\"error\":%d,\"message\":\"%s\"}", code, error.message);
+    return (len > 0) ? len : 0;
+  }
+
+  if (!id)
+  {
+    memcpy(buffer, error.body, error.length);
+    return error.length;
+  }
+
+  // `{"id":n,` then the body without its opening brace
+  int len = snprintf(buffer, KOOLAPI_ERROR_BODY_SIZE, "{\"id\":%u,", (unsigned)id);
+
+  memcpy(buffer + len, error.body + 1, error.length - 1);
+  return len + error.length - 1;
+}
+
+size_t koolApiErrorMsgPack(char *buffer, int code, uint32_t id)
+{
+  const KoolApiError &error = koolApiError(code);
+  size_t pos = 0;
+
+  // fixmap of 2 or 3 entries
+  buffer[pos++] = (char)((id) ? 0x83 : 0x82);
+
+  if (id)
+  {
+    pos += writeStr(buffer + pos, "id", 2);
+    pos += writeUint(buffer + pos, 0xce, id, 4);
+  }
+
+  pos += writeStr(buffer + pos, "error", 5);
+  pos += writeUint(buffer + pos, 0xcd, (uint16_t)code, 2);
+  pos += writeStr(buffer + pos, "message", 7);
+  pos += writeStr(buffer + pos, error.message, strlen(error.message));
+
+  return pos;
+}
@@ -0,0 +1,58 @@
+#ifndef __KOOLAPIERRORS_H__
+#define __KOOLAPIERRORS_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Size of a buffer able to hold any error body, json or msgpack, with an id
+ *
+ */
+#define KOOLAPI_ERROR_BODY_SIZE 80
+
+/**
+ * @brief Error response of a status code, serialised at compile time
+ *
+ */
+struct KoolApiError
+{
+  int code;
+  const char *message;
+
+  /**
+   * @brief `{"error":code,"message":"..."}`
+   *
+   */
+  const char *body;
+  uint8_t length;
+};
+
+/**
+ * @brief Error response for `code`, found without searching
+ *
+ * @param code HTTP status code
+ * @return const KoolApiError& Unspecified condition if the code is not an error we know
+ */
+const KoolApiError &koolApiError(int code);
+
+/**
+ * @brief Write the json error body of `code` with `id` spliced in
+ *
+ * @param buffer At least KOOLAPI_ERROR_BODY_SIZE chars
+ * @param code
+ * @param id
+ * @return size_t Length written
+ */
+size_t koolApiErrorJson(char *buffer, int code, uint32_t id);
+
+/**
+ * @brief Write the msgpack error body of `code`, with `id` when non zero
+ *
+ * @param buffer At least KOOLAPI_ERROR_BODY_SIZE bytes
+ * @param code
+ * @param id
+ * @return size_t Length written
+ */
+size_t koolApiErrorMsgPack(char *buffer, int code, uint32_t id);
+
+#endif // __KOOLAPIERRORS_H__
@@ -0,0 +1,107 @@
+#include "KoolApiEventLoop.h"
+
+#ifdef KOOLAPI_HAS_COROUTINES
+
+size_t KoolApiEventLoop::run()
+{
+  waiter_t *due = nullptr;
+  uint32_t now = koolApiMillis();
+
+  {
+    KoolApiLock::Guard guard(_lock);
+
+    // Everything ready is taken at once, coroutines posting more are resumed next run
+    due = _ready;
+    _ready = nullptr;
+
+    waiter_t **link = &_timers;
+
+    while (*link)
+    {
+      waiter_t *waiter = *link;
+
+      // Compared as a difference so millis wrapping is harmless
+      if ((int32_t)(now - waiter->due) >= 0)
+      {
+        *link = waiter->next;
+        waiter->next = due;
+        due = waiter;
+      }
+      else
+      {
+        link = &waiter->next;
+      }
+    }
+  }
+
+  size_t resumed = 0;
+
+  for (waiter_t *waiter = due; waiter; waiter = waiter->next)
+    ++resumed;
+
+  {
+    KoolApiLock::Guard guard(_lock);
+    _waiting -= resumed;
+  }
+
+  while (due)
+  {
+    // The node lives in the frame, so is read before resuming
+    waiter_t *next = due->next;
+    due->handle.resume();
+    due = next;
+  }
+
+  return resumed;
+}
+
+bool KoolApiEventLoop::runUntilIdle(uint32_t timeout)
+{
+  uint32_t start = koolApiMillis();
+
+  while (!idle())
+  {
+    if (koolApiMillis() - start >= timeout)
+      return false;
+
+    if (!run())
+    {
+#ifdef ARDUINO
+      delay(1);
+#else
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+    }
+  }
+
+  return true;
+}
+
+bool KoolApiEventLoop::idle()
+{
+  KoolApiLock::Guard guard(_lock);
+  return !_waiting;
+}
+
+void KoolApiEventLoop::hold()
+{
+  KoolApiLock::Guard guard(_lock);
+  ++_waiting;
+}
+
+void KoolApiEventLoop::post(waiter_t &waiter)
+{
+  KoolApiLock::Guard guard(_lock);
+  waiter.next = _ready;
+  _ready = &waiter;
+}
+
+void KoolApiEventLoop::_addTimer(waiter_t &waiter)
+{
+  KoolApiLock::Guard guard(_lock);
+  waiter.next = _timers;
+  _timers = &waiter;
+  ++_waiting;
+}
+
+#endif
@@ -0,0 +1,224 @@
+#ifndef __KOOLAPIEVENTLOOP_H__
+#define __KOOLAPIEVENTLOOP_H__
+
+#include "KoolApiClock.h"
+#include "KoolApiLock.h"
+
+// Coroutine handlers need C++20, eg -std=gnu++20, so are left out of older builds
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define KOOLAPI_HAS_COROUTINES
+#endif
+#endif
+
+#ifdef KOOLAPI_HAS_COROUTINES
+
+#include <coroutine>
+#include <utility>
+
+/**
+ * @brief Resumes suspended coroutine handlers once what they await is ready.
+ *
+ * Awaiting keeps a node in the coroutine frame, so nothing is allocated and
+ * any number of coroutines can wait. Call `run` from `loop`, or from a task
+ * of its own. Handlers are always resumed by whichever task calls `run`.
+ */
+class KoolApiEventLoop
+{
+public:
+  /**
+   * @brief A suspended coroutine, linked into the loop while it waits
+   *
+   */
+  struct waiter_t
+  {
+    std::coroutine_handle<> handle;
+
+    /**
+     * @brief Milliseconds since start to resume at, for timers
+     *
+     */
+    uint32_t due;
+
+    waiter_t *next;
+  };
+
+  /**
+   * @brief Awaitable returned by `sleep`
+   *
+   */
+  class Sleep
+  {
+  public:
+    Sleep(KoolApiEventLoop &loop, uint32_t ms) : _loop(loop), _ms(ms) {}
+
+    bool await_ready() const { return _ms == 0; }
+
+    void await_suspend(std::coroutine_handle<> handle)
+    {
+      _waiter.handle = handle;
+      _waiter.due = koolApiMillis() + _ms;
+      _loop._addTimer(_waiter);
+    }
+
+    void await_resume() const {}
+
+  private:
+    KoolApiEventLoop &_loop;
+    uint32_t _ms;
+    waiter_t _waiter;
+  };
+
+  KoolApiEventLoop() {}
+
+  KoolApiEventLoop(const KoolApiEventLoop &) = delete;
+  KoolApiEventLoop &operator=(const KoolApiEventLoop &) = delete;
+
+  /**
+   * @brief Suspend the awaiting coroutine for `ms` milliseconds
+   *
+   * @param ms
+   * @return Sleep
+   */
+  Sleep sleep(uint32_t ms) { return Sleep(*this, ms); }
+
+  /**
+   * @brief Resume every coroutine that is ready or whose timer is due
+   *
+   * Only one task may run the loop at a time.
+   *
+   * @return size_t Number resumed
+   */
+  size_t run();
+
+  /**
+   * @brief Run until nothing waits, sleeping until the next timer. For the host & tests.
+   *
+   * @param timeout Most milliseconds to run for
+   * @return bool true if nothing is left waiting
+   */
+  bool runUntilIdle(uint32_t timeout = 10000);
+
+  /**
+   * @brief Whether no coroutine is waiting to be resumed by the loop
+   *
+   */
+  bool idle();
+
+  /**
+   * @brief Count a coroutine suspended on something other than a timer, eg
+   * a future, so the loop is not idle until it is posted & resumed
+   *
+   */
+  void hold();
+
+  /**
+   * @brief Queue a waiter counted by `hold` to be resumed by the next `run`, safe from any task
+   *
+   * The waiter must not be touched once posted, its coroutine may already be running.
+   *
+   * @param waiter
+   */
+  void post(waiter_t &waiter);
+
+private:
+  KoolApiLock _lock;
+
+  /**
+   * @brief Waiters ready to resume, newest first
+   *
+   */
+  waiter_t *_ready = nullptr;
+
+  /**
+   * @brief Waiters for a timer, unordered
+   *
+   */
+  waiter_t *_timers = nullptr;
+
+  /**
+   * @brief Coroutines suspended until resumed by `run`
+   *
+   */
+  uint32_t _waiting = 0;
+
+  void _addTimer(waiter_t &waiter);
+};
+
+/**
+ * @brief Single value completed from any task, eg an I/O callback, and awaited by one coroutine.
+ *
+ * Declare it in the coroutine, pass it to whatever completes it, then `co_await`
+ * it for the value. The coroutine is resumed on `loop`.
+ *
+ * @tparam T
+ */
+template <class T>
+class KoolApiFuture
+{
+public:
+  explicit KoolApiFuture(KoolApiEventLoop &loop) : _loop(loop) {}
+
+  KoolApiFuture(const KoolApiFuture &) = delete;
+  KoolApiFuture &operator=(const KoolApiFuture &) = delete;
+
+  /**
+   * @brief Complete with `value`, safe from any task. Only the first call counts.
+   *
+   * The future may be gone as soon as this returns.
+   *
+   * @param value
+   * @return bool false if already completed
+   */
+  bool set(T value)
+  {
+    KoolApiEventLoop::waiter_t *waiter;
+
+    {
+      KoolApiLock::Guard guard(_lock);
+
+      if (_ready)
+        return false;
+
+      _value = std::move(value);
+      _ready = true;
+      waiter = _waiter;
+    }
+
+    // Posted last, the awaiting coroutine may then run and end the future
+    if (waiter)
+      _loop.post(*waiter);
+
+    return true;
+  }
+
+  bool await_ready() const { return false; }
+
+  bool await_suspend(std::coroutine_handle<> handle)
+  {
+    KoolApiLock::Guard guard(_lock);
+
+    // Already completed, carry on without suspending
+    if (_ready)
+      return false;
+
+    _node.handle = handle;
+    _waiter = &_node;
+    _loop.hold();
+    return true;
+  }
+
+  T await_resume() { return std::move(_value); }
+
+private:
+  KoolApiEventLoop &_loop;
+  KoolApiLock _lock;
+  KoolApiEventLoop::waiter_t _node;
+  KoolApiEventLoop::waiter_t *_waiter = nullptr;
+  bool _ready = false;
+  T _value{};
+};
+
+#endif
+
+#endif // __KOOLAPIEVENTLOOP_H__
@@ -0,0 +1,247 @@
+#include "KoolApiExecutor.h"
+
+#ifdef KOOLAPI_HAS_EXECUTOR
+
+#include "KoolApi.h"
+#include "KoolApiClock.h"
+
+bool KoolApiExecutor::begin()
+{
+  if (running())
+    return true;
+
+#ifdef ARDUINO
+  // One count per queued job, plus one per worker to stop it
+  if (!_jobs)
+    _jobs = xSemaphoreCreateCounting(KOOLAPI_QUEUE_SIZE * API_PRIORITY_CLASSES + _workersLength, 0);
+
+  if (!_jobs)
+    return false;
+#else
+  _threads.reset(new std::thread[_workersLength]);
+#endif
+
+  _running.store(true, std::memory_order_release);
+
+  for (uint8_t i = 0; i < _workersLength; ++i)
+  {
+    _active.fetch_add(1, std::memory_order_relaxed);
+
+#ifdef ARDUINO
+    if (xTaskCreate(_task, "koolapi", KOOLAPI_WORKER_STACK_SIZE, this, KOOLAPI_WORKER_PRIORITY, nullptr) != pdPASS)
+    {
+      _active.fetch_sub(1, std::memory_order_relaxed);
+      end();
+      return false;
+    }
+#else
+    _threads[i] = std::thread(&KoolApiExecutor::_work, this);
+#endif
+  }
+
+  return true;
+}
+
+void KoolApiExecutor::end()
+{
+  if (!_running.exchange(false, std::memory_order_acq_rel))
+    return;
+
+  for (uint8_t i = 0; i < _workersLength; ++i)
+    _signal();
+
+#ifdef ARDUINO
+  while (_active.load(std::memory_order_acquire))
+    vTaskDelay(1);
+
+  // Counts left by jobs no worker took
+  while (xSemaphoreTake(_jobs, 0) == pdTRUE)
+  {
+  }
+#else
+  for (uint8_t i = 0; i < _workersLength; ++i)
+  {
+    if (_threads[i].joinable())
+      _threads[i].join();
+  }
+
+  _threads.reset();
+  _signals = 0;
+#endif
+
+  _rejectAll();
+}
+
+bool KoolApiExecutor::submit(job_t job)
+{
+  if (job.priority >= API_PRIORITY_CLASSES)
+    job.priority = API_PRIORITY_NORMAL;
+
+  job.queuedAt = koolApiMicros();
+
+  if (!running() || !_queues[job.priority].push(job))
+  {
+    _rejected[job.priority].fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  _signal();
+
+  // Stopped meanwhile, so no worker may take it
+  if (!running())
+    _rejectAll();
+
+  return true;
+}
+
+size_t KoolApiExecutor::pending() const
+{
+  size_t total = 0;
+
+  for (auto &queue : _queues)
+    total += queue.size();
+
+  return total;
+}
+
+uint32_t KoolApiExecutor::rejected() const
+{
+  uint32_t total = 0;
+
+  for (auto &count : _rejected)
+    total += count.load(std::memory_order_relaxed);
+
+  return total;
+}
+
+KoolApiExecutor::class_stats_t KoolApiExecutor::stats(api_priority_t priority) const
+{
+  class_stats_t stats = {0, 0, 0, 0, 0};
+
+  if (priority < API_PRIORITY_CLASSES)
+  {
+    stats.pending = _queues[priority].size();
+    stats.processed = _processed[priority].load(std::memory_order_relaxed);
+    stats.rejected = _rejected[priority].load(std::memory_order_relaxed);
+    stats.waitMax = _waitMax[priority].load(std::memory_order_relaxed);
+    stats.waitAverage = _waitAverage[priority].load(std::memory_order_relaxed);
+  }
+
+  return stats;
+}
+
+bool KoolApiExecutor::_pop(job_t &job)
+{
+  // Now and then the lowest class waiting goes first, so is never starved. Only
+  // requests taken count, polling an empty queue must not use up its turn.
+  bool aged = _taken.load(std::memory_order_relaxed) % KOOLAPI_PRIORITY_AGING == KOOLAPI_PRIORITY_AGING - 1;
+  bool popped = false;
+
+  for (int i = 0; i < API_PRIORITY_CLASSES && !popped; ++i)
+    popped = _queues[(aged) ? API_PRIORITY_CLASSES - 1 - i : i].pop(job);
+
+  if (popped)
+    _taken.fetch_add(1, std::memory_order_relaxed);
+
+  return popped;
+}
+
+void KoolApiExecutor::_record(const job_t &job)
+{
+  uint32_t wait = koolApiMicros() - job.queuedAt;
+  uint32_t max = _waitMax[job.priority].load(std::memory_order_relaxed);
+
+  while (wait > max && !_waitMax[job.priority].compare_exchange_weak(max, wait, std::memory_order_relaxed))
+  {
+  }
+
+  // Moving average over about the last 8 requests, lost updates only make it a little stale
+  uint32_t average = _waitAverage[job.priority].load(std::memory_order_relaxed);
+  _waitAverage[job.priority].store(average - average / 8 + wait / 8, std::memory_order_relaxed);
+
+  _processed[job.priority].fetch_add(1, std::memory_order_relaxed);
+}
+
+void KoolApiExecutor::_rejectAll()
+{
+  job_t job;
+
+  while (_pop(job))
+    _reject(job);
+}
+
+void KoolApiExecutor::_work()
+{
+  job_t job;
+
+  for (;;)
+  {
+    _wait();
+
+    if (!running())
+      break;
+
+    // Each count follows a push, though its producer may still be writing the job
+    bool popped;
+
+    while (!(popped = _pop(job)) && running())
+      KOOLAPI_LOCK_YIELD();
+
+    // Left for `end` to answer
+    if (!popped)
+      break;
+
+    _record(job);
+    job.api->_run(job.request, job.methodsAccepted);
+  }
+
+  _active.fetch_sub(1, std::memory_order_release);
+}
+
+void KoolApiExecutor::_reject(const job_t &job)
+{
+  KoolApi::_reject(job.request);
+}
+
+#ifdef ARDUINO
+
+void KoolApiExecutor::_signal()
+{
+  xSemaphoreGive(_jobs);
+}
+
+void KoolApiExecutor::_wait()
+{
+  xSemaphoreTake(_jobs, portMAX_DELAY);
+}
+
+void KoolApiExecutor::_task(void *executor)
+{
+  ((KoolApiExecutor *)executor)->_work();
+  vTaskDelete(nullptr);
+}
+
+#else
+
+void KoolApiExecutor::_signal()
+{
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    ++_signals;
+  }
+
+  _condition.notify_one();
+}
+
+void KoolApiExecutor::_wait()
+{
+  std::unique_lock<std::mutex> lock(_mutex);
+
+  _condition.wait(lock, [this]()
+                  { return _signals > 0; });
+  --_signals;
+}
+
+#endif
+
+#endif
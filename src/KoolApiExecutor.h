@@ -0,0 +1,233 @@
+#ifndef __KOOLAPIEXECUTOR_H__
+#define __KOOLAPIEXECUTOR_H__
+
+#include "KoolApiBases.h"
+#include "KoolApiQueue.h"
+
+// Workers need tasks, so are not available on the ESP8266
+#if defined(ESP32) || !defined(ARDUINO)
+#define KOOLAPI_HAS_EXECUTOR
+
+#ifndef KOOLAPI_QUEUE_SIZE
+#define KOOLAPI_QUEUE_SIZE 16 // Requests of each class waiting for a worker, a power of 2
+#endif
+
+#ifndef KOOLAPI_PRIORITY_AGING
+#define KOOLAPI_PRIORITY_AGING 8 // Every this many requests, the lowest class waiting goes first
+#endif
+
+#ifndef KOOLAPI_WORKER_STACK_SIZE
+#define KOOLAPI_WORKER_STACK_SIZE 6144 // Stack of each worker task, in bytes
+#endif
+
+#ifndef KOOLAPI_WORKER_PRIORITY
+#define KOOLAPI_WORKER_PRIORITY 1 // FreeRTOS priority of worker tasks
+#endif
+
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#else
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#endif
+
+class KoolApi;
+
+/**
+ * @brief Runs handlers on a pool of workers instead of the task delivering requests.
+ *
+ * Transports only queue requests, so a slow handler no longer holds up the
+ * network stack. Workers are FreeRTOS tasks on the ESP32 and threads elsewhere.
+ *
+ * Each priority class has its own queue. Workers take from the highest class
+ * waiting, except every `KOOLAPI_PRIORITY_AGING` requests when the lowest goes
+ * first, so control requests are not held up behind bulk ones nor bulk starved.
+ */
+class KoolApiExecutor
+{
+public:
+  /**
+   * @brief A request waiting for a worker
+   *
+   */
+  struct job_t
+  {
+    KoolApi *api;
+    ApiRequest *request;
+    int methodsAccepted;
+    api_priority_t priority;
+
+    /**
+     * @brief Time queued, in microseconds
+     *
+     */
+    uint32_t queuedAt;
+  };
+
+  /**
+   * @brief Counters of a priority class
+   *
+   */
+  struct class_stats_t
+  {
+    size_t pending;
+    uint32_t processed;
+    uint32_t rejected;
+
+    /**
+     * @brief Longest & moving average time waited for a worker, in microseconds
+     *
+     */
+    uint32_t waitMax;
+    uint32_t waitAverage;
+  };
+
+  /**
+   * @brief Construct an executor, `begin` starts it
+   *
+   * @param workers Number of workers, the api adds pooled documents for them in `setExecutor`
+   */
+  KoolApiExecutor(uint8_t workers = 2) : _workersLength(workers)
+  {
+    for (uint8_t i = 0; i < API_PRIORITY_CLASSES; ++i)
+    {
+      _processed[i] = 0;
+      _rejected[i] = 0;
+      _waitMax[i] = 0;
+      _waitAverage[i] = 0;
+    }
+  }
+
+  KoolApiExecutor(const KoolApiExecutor &) = delete;
+  KoolApiExecutor &operator=(const KoolApiExecutor &) = delete;
+
+  ~KoolApiExecutor() { end(); }
+
+  /**
+   * @brief Start the workers
+   *
+   * @return bool false if they could not all be started
+   */
+  bool begin();
+
+  /**
+   * @brief Stop the workers once they finish their current request.
+   *
+   * Requests still queued are answered 503.
+   */
+  void end();
+
+  /**
+   * @brief Queue a job for the next free worker
+   *
+   * @param job
+   * @return bool false if the queue of its class is full or the executor not started
+   */
+  bool submit(job_t job);
+
+  /**
+   * @brief Number of requests waiting for a worker
+   *
+   */
+  size_t pending() const;
+
+  /**
+   * @brief Number of requests turned away because a queue was full
+   *
+   */
+  uint32_t rejected() const;
+
+  /**
+   * @brief Counters of a priority class
+   *
+   * @param priority
+   * @return class_stats_t
+   */
+  class_stats_t stats(api_priority_t priority) const;
+
+  bool running() const { return _running.load(std::memory_order_acquire); }
+
+  uint8_t workers() const { return _workersLength; }
+
+private:
+  KoolApiQueue<job_t, KOOLAPI_QUEUE_SIZE> _queues[API_PRIORITY_CLASSES];
+
+  uint8_t _workersLength;
+  std::atomic<bool> _running{false};
+  std::atomic<uint8_t> _active{0};
+
+  /**
+   * @brief Jobs taken, to know when the lowest class goes first
+   *
+   */
+  std::atomic<uint32_t> _taken{0};
+
+  std::atomic<uint32_t> _processed[API_PRIORITY_CLASSES];
+  std::atomic<uint32_t> _rejected[API_PRIORITY_CLASSES];
+  std::atomic<uint32_t> _waitMax[API_PRIORITY_CLASSES];
+  std::atomic<uint32_t> _waitAverage[API_PRIORITY_CLASSES];
+
+  /**
+   * @brief Take the next job by class
+   *
+   * @param job
+   * @return bool false if none are queued
+   */
+  bool _pop(job_t &job);
+
+  /**
+   * @brief Count the time a job waited
+   *
+   * @param job
+   */
+  void _record(const job_t &job);
+
+  /**
+   * @brief Answer every queued job 503
+   *
+   */
+  void _rejectAll();
+
+  /**
+   * @brief Wake a worker for each job queued
+   *
+   */
+  void _signal();
+
+  /**
+   * @brief Wait until a job may be queued or the executor stops
+   *
+   */
+  void _wait();
+
+  /**
+   * @brief Worker loop
+   *
+   */
+  void _work();
+
+  /**
+   * @brief Answer a job 503 without running it
+   *
+   * @param job
+   */
+  static void _reject(const job_t &job);
+
+#ifdef ARDUINO
+  SemaphoreHandle_t _jobs = nullptr;
+
+  static void _task(void *executor);
+#else
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  size_t _signals = 0;
+  std::unique_ptr<std::thread[]> _threads;
+#endif
+};
+
+#endif
+#endif // __KOOLAPIEXECUTOR_H__
@@ -0,0 +1,145 @@
+#include "KoolApiFlights.h"
+
+#include "KoolApiBases.h"
+
+KoolApiFlights::KoolApiFlights()
+{
+  for (auto &flight : _flights)
+  {
+    flight.state = FLIGHT_FREE;
+    flight.refs = 0;
+    flight.body = nullptr;
+    flight.parkedLength = 0;
+  }
+}
+
+KoolApiFlights::flight_t *KoolApiFlights::join(const void *handler, const char *uri, const char *params, size_t paramsLength, api_format_t format, bool &leader)
+{
+  KoolApiLock::Guard guard(_lock);
+  flight_t *unused = nullptr;
+
+  for (auto &flight : _flights)
+  {
+    uint8_t state = flight.state.load(std::memory_order_acquire);
+
+    // The leader cannot leave while the lock is held, so its uri and params are still valid
+    if (state == FLIGHT_RUNNING && flight.handler == handler && flight.format == format && flight.paramsLength == paramsLength &&
+        memcmp(flight.params, params, paramsLength) == 0 && strcmp(flight.uri, uri) == 0)
+    {
+      ++flight.refs;
+      leader = false;
+      return &flight;
+    }
+
+    if (state == FLIGHT_FREE && !unused)
+      unused = &flight;
+  }
+
+  if (unused)
+  {
+    unused->handler = handler;
+    unused->uri = uri;
+    unused->params = params;
+    unused->paramsLength = paramsLength;
+    unused->format = format;
+    unused->refs = 1;
+    unused->parkedLength = 0;
+    unused->code = 0;
+    unused->body = nullptr;
+    unused->length = 0;
+    unused->state.store(FLIGHT_RUNNING, std::memory_order_release);
+    leader = true;
+  }
+
+  return unused;
+}
+
+bool KoolApiFlights::park(flight_t *flight, ApiRequest *request)
+{
+  // Deferred under the lock, so the leader cannot finish between the check and parking
+  KoolApiLock::Guard guard(_lock);
+
+  if (flight->state.load(std::memory_order_acquire) != FLIGHT_RUNNING || flight->parkedLength == KOOLAPI_FLIGHT_MAX_PARKED)
+    return false;
+
+  KoolApiDeferred reply = request->defer();
+
+  if (!reply)
+    return false;
+
+  flight->parked[flight->parkedLength++] = std::move(reply);
+
+  // The leader still holds the flight, so it is not freed here
+  --flight->refs;
+  return true;
+}
+
+bool KoolApiFlights::store(flight_t *flight, int code, JsonVariantConst source)
+{
+  size_t length = koolApiMeasure(source, flight->format);
+
+  flight->body = (char *)malloc(length + 1);
+
+  if (!flight->body)
+  {
+    flight->state.store(FLIGHT_ABANDONED, std::memory_order_release);
+    return false;
+  }
+
+  flight->length = koolApiSerialize(source, flight->body, length + 1, flight->format);
+  flight->code = code;
+  flight->state.store(FLIGHT_DONE, std::memory_order_release);
+
+  return true;
+}
+
+void KoolApiFlights::fail(flight_t *flight, int code)
+{
+  flight->code = code;
+  flight->state.store(FLIGHT_DONE, std::memory_order_release);
+}
+
+void KoolApiFlights::finish(flight_t *flight)
+{
+  KoolApiDeferred parked[KOOLAPI_FLIGHT_MAX_PARKED];
+  uint8_t length;
+
+  {
+    KoolApiLock::Guard guard(_lock);
+    uint8_t running = FLIGHT_RUNNING;
+
+    // Nobody parks once it is no longer running, so the list is complete
+    flight->state.compare_exchange_strong(running, FLIGHT_ABANDONED, std::memory_order_acq_rel);
+
+    length = flight->parkedLength;
+    flight->parkedLength = 0;
+
+    for (uint8_t i = 0; i < length; ++i)
+      parked[i] = std::move(flight->parked[i]);
+  }
+
+  if (flight->state.load(std::memory_order_acquire) != FLIGHT_DONE)
+    return;
+
+  // Answered outside the lock, the body is held until the leader leaves.
+  // Those left over when abandoned are answered 503 as their handles go.
+  for (uint8_t i = 0; i < length; ++i)
+  {
+    if (flight->body)
+      parked[i]._sendBody(flight->code, flight->body, flight->length);
+    else
+      parked[i].send(flight->code);
+  }
+}
+
+void KoolApiFlights::leave(flight_t *flight)
+{
+  KoolApiLock::Guard guard(_lock);
+
+  if (--flight->refs)
+    return;
+
+  free(flight->body);
+  flight->body = nullptr;
+  flight->state.store(FLIGHT_FREE, std::memory_order_release);
+}
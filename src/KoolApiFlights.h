@@ -0,0 +1,151 @@
+#ifndef __KOOLAPIFLIGHTS_H__
+#define __KOOLAPIFLIGHTS_H__
+
+#include "KoolApiDeferred.h"
+#include "KoolApiDocuments.h"
+#include "KoolApiLock.h"
+
+#ifndef KOOLAPI_MAX_FLIGHTS
+#define KOOLAPI_MAX_FLIGHTS 4 // Distinct GETs that can be shared at once, others run alone
+#endif
+
+#ifndef KOOLAPI_FLIGHT_MAX_PARKED
+#define KOOLAPI_FLIGHT_MAX_PARKED 8 // Requests answered by each shared GET once done, more run alone
+#endif
+
+#ifndef KOOLAPI_FLIGHT_KEY_SIZE
+#define KOOLAPI_FLIGHT_KEY_SIZE 128 // Longest serialised params of a shared GET, requests with more run alone
+#endif
+
+/**
+ * @brief GETs being handled, so identical requests arriving meanwhile share one response.
+ *
+ * The first request for a route and params runs the handler. Others are
+ * deferred and parked in its flight, so nothing holds a task while they wait,
+ * and are answered with its serialised response as it finishes.
+ */
+class KoolApiFlights
+{
+public:
+  enum state_t : uint8_t
+  {
+    FLIGHT_FREE,
+    FLIGHT_RUNNING,
+    FLIGHT_DONE,
+
+    // Ended without a response to share, eg streamed
+    FLIGHT_ABANDONED
+  };
+
+  struct flight_t
+  {
+    std::atomic<uint8_t> state;
+
+    /**
+     * @brief Identify the request, `uri` and `params` belong to the first
+     * request and are only read while it runs
+     *
+     */
+    const void *handler;
+    const char *uri;
+    const char *params;
+    size_t paramsLength;
+
+    /**
+     * @brief Format the response is serialised in, clients in another run their own flight
+     *
+     */
+    api_format_t format;
+
+    /**
+     * @brief Requests holding the flight, guarded by the table lock
+     *
+     */
+    uint8_t refs;
+
+    /**
+     * @brief Requests answered by the leader once it finishes, guarded by the table lock
+     *
+     */
+    KoolApiDeferred parked[KOOLAPI_FLIGHT_MAX_PARKED];
+    uint8_t parkedLength;
+
+    /**
+     * @brief Response once done, an error if `body` is nullptr
+     *
+     */
+    int code;
+    char *body;
+    size_t length;
+  };
+
+  KoolApiFlights();
+
+  KoolApiFlights(const KoolApiFlights &) = delete;
+  KoolApiFlights &operator=(const KoolApiFlights &) = delete;
+
+  /**
+   * @brief Join the running flight of an identical request, or start one
+   *
+   * @param handler
+   * @param uri
+   * @param params Serialised by `ApiParamBase::serialize`, compared byte for byte
+   * @param paramsLength
+   * @param format
+   * @param leader Set true when the caller started the flight so must run the handler
+   * @return flight_t* nullptr if none are free, the request then runs alone
+   */
+  flight_t *join(const void *handler, const char *uri, const char *params, size_t paramsLength, api_format_t format, bool &leader);
+
+  /**
+   * @brief Defer a request that joined and leave it for the leader to answer
+   *
+   * The flight is left on success, the request must not be used again.
+   * Otherwise check the flight's state: done, its response is sent by the
+   * caller, else the caller runs alone.
+   *
+   * @param flight
+   * @param request
+   * @return bool false if the flight is no longer running, is full or the request cannot be deferred
+   */
+  bool park(flight_t *flight, ApiRequest *request);
+
+  /**
+   * @brief Keep the response, serialised in the flight's format, for those joining or parked
+   *
+   * @param flight
+   * @param code
+   * @param source
+   * @return bool false if out of memory, the flight is then abandoned
+   */
+  static bool store(flight_t *flight, int code, JsonVariantConst source);
+
+  /**
+   * @brief Share an error response
+   *
+   * @param flight
+   * @param code
+   */
+  static void fail(flight_t *flight, int code);
+
+  /**
+   * @brief Leader finished, answers those parked. A flight left without a
+   * response is abandoned and those parked are answered 503.
+   *
+   * @param flight
+   */
+  void finish(flight_t *flight);
+
+  /**
+   * @brief Release the flight, freed once no request holds it
+   *
+   * @param flight
+   */
+  void leave(flight_t *flight);
+
+private:
+  flight_t _flights[KOOLAPI_MAX_FLIGHTS];
+  KoolApiLock _lock;
+};
+
+#endif // __KOOLAPIFLIGHTS_H__
@@ -0,0 +1,216 @@
+#include "KoolApiJobs.h"
+
+#include "KoolApiClock.h"
+
+namespace
+{
+  const char *stateText(KoolApiJobs::state_t state)
+  {
+    switch (state)
+    {
+    case KoolApiJobs::JOB_PENDING:
+      return "pending";
+    case KoolApiJobs::JOB_DONE:
+      return "done";
+    default:
+      return "failed";
+    }
+  }
+}
+
+KoolApiJobs::KoolApiJobs()
+{
+  for (auto &job : _jobs)
+  {
+    job.state = JOB_FREE;
+    job.result = nullptr;
+  }
+}
+
+KoolApiJobs::~KoolApiJobs()
+{
+  for (auto &job : _jobs)
+    _free(job);
+}
+
+uint32_t KoolApiJobs::accept(ApiRequest *request, JsonObject out)
+{
+  uint32_t id = 0;
+
+  {
+    KoolApiLock::Guard guard(_lock);
+    uint32_t now = koolApiMillis();
+
+    for (auto &job : _jobs)
+    {
+      _expire(job, now);
+
+      // Finished jobs nobody collected are reclaimed once expired
+      bool expired = (job.state == JOB_DONE || job.state == JOB_FAILED) && now - job.finished >= KOOLAPI_JOB_TTL;
+
+      if (job.state != JOB_FREE && !expired)
+        continue;
+
+      _free(job);
+
+      id = _nextId++;
+
+      if (!_nextId)
+        _nextId = 1;
+
+      job.id = id;
+      job.state = JOB_PENDING;
+      job.code = 0;
+      job.accepted = now;
+      break;
+    }
+  }
+
+  if (!id)
+  {
+    request->send(SERVICE_UNAVAILABLE);
+    return 0;
+  }
+
+  out["job"] = id;
+  request->send(ACCEPTED);
+  return id;
+}
+
+bool KoolApiJobs::finish(uint32_t id, int code, JsonVariantConst result)
+{
+  // Serialised before taking the lock, which is only held to swap it in
+  size_t length = measureJson(result);
+  char *text = (char *)malloc(length + 1);
+
+  if (text)
+    serializeJson(result, text, length + 1);
+
+  KoolApiLock::Guard guard(_lock);
+  job_t *job = _find(id);
+
+  if (!job || job->state != JOB_PENDING)
+  {
+    free(text);
+    return false;
+  }
+
+  job->state = (text) ? JOB_DONE : JOB_FAILED;
+  job->code = (text) ? code : SERVICE_UNAVAILABLE;
+  job->result = text;
+  job->finished = koolApiMillis();
+  return text != nullptr;
+}
+
+bool KoolApiJobs::fail(uint32_t id, int code)
+{
+  KoolApiLock::Guard guard(_lock);
+  job_t *job = _find(id);
+
+  if (!job || job->state != JOB_PENDING)
+    return false;
+
+  job->state = JOB_FAILED;
+  job->code = code;
+  job->finished = koolApiMillis();
+  return true;
+}
+
+KoolApiJobs::state_t KoolApiJobs::state(uint32_t id)
+{
+  KoolApiLock::Guard guard(_lock);
+  job_t *job = _find(id);
+
+  return (job) ? job->state : JOB_FREE;
+}
+
+void KoolApiJobs::get(ApiRequest *request, JsonObject out)
+{
+  uint32_t id = request->params->getInt("id");
+
+  {
+    KoolApiLock::Guard guard(_lock);
+    job_t *job = _find(id);
+
+    if (job)
+    {
+      out["job"] = id;
+      out["state"] = stateText(job->state);
+
+      if (job->state != JOB_PENDING)
+        out["code"] = job->code;
+
+      // A char * result is copied into the output, so may be freed once unlocked
+      if (job->result && request->format == API_FORMAT_MSGPACK)
+      {
+        StaticJsonDocument<KOOLAPI_JOB_RESULT_DOC_SIZE> doc;
+
+        if (deserializeJson(doc, (const char *)job->result) == DeserializationError::Ok)
+          out["result"] = doc.as<JsonVariantConst>();
+      }
+      else if (job->result)
+      {
+        out["result"] = serialized(job->result);
+      }
+    }
+  }
+
+  if (out.containsKey("job"))
+    request->send(OK);
+  else
+    request->send(NOT_FOUND);
+}
+
+void KoolApiJobs::del(ApiRequest *request, JsonObject out)
+{
+  uint32_t id = request->params->getInt("id");
+  bool found = false;
+
+  {
+    KoolApiLock::Guard guard(_lock);
+    job_t *job = _find(id);
+
+    if (job)
+    {
+      _free(*job);
+      found = true;
+    }
+  }
+
+  request->send((found) ? OK : NOT_FOUND);
+}
+
+KoolApiJobs::job_t *KoolApiJobs::_find(uint32_t id)
+{
+  if (!id)
+    return nullptr;
+
+  for (auto &job : _jobs)
+  {
+    if (job.state != JOB_FREE && job.id == id)
+    {
+      _expire(job, koolApiMillis());
+      return &job;
+    }
+  }
+
+  return nullptr;
+}
+
+void KoolApiJobs::_expire(job_t &job, uint32_t now)
+{
+  if (job.state != JOB_PENDING || now - job.accepted < KOOLAPI_JOB_PENDING_TTL)
+    return;
+
+  // Kept for KOOLAPI_JOB_TTL from now, so a polling client still learns it failed
+  job.state = JOB_FAILED;
+  job.code = SERVICE_UNAVAILABLE;
+  job.finished = now;
+}
+
+void KoolApiJobs::_free(job_t &job)
+{
+  free(job.result);
+  job.result = nullptr;
+  job.state = JOB_FREE;
+}
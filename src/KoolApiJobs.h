@@ -0,0 +1,144 @@
+#ifndef __KOOLAPIJOBS_H__
+#define __KOOLAPIJOBS_H__
+
+#include "KoolApiPath.h"
+#include "KoolApiLock.h"
+
+#ifndef KOOLAPI_MAX_JOBS
+#define KOOLAPI_MAX_JOBS 4 // Jobs held at once, further requests are answered 503
+#endif
+
+#ifndef KOOLAPI_JOB_TTL
+#define KOOLAPI_JOB_TTL 60000 // Milliseconds a finished job is kept before its slot can be reused
+#endif
+
+#ifndef KOOLAPI_JOB_PENDING_TTL
+#define KOOLAPI_JOB_PENDING_TTL 600000 // Milliseconds a job may stay pending, then it fails with 503
+#endif
+
+#ifndef KOOLAPI_JOB_RESULT_DOC_SIZE
+#define KOOLAPI_JOB_RESULT_DOC_SIZE 512 // Stack document a result is parsed into for msgpack clients
+#endif
+
+/**
+ * @brief Jobs answered 202 Accepted, whose result is fetched later.
+ *
+ * Register on a route with an `{id}` segment, eg "jobs/{id}". Handlers starting
+ * slow work call `accept`, which answers `{"job":id}` straight away, and the
+ * work calls `finish` or `fail` from any task once done. Clients poll the job
+ * with GET and remove it with DELETE. Results are kept as json text.
+ */
+class KoolApiJobs : public KoolApiPath
+{
+public:
+  enum state_t : uint8_t
+  {
+    JOB_FREE,
+    JOB_PENDING,
+    JOB_DONE,
+    JOB_FAILED
+  };
+
+  KoolApiJobs();
+  virtual ~KoolApiJobs();
+
+  KoolApiJobs(const KoolApiJobs &) = delete;
+  KoolApiJobs &operator=(const KoolApiJobs &) = delete;
+
+  /**
+   * @brief Create a job and answer 202 with its id
+   *
+   * @param request
+   * @param out
+   * @return uint32_t Id of the job, 0 if none are free, 503 is then answered
+   */
+  uint32_t accept(ApiRequest *request, JsonObject out);
+
+  /**
+   * @brief Keep the result of a job, from any task
+   *
+   * @param id
+   * @param code HTTP Response code of the work
+   * @param result
+   * @return bool false if the job is not pending, has expired or out of memory, it then fails with 503
+   */
+  bool finish(uint32_t id, int code, JsonVariantConst result);
+
+  /**
+   * @brief Mark a job failed, from any task
+   *
+   * @param id
+   * @param code HTTP Response code of the work
+   * @return bool false if the job is not pending
+   */
+  bool fail(uint32_t id, int code);
+
+  /**
+   * @brief State of a job
+   *
+   * @param id
+   * @return state_t JOB_FREE if not known
+   */
+  state_t state(uint32_t id);
+
+  void get(ApiRequest *request, JsonObject out) override;
+  void del(ApiRequest *request, JsonObject out) override;
+  int options() override { return API_METHOD_GET | API_METHOD_DELETE; }
+
+private:
+  struct job_t
+  {
+    uint32_t id;
+    state_t state;
+    int code;
+
+    /**
+     * @brief Result as json text, nullptr until done
+     *
+     */
+    char *result;
+
+    /**
+     * @brief Milliseconds since start when accepted
+     *
+     */
+    uint32_t accepted;
+
+    /**
+     * @brief Milliseconds since start when finished
+     *
+     */
+    uint32_t finished;
+  };
+
+  job_t _jobs[KOOLAPI_MAX_JOBS];
+  uint32_t _nextId = 1;
+  KoolApiLock _lock;
+
+  /**
+   * @brief Job with `id`, call holding the lock
+   *
+   * @param id
+   * @return job_t* nullptr if not known
+   */
+  job_t *_find(uint32_t id);
+
+  /**
+   * @brief Fail a job left pending longer than `KOOLAPI_JOB_PENDING_TTL`, call holding the lock
+   *
+   * Work that never calls `finish` or `fail` would otherwise hold its slot for good.
+   *
+   * @param job
+   * @param now
+   */
+  static void _expire(job_t &job, uint32_t now);
+
+  /**
+   * @brief Empty a slot, call holding the lock
+   *
+   * @param job
+   */
+  static void _free(job_t &job);
+};
+
+#endif // __KOOLAPIJOBS_H__
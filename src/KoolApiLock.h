@@ -0,0 +1,177 @@
+#ifndef __KOOLAPILOCK_H__
+#define __KOOLAPILOCK_H__
+
+#include <atomic>
+
+// FreeRTOS mutexes on the ESP32, spin locks where there is no RTOS or on the host
+#if defined(ESP32)
+#define KOOLAPI_LOCK_MUTEX
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#elif defined(ARDUINO)
+#include <Arduino.h>
+#define KOOLAPI_LOCK_YIELD() yield()
+#else
+#include <thread>
+#define KOOLAPI_LOCK_YIELD() std::this_thread::yield()
+#endif
+
+/**
+ * @brief Lock for short critical sections, not recursive.
+ *
+ * On the ESP32 a FreeRTOS mutex, so a waiting task sleeps and a lower priority
+ * holder inherits its priority until it unlocks. Elsewhere a spin lock that
+ * yields while waiting so a holder on the same core can finish.
+ */
+class KoolApiLock
+{
+public:
+#ifdef KOOLAPI_LOCK_MUTEX
+  // Static, so needs no heap and can be made before the scheduler starts
+  KoolApiLock() : _mutex(xSemaphoreCreateMutexStatic(&_buffer)) {}
+
+  void lock() { xSemaphoreTake(_mutex, portMAX_DELAY); }
+
+  void unlock() { xSemaphoreGive(_mutex); }
+#else
+  KoolApiLock() {}
+
+  void lock()
+  {
+    while (_flag.test_and_set(std::memory_order_acquire))
+      KOOLAPI_LOCK_YIELD();
+  }
+
+  void unlock() { _flag.clear(std::memory_order_release); }
+#endif
+
+  KoolApiLock(const KoolApiLock &) = delete;
+  KoolApiLock &operator=(const KoolApiLock &) = delete;
+
+  /**
+   * @brief Holds a lock for its scope
+   *
+   */
+  class Guard
+  {
+  public:
+    Guard(KoolApiLock &lock) : _lock(lock) { _lock.lock(); }
+    ~Guard() { _lock.unlock(); }
+
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+
+  private:
+    KoolApiLock &_lock;
+  };
+
+private:
+#ifdef KOOLAPI_LOCK_MUTEX
+  StaticSemaphore_t _buffer;
+  SemaphoreHandle_t _mutex;
+#else
+  std::atomic_flag _flag = ATOMIC_FLAG_INIT;
+#endif
+};
+
+/**
+ * @brief Readers writer lock. Any number of readers, or one writer. Not recursive.
+ *
+ * Meant for data read on every request and written rarely, such as routes.
+ * On the ESP32 readers pass through the writers' mutex, so a writer waiting
+ * for readers to leave holds back new ones and is never starved.
+ */
+class KoolApiSharedLock
+{
+public:
+#ifdef KOOLAPI_LOCK_MUTEX
+  KoolApiSharedLock() : _drained(xSemaphoreCreateBinaryStatic(&_drainedBuffer)) {}
+
+  void lockShared()
+  {
+    KoolApiLock::Guard guard(_writer);
+    _readers.fetch_add(1, std::memory_order_acquire);
+  }
+
+  void unlockShared()
+  {
+    if (_readers.fetch_sub(1, std::memory_order_release) == 1)
+      xSemaphoreGive(_drained);
+  }
+
+  void lock()
+  {
+    _writer.lock();
+
+    // A give left from an earlier writer only costs another look at the count
+    while (_readers.load(std::memory_order_acquire))
+      xSemaphoreTake(_drained, portMAX_DELAY);
+  }
+
+  void unlock() { _writer.unlock(); }
+#else
+  void lockShared()
+  {
+    int state = _state.load(std::memory_order_relaxed);
+
+    // Writers hold -1, readers add one each
+    while (state < 0 || !_state.compare_exchange_weak(state, state + 1, std::memory_order_acquire, std::memory_order_relaxed))
+    {
+      if (state < 0)
+      {
+        KOOLAPI_LOCK_YIELD();
+        state = _state.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  void unlockShared() { _state.fetch_sub(1, std::memory_order_release); }
+
+  void lock()
+  {
+    int expected = 0;
+
+    while (!_state.compare_exchange_weak(expected, -1, std::memory_order_acquire, std::memory_order_relaxed))
+    {
+      expected = 0;
+      KOOLAPI_LOCK_YIELD();
+    }
+  }
+
+  void unlock() { _state.store(0, std::memory_order_release); }
+#endif
+
+  /**
+   * @brief Holds a lock for its scope, shared unless `exclusive`
+   *
+   */
+  class Guard
+  {
+  public:
+    Guard(KoolApiSharedLock &lock, bool exclusive = false) : _lock(lock), _exclusive(exclusive)
+    {
+      (_exclusive) ? _lock.lock() : _lock.lockShared();
+    }
+
+    ~Guard() { (_exclusive) ? _lock.unlock() : _lock.unlockShared(); }
+
+    Guard(const Guard &) = delete;
+    Guard &operator=(const Guard &) = delete;
+
+  private:
+    KoolApiSharedLock &_lock;
+    bool _exclusive;
+  };
+
+private:
+#ifdef KOOLAPI_LOCK_MUTEX
+  KoolApiLock _writer;
+  std::atomic<int> _readers{0};
+  StaticSemaphore_t _drainedBuffer;
+  SemaphoreHandle_t _drained;
+#else
+  std::atomic<int> _state{0};
+#endif
+};
+
+#endif // __KOOLAPILOCK_H__
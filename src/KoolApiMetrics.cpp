@@ -0,0 +1,280 @@
+#include "KoolApiMetrics.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+namespace
+{
+  const char *const phaseNames[API_PHASES] = {"parse", "handle", "serialise"};
+}
+
+const uint32_t KoolApiHistogram::bounds[KoolApiHistogram::BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 100000, 250000};
+
+const int KoolApiRouteMetrics::statusCodes[KoolApiRouteMetrics::STATUSES] = {
+    200, 201, 202, 204, 304, 400, 401, 403, 404, 405, 406, 413, 429, 503};
+
+KoolApiHistogram::KoolApiHistogram()
+{
+  for (auto &bucket : _buckets)
+    bucket = 0;
+
+  _sum = 0;
+}
+
+void KoolApiHistogram::record(uint32_t micros)
+{
+  uint8_t i = 0;
+
+  while (i < BUCKETS - 1 && micros > bounds[i])
+    ++i;
+
+  _buckets[i].fetch_add(1, std::memory_order_relaxed);
+  _sum.fetch_add(micros, std::memory_order_relaxed);
+}
+
+uint32_t KoolApiHistogram::count() const
+{
+  uint32_t total = 0;
+
+  for (auto &bucket : _buckets)
+    total += bucket.load(std::memory_order_relaxed);
+
+  return total;
+}
+
+KoolApiRouteMetrics::KoolApiRouteMetrics()
+{
+  for (auto &count : _responses)
+    count = 0;
+
+  _requests = 0;
+  _bytesIn = 0;
+  _bytesOut = 0;
+}
+
+void KoolApiRouteMetrics::record(int status, size_t bytesIn, size_t bytesOut, const uint32_t *phases)
+{
+  uint8_t i = 0;
+
+  while (i < STATUSES && statusCodes[i] != status)
+    ++i;
+
+  _requests.fetch_add(1, std::memory_order_relaxed);
+  _responses[i].fetch_add(1, std::memory_order_relaxed);
+  _bytesIn.fetch_add(bytesIn, std::memory_order_relaxed);
+  _bytesOut.fetch_add(bytesOut, std::memory_order_relaxed);
+
+  for (uint8_t p = 0; p < API_PHASES; ++p)
+    _phases[p].record(phases[p]);
+}
+
+void KoolApiMetricsWriter::begin(uint8_t section)
+{
+  if (!_prometheus)
+  {
+    _printf("{\"bounds\":[");
+
+    for (uint8_t i = 0; i < KoolApiHistogram::BUCKETS - 1; ++i)
+      _printf((i) ? ",%u" : "%u", (unsigned)KoolApiHistogram::bounds[i]);
+
+    _printf("],\"routes\":[");
+    return;
+  }
+
+  switch (section)
+  {
+  case SECTION_REQUESTS:
+    _printf("# HELP koolapi_requests_total Requests processed.\n# TYPE koolapi_requests_total counter\n");
+    break;
+  case SECTION_RESPONSES:
+    _printf("# HELP koolapi_responses_total Responses sent by status code.\n# TYPE koolapi_responses_total counter\n");
+    break;
+  case SECTION_BYTES_IN:
+    _printf("# HELP koolapi_bytes_in_total Request bytes received.\n# TYPE koolapi_bytes_in_total counter\n");
+    break;
+  case SECTION_BYTES_OUT:
+    _printf("# HELP koolapi_bytes_out_total Response bytes sent.\n# TYPE koolapi_bytes_out_total counter\n");
+    break;
+  case SECTION_LATENCY:
+    _printf("# HELP koolapi_phase_seconds Time spent in each phase of a request.\n# TYPE koolapi_phase_seconds histogram\n");
+    break;
+  }
+}
+
+void KoolApiMetricsWriter::route(uint8_t section, const char *path, const KoolApiRouteMetrics &metrics)
+{
+  if (_prometheus)
+    _prometheusRoute(section, path, metrics);
+  else
+    _json(path, metrics);
+
+  _first = false;
+}
+
+void KoolApiMetricsWriter::end(uint8_t section)
+{
+  if (!_prometheus)
+    _printf("]}");
+}
+
+void KoolApiMetricsWriter::_json(const char *path, const KoolApiRouteMetrics &metrics)
+{
+  _printf((_first) ? "{\"path\":" : ",{\"path\":");
+  _quoted(path);
+  _printf(",\"requests\":%u,\"responses\":{", (unsigned)metrics.requests());
+
+  bool any = false;
+
+  // Only codes sent, most routes send few
+  for (uint8_t i = 0; i <= KoolApiRouteMetrics::STATUSES; ++i)
+  {
+    uint32_t count = metrics.responses(i);
+
+    if (!count)
+      continue;
+
+    if (any)
+      _put(',');
+
+    if (i < KoolApiRouteMetrics::STATUSES)
+      _printf("\"%d\":%u", KoolApiRouteMetrics::statusCodes[i], (unsigned)count);
+    else
+      _printf("\"other\":%u", (unsigned)count);
+
+    any = true;
+  }
+
+  _printf("},\"bytesIn\":%u,\"bytesOut\":%u,\"latency\":{", (unsigned)metrics.bytesIn(), (unsigned)metrics.bytesOut());
+
+  for (uint8_t p = 0; p < API_PHASES; ++p)
+  {
+    const KoolApiHistogram &histogram = metrics.phase((api_phase_t)p);
+
+    _printf((p) ? ",\"%s\":{\"buckets\":[" : "\"%s\":{\"buckets\":[", phaseNames[p]);
+
+    for (uint8_t i = 0; i < KoolApiHistogram::BUCKETS; ++i)
+      _printf((i) ? ",%u" : "%u", (unsigned)histogram.bucket(i));
+
+    _printf("],\"sum\":%u,\"count\":%u}", (unsigned)histogram.sum(), (unsigned)histogram.count());
+  }
+
+  _printf("}}");
+}
+
+void KoolApiMetricsWriter::_prometheusRoute(uint8_t section, const char *path, const KoolApiRouteMetrics &metrics)
+{
+  switch (section)
+  {
+  case SECTION_REQUESTS:
+    _printf("koolapi_requests_total{path=");
+    _quoted(path);
+    _printf("} %u\n", (unsigned)metrics.requests());
+    break;
+
+  case SECTION_RESPONSES:
+    for (uint8_t i = 0; i <= KoolApiRouteMetrics::STATUSES; ++i)
+    {
+      uint32_t count = metrics.responses(i);
+
+      if (!count)
+        continue;
+
+      _printf("koolapi_responses_total{path=");
+      _quoted(path);
+
+      if (i < KoolApiRouteMetrics::STATUSES)
+        _printf(",code=\"%d\"} %u\n", KoolApiRouteMetrics::statusCodes[i], (unsigned)count);
+      else
+        _printf(",code=\"other\"} %u\n", (unsigned)count);
+    }
+    break;
+
+  case SECTION_BYTES_IN:
+  case SECTION_BYTES_OUT:
+    _printf((section == SECTION_BYTES_IN) ? "koolapi_bytes_in_total{path=" : "koolapi_bytes_out_total{path=");
+    _quoted(path);
+    _printf("} %u\n", (unsigned)((section == SECTION_BYTES_IN) ? metrics.bytesIn() : metrics.bytesOut()));
+    break;
+
+  case SECTION_LATENCY:
+    for (uint8_t p = 0; p < API_PHASES; ++p)
+    {
+      const KoolApiHistogram &histogram = metrics.phase((api_phase_t)p);
+      uint32_t cumulative = 0;
+
+      // Prometheus buckets count everything at or below their bound
+      for (uint8_t i = 0; i < KoolApiHistogram::BUCKETS; ++i)
+      {
+        cumulative += histogram.bucket(i);
+
+        _printf("koolapi_phase_seconds_bucket{path=");
+        _quoted(path);
+        _printf(",phase=\"%s\",le=\"", phaseNames[p]);
+
+        if (i < KoolApiHistogram::BUCKETS - 1)
+          _seconds(KoolApiHistogram::bounds[i]);
+        else
+          _printf("+Inf");
+
+        _printf("\"} %u\n", (unsigned)cumulative);
+      }
+
+      _printf("koolapi_phase_seconds_sum{path=");
+      _quoted(path);
+      _printf(",phase=\"%s\"} ", phaseNames[p]);
+      _seconds(histogram.sum());
+
+      _printf("\nkoolapi_phase_seconds_count{path=");
+      _quoted(path);
+      _printf(",phase=\"%s\"} %u\n", phaseNames[p], (unsigned)cumulative);
+    }
+    break;
+  }
+}
+
+void KoolApiMetricsWriter::_printf(const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+
+  int written = (_buffer && _pos < _size) ? vsnprintf(_buffer + _pos, _size - _pos, format, args)
+                                          : vsnprintf(nullptr, 0, format, args);
+
+  va_end(args);
+
+  if (written > 0)
+    _pos += written;
+}
+
+void KoolApiMetricsWriter::_put(char c)
+{
+  if (_buffer && _pos + 1 < _size)
+  {
+    _buffer[_pos] = c;
+    _buffer[_pos + 1] = 0;
+  }
+
+  ++_pos;
+}
+
+void KoolApiMetricsWriter::_quoted(const char *str)
+{
+  _put('"');
+
+  for (const char *c = (str) ? str : ""; *c; ++c)
+  {
+    if (*c == '"' || *c == '\\')
+      _put('\\');
+
+    _put(*c);
+  }
+
+  _put('"');
+}
+
+void KoolApiMetricsWriter::_seconds(uint32_t micros)
+{
+  // Integer formatting, float printf is not always linked on the ESP8266
+  _printf("%u.%06u", (unsigned)(micros / 1000000), (unsigned)(micros % 1000000));
+}
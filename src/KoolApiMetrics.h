@@ -0,0 +1,217 @@
+#ifndef __KOOLAPIMETRICS_H__
+#define __KOOLAPIMETRICS_H__
+
+#include "KoolApiClock.h"
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef KOOLAPI_METRICS_ATTEMPTS
+#define KOOLAPI_METRICS_ATTEMPTS 3 // Times the metrics are written before giving up on counts outgrowing the buffer
+#endif
+
+/**
+ * @brief Phases of a request timed by the metrics
+ *
+ */
+typedef enum
+{
+  API_PHASE_PARSE,
+  API_PHASE_HANDLE,
+  API_PHASE_SERIALISE,
+
+  API_PHASES
+} api_phase_t;
+
+/**
+ * @brief Adds the time until it goes out of scope to `total`
+ *
+ */
+class KoolApiPhaseTimer
+{
+public:
+  KoolApiPhaseTimer(uint32_t &total) : _total(total), _start(koolApiMicros()) {}
+  ~KoolApiPhaseTimer() { _total += koolApiMicros() - _start; }
+
+private:
+  uint32_t &_total;
+  uint32_t _start;
+};
+
+// Times the rest of the scope as `phase` of `request`, nothing unless metrics are compiled in
+#ifdef KOOLAPI_METRICS
+#define KOOLAPI_TIME_PHASE(request, phase) KoolApiPhaseTimer _phaseTimer((request)._phases[phase])
+#else
+#define KOOLAPI_TIME_PHASE(request, phase)
+#endif
+
+/**
+ * @brief Fixed bucket latency histogram, in microseconds
+ *
+ */
+class KoolApiHistogram
+{
+public:
+  /**
+   * @brief Number of buckets, the last has no upper bound
+   *
+   */
+  static const uint8_t BUCKETS = 11;
+
+  /**
+   * @brief Upper bound of each bucket but the last, in microseconds
+   *
+   */
+  static const uint32_t bounds[BUCKETS - 1];
+
+  KoolApiHistogram();
+
+  void record(uint32_t micros);
+
+  /**
+   * @brief Count of the bucket alone, not including those below it
+   *
+   * @param i
+   * @return uint32_t
+   */
+  uint32_t bucket(uint8_t i) const { return _buckets[i].load(std::memory_order_relaxed); }
+
+  uint32_t count() const;
+
+  /**
+   * @brief Total microseconds recorded, wraps like a counter reset
+   *
+   */
+  uint32_t sum() const { return _sum.load(std::memory_order_relaxed); }
+
+private:
+  std::atomic<uint32_t> _buckets[BUCKETS];
+  std::atomic<uint32_t> _sum;
+};
+
+/**
+ * @brief Counters & latencies of a route. Lock free, so recorded from any task.
+ *
+ */
+class KoolApiRouteMetrics
+{
+public:
+  /**
+   * @brief Status codes counted by `responses`, any others together after them
+   *
+   */
+  static const uint8_t STATUSES = 14;
+  static const int statusCodes[STATUSES];
+
+  KoolApiRouteMetrics();
+
+  /**
+   * @brief Count a request
+   *
+   * @param status Code answered, 0 if none
+   * @param bytesIn
+   * @param bytesOut
+   * @param phases Microseconds spent in each phase
+   */
+  void record(int status, size_t bytesIn, size_t bytesOut, const uint32_t *phases);
+
+  uint32_t requests() const { return _requests.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief Responses with the code at `i` of `statusCodes`, or any other if STATUSES
+   *
+   * @param i
+   * @return uint32_t
+   */
+  uint32_t responses(uint8_t i) const { return _responses[i].load(std::memory_order_relaxed); }
+
+  uint32_t bytesIn() const { return _bytesIn.load(std::memory_order_relaxed); }
+  uint32_t bytesOut() const { return _bytesOut.load(std::memory_order_relaxed); }
+
+  const KoolApiHistogram &phase(api_phase_t phase) const { return _phases[phase]; }
+
+private:
+  std::atomic<uint32_t> _requests;
+  std::atomic<uint32_t> _responses[STATUSES + 1];
+  std::atomic<uint32_t> _bytesIn;
+  std::atomic<uint32_t> _bytesOut;
+  KoolApiHistogram _phases[API_PHASES];
+};
+
+/**
+ * @brief Writes metrics as json or Prometheus text. Measures only when given no buffer,
+ * otherwise output is truncated to fit.
+ *
+ * Output is written in sections, each covering every route in turn, as
+ * Prometheus needs the samples of each metric together.
+ */
+class KoolApiMetricsWriter
+{
+public:
+  KoolApiMetricsWriter(char *buffer, size_t size, bool prometheus)
+      : _buffer(buffer), _size(size), _prometheus(prometheus) {}
+
+  /**
+   * @brief Number of sections to write
+   *
+   */
+  uint8_t sections() const { return (_prometheus) ? SECTIONS : 1; }
+
+  void begin(uint8_t section);
+
+  /**
+   * @brief Write a route's part of the section
+   *
+   * @param section
+   * @param path
+   * @param metrics
+   */
+  void route(uint8_t section, const char *path, const KoolApiRouteMetrics &metrics);
+
+  void end(uint8_t section);
+
+  /**
+   * @brief Length of the whole output, what was written is cut short if it is `size` or more
+   *
+   */
+  size_t length() const { return _pos; }
+
+private:
+  enum section_t
+  {
+    SECTION_REQUESTS,
+    SECTION_RESPONSES,
+    SECTION_BYTES_IN,
+    SECTION_BYTES_OUT,
+    SECTION_LATENCY,
+
+    SECTIONS
+  };
+
+  char *_buffer;
+  size_t _size;
+  bool _prometheus;
+  size_t _pos = 0;
+  bool _first = true;
+
+  void _printf(const char *format, ...);
+  void _put(char c);
+
+  /**
+   * @brief Write a string in quotes, escaped for both json & Prometheus labels
+   *
+   */
+  void _quoted(const char *str);
+
+  /**
+   * @brief Write microseconds as seconds
+   *
+   */
+  void _seconds(uint32_t micros);
+
+  void _json(const char *path, const KoolApiRouteMetrics &metrics);
+  void _prometheusRoute(uint8_t section, const char *path, const KoolApiRouteMetrics &metrics);
+};
+
+#endif // __KOOLAPIMETRICS_H__
@@ -4,27 +4,31 @@ KoolApiPath::KoolApiPath(const char *path) : _path(path){}
 
 void KoolApiPath::_handle(const handle_t h)
 {
-  request = h.request;
-  _rootJout = h.request->outdoc.to<JsonObject>();
+  // Everything about the request stays on the stack or in the request
+  ApiRequest *request = h.request;
+  JsonObject root = request->outdoc->to<JsonObject>();
 
   // If uriKey specified create sub key `data` for response
   if (h.uriKey || request->_id)
   {
     if (h.uriKey)
-      _rootJout[h.uriKey] = _path;
+      root[h.uriKey] = h.path;
     if (request->_id)
-      _rootJout["id"] = request->_id;
-    request->_out = _rootJout.createNestedObject("data");
+      root["id"] = request->_id;
+    request->_out = root.createNestedObject("data");
+    request->_enveloped = true;
+    request->_uriKey = h.uriKey;
   }
   else
   {
-    request->_out = _rootJout;
+    request->_out = root;
   }
 
   switch (h.method)
   {
   case API_METHOD_GET:
-    get(request, request->_out);
+  case API_METHOD_HEAD:
+    _get(h);
     break;
   case API_METHOD_POST:
     post(request, request->_out);
@@ -39,25 +43,192 @@ void KoolApiPath::_handle(const handle_t h)
     del(request, request->_out);
     break;
   case API_METHOD_OPTIONS:
+    _sendOptions(request);
+    break;
+  default:
+    break;
+  }
+}
+
+void KoolApiPath::_get(const handle_t &h)
+{
+  ApiRequest *request = h.request;
+  char params[KOOLAPI_FLIGHT_KEY_SIZE];
+  size_t paramsLength = 0;
+
+  if (_sendCached(request, h.path))
+    return;
+
+  // Responses carrying an id differ, so are never shared
+  bool shareable = h.flights && !request->_id && (!request->params || request->params->serialize(params, sizeof(params), paramsLength));
+  bool leader = false;
+  auto flight = (shareable) ? h.flights->join(this, request->uri, params, paramsLength, request->format, leader) : nullptr;
+
+  if (flight && !leader)
   {
-    request->outdoc.clear();
-    auto jo = request->outdoc.to<JsonObject>();
+    // Answered by the leader, this task is free meanwhile
+    if (h.flights->park(flight, request))
+      return;
 
-    if (_createOptions(jo))
-    {
-      request->_sendOptions();
-    }
-    else
+    // Finished while joining, or cannot wait, eg a char request, so runs alone
+    bool done = flight->state.load(std::memory_order_acquire) == KoolApiFlights::FLIGHT_DONE;
+
+    if (done && flight->body)
+      request->_sendBody(flight->code, flight->body, flight->length, request->format);
+    else if (done)
+      request->_error(flight->code);
+
+    h.flights->leave(flight);
+
+    if (done)
+      return;
+
+    flight = nullptr;
+  }
+
+  request->_flight = flight;
+  get(request, request->_out);
+
+  if (flight)
+  {
+    h.flights->finish(flight);
+    h.flights->leave(flight);
+    request->_flight = nullptr;
+  }
+}
+
+bool KoolApiPath::_sendCached(ApiRequest *request, const char *path)
+{
+  uint32_t v = version();
+
+  // Responses depending on more than the route are never cached
+  if (!v || request->_id || (request->params && request->params->length()))
+    return false;
+
+  KoolApiResponseCache::etag(request->_etag, v, path);
+
+  if (request->_matchesETag())
+  {
+    request->_sendBody(304, nullptr, 0, request->format);
+    return true;
+  }
+
+  std::shared_ptr<const char> body;
+  size_t length = 0;
+
+  {
+    KoolApiLock::Guard guard(_cache.lock);
+
+    if (_cache.fresh(request->_etag, request->_enveloped, request->format))
     {
-      request->_dispatch(405);
+      body = _cache.body();
+      length = _cache.length();
     }
   }
-  break;
-  default:
-    break;
+
+  // Sent from our reference, another request may replace the body meanwhile
+  if (body)
+  {
+    request->_sendBody(200, body.get(), length, request->format);
+    return true;
+  }
+
+  request->_cache = &_cache;
+  return false;
+}
+
+void KoolApiPath::_sendOptions(ApiRequest *request)
+{
+  uint8_t state = OPTIONS_UNBUILT;
+
+  // The first request builds the shared response, others only read it once built
+  if (_optionsState.load(std::memory_order_acquire) == OPTIONS_UNBUILT &&
+      _optionsState.compare_exchange_strong(state, OPTIONS_BUILDING, std::memory_order_acquire))
+  {
+    _optionsLength = _buildOptions(_allowMethods, _optionsBody);
+    _optionsState.store(OPTIONS_BUILT, std::memory_order_release);
+  }
+
+  const char *methods = _allowMethods;
+  const char *body = _optionsBody;
+  uint8_t length;
+
+  // Built on the stack rather than waiting while another request builds it
+  char ownMethods[sizeof(_allowMethods)];
+  char ownBody[sizeof(_optionsBody)];
+
+  if (_optionsState.load(std::memory_order_acquire) == OPTIONS_BUILT)
+  {
+    length = _optionsLength;
+  }
+  else
+  {
+    length = _buildOptions(ownMethods, ownBody);
+    methods = ownMethods;
+    body = ownBody;
+  }
+
+  if (length)
+  {
+    request->_sendOptions(body, length, methods);
+    request->_sent(200, length);
+  }
+  else
+  {
+    request->outdoc->to<JsonObject>();
+    request->_dispatch(405);
+    request->_sentOutput(405);
   }
 }
 
+uint8_t KoolApiPath::_buildOptions(char *allowMethods, char *optionsBody)
+{
+  const size_t methodsSize = sizeof(_allowMethods);
+  const size_t bodySize = sizeof(_optionsBody);
+
+  auto opts = options();
+  size_t methods = 0;
+  size_t body = 0;
+  bool truncated = false;
+
+  // snprintf returns the length it wanted, so positions never pass the end
+  auto append = [&](char *buffer, size_t size, size_t &pos, const char *format, const char *text)
+  {
+    if (truncated)
+      return;
+
+    int written = snprintf(buffer + pos, size - pos, format, text);
+
+    if (written < 0 || (size_t)written >= size - pos)
+      truncated = true;
+    else
+      pos += written;
+  };
+
+  allowMethods[0] = 0;
+  append(optionsBody, bodySize, body, "%s", "{\"options\":[");
+
+  auto add = [&](const char *method)
+  {
+    append(allowMethods, methodsSize, methods, (methods) ? ", %s" : "%s", method);
+    append(optionsBody, bodySize, body, (body && optionsBody[body - 1] == '[') ? "\"%s\"" : ",\"%s\"", method);
+  };
+
+  for (uint8_t x = 0; x < koolApiMethodMap.length(); ++x)
+  {
+    if (koolApiMethodMap.code[x] != API_METHOD_OPTIONS && (koolApiMethodMap.code[x] & opts))
+      add(koolApiMethodMap.text[x]);
+  }
+
+  if (methods)
+    add(koolApiMethodMap.codeToText(API_METHOD_OPTIONS));
+
+  append(optionsBody, bodySize, body, "%s", "]}");
+
+  // A method map grown past the buffers is answered 405 rather than overrunning them
+  return (methods && !truncated) ? body : 0;
+}
+
 uint8_t KoolApiPath::_createOptions(JsonObject jo, bool includeOptions)
 {
   auto opts = options();
@@ -6,22 +6,38 @@
 /**
  * @brief Class to be inherited by endpoints
  *
+ * A handler may be called for several requests at once, from different tasks.
+ * Keep per request state on the stack or in the request, not in members.
  */
 class KoolApiPath
 {
 public:
-  /**
-   * @brief Request info.
-   * Hold the json and params for a request.
-   */
-  ApiRequest *request;
-
   virtual void get(ApiRequest *request, JsonObject out) { request->send(NOT_ALLOWED); };
   virtual void post(ApiRequest *request, JsonObject out) { request->send(NOT_ALLOWED); };
   virtual void put(ApiRequest *request, JsonObject out) { request->send(NOT_ALLOWED); };
   virtual void patch(ApiRequest *request, JsonObject out) { request->send(NOT_ALLOWED); };
   virtual void del(ApiRequest *request, JsonObject out) { request->send(NOT_ALLOWED); };
 
+  /**
+   * @brief Return true to receive webserver POST, PUT & PATCH bodies through
+   * `bodyEvent` as they arrive, rather than parsed into `request->json`.
+   *
+   * Bodies of any size are then handled in constant memory. Once the body is
+   * complete the usual method is called, with `request->bodyContext` set.
+   *
+   * @return bool
+   */
+  virtual bool streamsBody() { return false; }
+
+  /**
+   * @brief Receives each element of a streamed body
+   *
+   * Called for many requests at once, keep per request state in `*event.context`.
+   *
+   * @param event
+   */
+  virtual void bodyEvent(const ApiBodyEvent &event){};
+
   /**
    * @brief Bitwise for describing methods used
    *
@@ -29,6 +45,43 @@ public:
    */
   virtual int options() { return API_METHOD_UNKNOWN; };
 
+  /**
+   * @brief Version of the resource `get` returns. Change it whenever its output would change.
+   *
+   * A non zero version lets the serialised GET response be kept and sent again
+   * without calling `get`, and webserver clients be answered 304 Not Modified.
+   * Requests with params or an id always call `get`.
+   *
+   * @return uint32_t 0 disables caching
+   */
+  virtual uint32_t version() { return 0; }
+
+  /**
+   * @brief Use a CORS policy of its own instead of the api's
+   *
+   * @param policy Must outlive the handler
+   * @return KoolApiPath&
+   */
+  KoolApiPath &setCors(const KoolApiCors &policy)
+  {
+    _cors = &policy;
+    return *this;
+  }
+
+  /**
+   * @brief Set the class requests are queued in when run by an executor
+   *
+   * Also set by `KoolApi::on`, use for routes of a compile time table.
+   *
+   * @param priority Default: API_PRIORITY_NORMAL
+   * @return KoolApiPath&
+   */
+  KoolApiPath &setPriority(api_priority_t priority)
+  {
+    _priority = priority;
+    return *this;
+  }
+
 protected:
   enum resp_code_t
   {
@@ -39,7 +92,10 @@ protected:
     UNAUTHORIZED = 401,
     FORBIDDEN = 403,
     NOT_FOUND = 404,
-    NOT_ALLOWED = 405
+    NOT_ALLOWED = 405,
+    TOO_MANY_REQUESTS = 429,
+    SERVICE_UNAVAILABLE = 503,
+    INSUFFICIENT_STORAGE = 507
   };
 
   /**
@@ -65,16 +121,43 @@ private:
   friend class KoolApi;
 
   /**
-   * @brief Enpoint path
+   * @brief Enpoint path as registered by `KoolApi::on`
    *
    */
   const char *_path;
 
   /**
-   * @brief Root object for json output
+   * @brief CORS policy of this route, nullptr for the api's
+   *
+   */
+  const KoolApiCors *_cors = nullptr;
+
+  /**
+   * @brief Class requests for this route are queued in
+   *
+   */
+  api_priority_t _priority = API_PRIORITY_NORMAL;
+
+  /**
+   * @brief Allow-Methods value & OPTIONS response, built on the first OPTIONS request
+   *
+   */
+  char _allowMethods[48];
+  char _optionsBody[72];
+  uint8_t _optionsLength = 0;
+
+  enum options_state_t : uint8_t
+  {
+    OPTIONS_UNBUILT,
+    OPTIONS_BUILDING,
+    OPTIONS_BUILT
+  };
+
+  /**
+   * @brief Whether `_allowMethods` & `_optionsBody` may be read
    *
    */
-  JsonObject _rootJout;
+  std::atomic<uint8_t> _optionsState{OPTIONS_UNBUILT};
 
   /**
    * @brief Contains data for handlers
@@ -85,6 +168,13 @@ private:
     api_method_t method;
     ApiRequest *request;
     const char *uriKey;
+    const char *path;
+
+    /**
+     * @brief GETs being handled, nullptr unless identical requests are shared
+     *
+     */
+    KoolApiFlights *flights;
   };
 
   /**
@@ -102,6 +192,65 @@ private:
    * @return uint8_t Number of options found.
    */
   uint8_t _createOptions(JsonObject jo, bool includeOptions = true);
+
+  /**
+   * @brief Answer a GET or HEAD, from the cache or an identical request if possible
+   *
+   * @param h Handler information
+   */
+  void _get(const handle_t &h);
+
+  /**
+   * @brief Answer a GET or HEAD from the cache, or have the response stored in it
+   *
+   * @param request
+   * @param path Route requested
+   * @return bool true if answered
+   */
+  bool _sendCached(ApiRequest *request, const char *path);
+
+  /**
+   * @brief Answer an OPTIONS request, building the response once
+   *
+   * @param request
+   */
+  void _sendOptions(ApiRequest *request);
+
+  /**
+   * @brief Builds the Allow-Methods value & OPTIONS response from `options`
+   *
+   * @param allowMethods Sized as `_allowMethods`
+   * @param optionsBody Sized as `_optionsBody`
+   * @return uint8_t Length of the body, 0 if no methods are allowed or they do not fit
+   */
+  uint8_t _buildOptions(char *allowMethods, char *optionsBody);
+
+  /**
+   * @brief Last serialised GET response
+   *
+   */
+  KoolApiResponseCache _cache;
+
+#ifdef KOOLAPI_METRICS
+
+  /**
+   * @brief Counters & latencies of requests for this route
+   *
+   */
+  KoolApiRouteMetrics _metrics;
+
+#endif
+};
+
+/**
+ * @brief Entry of the route index, ordered by `hash` then `path`
+ *
+ */
+struct KoolApiRoute
+{
+  uint32_t hash;
+  const char *path;
+  KoolApiPath *handler;
 };
 
 #endif // __KOOLAPIPATH_H__
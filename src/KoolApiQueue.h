@@ -0,0 +1,131 @@
+#ifndef __KOOLAPIQUEUE_H__
+#define __KOOLAPIQUEUE_H__
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Bounded lock free queue for many producers and many consumers.
+ *
+ * Each cell carries a sequence number telling producers and consumers whose
+ * turn it is, so neither ever waits on a lock. Nothing is allocated.
+ *
+ * @tparam T Item type, copied in & out
+ * @tparam N Capacity, a power of 2
+ */
+template <class T, size_t N>
+class KoolApiQueue
+{
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "Queue capacity must be a power of 2");
+
+public:
+  KoolApiQueue()
+  {
+    for (size_t i = 0; i < N; ++i)
+      _cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  KoolApiQueue(const KoolApiQueue &) = delete;
+  KoolApiQueue &operator=(const KoolApiQueue &) = delete;
+
+  /**
+   * @brief Add an item
+   *
+   * @param item
+   * @return bool false if full
+   */
+  bool push(const T &item)
+  {
+    size_t pos = _tail.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      cell_t &cell = _cells[pos & (N - 1)];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+      if (diff == 0)
+      {
+        if (_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          cell.item = item;
+          cell.sequence.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false;
+      }
+      else
+      {
+        pos = _tail.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Take the oldest item
+   *
+   * @param item Set to the item taken
+   * @return bool false if empty
+   */
+  bool pop(T &item)
+  {
+    size_t pos = _head.load(std::memory_order_relaxed);
+
+    for (;;)
+    {
+      cell_t &cell = _cells[pos & (N - 1)];
+      size_t sequence = cell.sequence.load(std::memory_order_acquire);
+      intptr_t diff = (intptr_t)sequence - (intptr_t)(pos + 1);
+
+      if (diff == 0)
+      {
+        if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+        {
+          item = cell.item;
+          cell.sequence.store(pos + N, std::memory_order_release);
+          return true;
+        }
+      }
+      else if (diff < 0)
+      {
+        return false;
+      }
+      else
+      {
+        pos = _head.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * @brief Number of items held, approximate while pushed or popped
+   *
+   */
+  size_t size() const
+  {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    size_t head = _head.load(std::memory_order_relaxed);
+
+    return (tail > head) ? tail - head : 0;
+  }
+
+  constexpr size_t capacity() const { return N; }
+
+private:
+  struct cell_t
+  {
+    std::atomic<size_t> sequence;
+    T item;
+  };
+
+  cell_t _cells[N];
+
+  std::atomic<size_t> _tail{0};
+  std::atomic<size_t> _head{0};
+};
+
+#endif // __KOOLAPIQUEUE_H__
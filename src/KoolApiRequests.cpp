@@ -4,63 +4,249 @@
 
 void ApiCharRequest::_dispatch(int code) const
 {
-  if (_maxLength && !outdoc.isNull()) serializeJson(outdoc, _output, _maxLength);
+  if (_maxLength && !outdoc->isNull()) _write(*outdoc);
 }
 
-int ApiCharRequest::parse(const char *urlBase, const char *requestKey)
+void ApiCharRequest::_dispatchRaw(int code, const char *body, size_t length) const
 {
-  const char * methodTxt = "method";
-  const char * bodyTxt = "body";
-  const char * paramsTxt = "params";
+  if (!_maxLength)
+    return;
+
+  if (format == API_FORMAT_MSGPACK)
+  {
+    StaticJsonDocument<128> fallback;
+    JsonDocument *parsed = _rawDocument(body, length, fallback);
+
+    if (parsed)
+      _write(*parsed);
 
-  if (_isConst) {
-    _deserializationError = deserializeJson(doc, _jsonInConst);
+    return;
   }
-  else
+
+  _copy(body, length);
+}
+
+void ApiCharRequest::_dispatchEncoded(int code, const char *body, size_t length) const
+{
+  if (_maxLength)
+    _copy(body, length);
+}
+
+void ApiCharRequest::_dispatchText(int code, const char *body, size_t length) const
+{
+  if (_maxLength)
+    _copy(body, length);
+}
+
+size_t ApiCharRequest::_inputLength() const
+{
+  if (_maxInLength)
+    return _maxInLength;
+
+  const char *input = (_isConst) ? _jsonInConst : _jsonIn;
+  return (input) ? strlen(input) : 0;
+}
+
+void ApiCharRequest::_copy(const char *body, size_t length) const
+{
+  // Room is kept for a terminator, which json callers rely on
+  if (length >= _maxLength)
   {
-    _deserializationError = (_maxInLength) ? deserializeJson(doc, _jsonIn, _maxInLength) :
-                                        deserializeJson(doc, _jsonIn);
+    _overflowed();
+    return;
   }
 
-  if (_deserializationError || doc.isNull() || !doc.is<JsonObject>())
+  memcpy(_output, body, length);
+  _output[length] = 0;
+  _outputLength = length;
+}
+
+void ApiCharRequest::_write(JsonVariantConst source) const
+{
+  // A truncated body would not parse, msgpack has no terminator to show it was cut
+  if (koolApiMeasure(source, format) >= _maxLength)
   {
-    return 400;
+    _overflowed();
+    return;
   }
 
-  JsonObject jParse = doc.as<JsonObject>();
+  _outputLength = koolApiSerialize(source, _output, _maxLength, format);
+  _output[_outputLength] = 0;
+}
 
-  this->_id = jParse["id"];
+void ApiCharRequest::_overflowed() const
+{
+  char body[KOOLAPI_ERROR_BODY_SIZE];
+  size_t length = (format == API_FORMAT_MSGPACK) ? koolApiErrorMsgPack(body, 507, _id)
+                                                 : koolApiErrorJson(body, 507, _id);
 
-  // Use brief json keys if in that mode
-  if (this->useShortKeys) {
-    bodyTxt = "B";
-    paramsTxt = "P";
-    const char* surl = jParse["U"];
-    // const char *methodStr = jParse[methodTxt];
-    this->_method = koolApiMethodMap.textToCode(surl, API_METHOD_UNKNOWN);
-    char * urlPos = strchr(surl, '|');
+  if (length >= _maxLength)
+    length = 0;
 
-    if (urlPos && (int) strlen(surl) > surl - urlPos) {
+  memcpy(_output, body, length);
+  _output[length] = 0;
+  _outputLength = length;
+}
+
+void ApiCharRequest::_dispatchStream(int code, std::shared_ptr<KoolApiStream> stream)
+{
+  // Streams are json text, msgpack output is collected into the output document
+  if (!streamSink || format == API_FORMAT_MSGPACK)
+  {
+    ApiRequest::_dispatchStream(code, stream);
+    return;
+  }
+
+  uint8_t buffer[128];
+  size_t len;
+
+  stream->begin(outdoc->as<JsonObject>(), _enveloped);
+
+  while ((len = stream->read(buffer, sizeof(buffer))))
+    streamSink(buffer, len);
+}
+
+DeserializationError ApiCharRequest::_deserialize(JsonDocument &target, bool filter, const char *requestKey)
+{
+  if (filter)
+  {
+    StaticJsonDocument<JSON_OBJECT_SIZE(4)> envelope;
+    _envelopeFilter(envelope, requestKey);
+
+    const char *input = (_isConst) ? _jsonInConst : _jsonIn;
+
+    return _deserializeInput(target, input, _maxInLength, DeserializationOption::Filter(envelope));
+  }
+
+  if (_isConst)
+  {
+    return _deserializeInput(target, _jsonInConst, _maxInLength);
+  }
+
+  return _deserializeInput(target, _jsonIn, _maxInLength);
+}
+
+const char *ApiCharRequest::_peekUri(const char *urlBase, const char *requestKey)
+{
+  return _peekInput((_isConst) ? _jsonInConst : _jsonIn, _maxInLength, requestKey, useShortKeys);
+}
+
+int ApiCharRequest::parseEnvelope(const char *urlBase, const char *requestKey)
+{
+  // Already read to queue the request
+  if (_envelopeRead)
+    return 0;
 
-      this->uri = urlPos + 1;
-    }
+  // Batches are routed item by item, after a full parse
+  if (_isBatchInput((_isConst) ? _jsonInConst : _jsonIn, _maxInLength, format))
+  {
+    _parsed = true;
+    return parse(urlBase, requestKey);
   }
-  else
+
+  // The output document is unused until a handler runs, so holds the envelope
+  _deserializationError = _deserialize(*outdoc, true, requestKey);
+
+  if (_deserializationError || !outdoc->is<JsonObject>())
   {
-    this->uri = jParse[requestKey];
-    const char *methodStr = jParse[methodTxt];
-    this->_method = koolApiMethodMap.textToCode(methodStr, API_METHOD_UNKNOWN);
+    return 400;
   }
 
+  _readEnvelope(outdoc->as<JsonObject>(), requestKey, useShortKeys);
 
-  // Get requests should have no json body
-  if (_method != API_METHOD_GET)
-    this->json = jParse[bodyTxt];
+  return 0;
+}
 
-  this->_out = outdoc.to<JsonObject>();
+int ApiCharRequest::parse(const char *urlBase, const char *requestKey)
+{
+  _deserializationError = _deserialize(*doc, false);
 
-  this->params = new ApiJsonParams(jParse[paramsTxt].as<JsonObject>());
+  if (!_deserializationError && doc->is<JsonArray>())
+  {
+    _batch = doc->as<JsonArray>();
+    return 0;
+  }
+
+  if (_deserializationError || doc->isNull() || !doc->is<JsonObject>())
+  {
+    return 400;
+  }
+
+  JsonObject jParse = doc->as<JsonObject>();
+
+  _readEnvelope(jParse, requestKey, useShortKeys);
+  _readBody(jParse, useShortKeys);
 
   return 0;
 }
 
+void ApiJsonRequest::_dispatch(int code) const
+{
+  // A copy never needs more than the source uses, checked first so a failed one leaves nothing behind
+  if (!_fits(outdoc->memoryUsage()) || !_item.set(*outdoc))
+    _overflowed();
+}
+
+void ApiJsonRequest::_dispatchRaw(int code, const char *body, size_t length) const
+{
+  if (format == API_FORMAT_MSGPACK)
+  {
+    // Raw json cannot be embedded in msgpack output, so is added as values
+    StaticJsonDocument<128> fallback;
+    JsonDocument *parsed = _rawDocument(body, length, fallback);
+
+    if (parsed && (!_fits(parsed->memoryUsage()) || !_item.set(*parsed)))
+      _overflowed();
+
+    return;
+  }
+
+  // Non const pointer so ArduinoJson keeps a copy
+  if (!_fits(length + 1) || !_item.set(serialized((char *)body, length)))
+    _overflowed();
+}
+
+void ApiJsonRequest::_dispatchEncoded(int code, const char *body, size_t length) const
+{
+  // Serialized values are written as is by both json and msgpack
+  if (!_fits(length + 1) || !_item.set(serialized((char *)body, length)))
+    _overflowed();
+}
+
+void ApiJsonRequest::_dispatchText(int code, const char *body, size_t length) const
+{
+  // Added as a string value, so it is escaped in json & msgpack alike
+  if (!_fits(length + 1) || !_item.set((char *)body))
+    _overflowed();
+}
+
+bool ApiJsonRequest::_fits(size_t bytes) const
+{
+  return doc->memoryUsage() + bytes <= doc->capacity();
+}
+
+void ApiJsonRequest::_overflowed() const
+{
+  char body[KOOLAPI_ERROR_BODY_SIZE];
+  size_t length = (format == API_FORMAT_MSGPACK) ? koolApiErrorMsgPack(body, 507, _id)
+                                                 : koolApiErrorJson(body, 507, _id);
+
+  // The item's slot is already allocated, a number needs no more memory
+  if (!_item.set(serialized(body, length)))
+    _item.set(507);
+}
+
+int ApiJsonRequest::parse(const char *urlBase, const char *requestKey)
+{
+  if (!_item.is<JsonObject>())
+  {
+    return 400;
+  }
+
+  JsonObject jParse = _item.as<JsonObject>();
+
+  _readEnvelope(jParse, requestKey, _shortKeys);
+  _readBody(jParse, _shortKeys);
+
+  return 0;
+}
@@ -20,6 +20,13 @@ public:
    */
   bool useShortKeys = false;
 
+  /**
+   * @brief Receives output streamed by handlers using `stream`.
+   *
+   * If not set streamed output is limited to what fits the output document.
+   */
+  KoolApiStreamSink streamSink;
+
   /**
    * @brief Process char request without output. Uses less memory
    *
@@ -108,21 +115,138 @@ public:
   {
   }
 
+  /**
+   * @brief Process const input of known length placing any output in `output`.
+   *
+   * Required for MessagePack input, which may contain null bytes.
+   *
+   * @param in json or msgpack
+   * @param maxInLength length of in
+   * @param output output char[]
+   * @param maxLength size of output char[]
+   */
+  ApiCharRequest(const char *in, size_t maxInLength, char *output, size_t maxLength)
+      : _jsonInConst(in),
+        _output(output),
+        _maxLength(maxLength),
+        _maxInLength(maxInLength),
+        _isConst(true)
+  {
+  }
+
   virtual ~ApiCharRequest(){};
 
+  /**
+   * @brief Bytes written to `output`.
+   *
+   * Needed for MessagePack output which is not null terminated.
+   */
+  size_t outputLength() const { return _outputLength; }
+
 protected:
   void _dispatch(int code) const override;
+  void _dispatchRaw(int code, const char *body, size_t length) const override;
+  void _dispatchEncoded(int code, const char *body, size_t length) const override;
+  void _dispatchText(int code, const char *body, size_t length) const override;
+  virtual void _dispatchStream(int code, std::shared_ptr<KoolApiStream> stream) override;
   virtual int parse(const char *urlBase, const char *requestKey) override;
+  virtual int parseEnvelope(const char *urlBase, const char *requestKey) override;
+  virtual bool _usesShortKeys() const override { return useShortKeys; }
+  virtual size_t _inputLength() const override;
+  virtual const char *_peekUri(const char *urlBase, const char *requestKey) override;
 
 private:
   friend class KoolApi;
 
+  /**
+   * @brief Parse the input into `target`
+   *
+   * @param target
+   * @param filter Only keep envelope keys. Input is then treated as const so it is left untouched.
+   * @param requestKey
+   * @return DeserializationError
+   */
+  DeserializationError _deserialize(JsonDocument &target, bool filter, const char *requestKey = nullptr);
+
+  /**
+   * @brief Write `source` to output in the request's format, a 507 error if it does not fit
+   *
+   * @param source
+   */
+  void _write(JsonVariantConst source) const;
+
+  /**
+   * @brief Copy already encoded bytes to output, a 507 error if they do not fit
+   *
+   * @param body
+   * @param length
+   */
+  void _copy(const char *body, size_t length) const;
+
+  /**
+   * @brief Output a 507 error in place of a body too large for it, or nothing if that does not fit either
+   *
+   */
+  void _overflowed() const;
+
   const char *_jsonInConst;
   char *_jsonIn;
   char *_output;
   size_t _maxLength = 0;
+  mutable size_t _outputLength = 0;
   int _maxInLength = 0;
   bool _isConst = false;
 };
 
+/**
+ * @brief KoolApi input from an already parsed json request.
+ *
+ * Used for each item of a batch envelope, the response replaces the item.
+ */
+class ApiJsonRequest : public ApiRequest
+{
+public:
+  /**
+   * @brief Process a parsed request, replacing it with its response
+   *
+   * Set `doc` & `outdoc` before processing, `outdoc` is where the response is built.
+   *
+   * @param item Request object
+   * @param shortKeys Whether the item uses short keys
+   */
+  ApiJsonRequest(JsonVariant item, bool shortKeys = false)
+      : _item(item),
+        _shortKeys(shortKeys)
+  {
+  }
+
+  virtual ~ApiJsonRequest(){};
+
+protected:
+  void _dispatch(int code) const override;
+  void _dispatchRaw(int code, const char *body, size_t length) const override;
+  void _dispatchEncoded(int code, const char *body, size_t length) const override;
+  void _dispatchText(int code, const char *body, size_t length) const override;
+  virtual int parse(const char *urlBase, const char *requestKey) override;
+
+  /**
+   * @brief Whether `bytes` more fit the batch document the response is copied into
+   *
+   * @param bytes
+   * @return bool
+   */
+  bool _fits(size_t bytes) const;
+
+  /**
+   * @brief Answer 507 in place of a response that did not fit the batch
+   *
+   * Falls back to the bare code once not even the error body fits.
+   */
+  void _overflowed() const;
+
+private:
+  JsonVariant _item;
+  bool _shortKeys = false;
+};
+
 #endif // __KOOLAPIREQUESTS_H__
@@ -3,132 +3,868 @@
 #ifdef _ESPAsyncWebServer_H_
 
 
+void ApiAsyncParams::_buildIndex() const
+{
+  size_t count = _request->params();
+
+  for (size_t i = 0; i < count; ++i)
+  {
+    const AsyncWebParameter *p = _request->getParam(i);
+
+    if (p->isPost() != _isPost || p->isFile() != _isFile)
+      continue;
+
+    if (_indexLength == KOOLAPI_MAX_QUERY_PARAMS)
+    {
+      _overflow = true;
+      break;
+    }
+
+    _index[_indexLength] = p;
+    _hashes[_indexLength++] = koolutils::hash(p->name().c_str());
+  }
+
+  _indexed = true;
+}
+
+const AsyncWebParameter *ApiAsyncParams::_find(const char *name) const
+{
+  if (!name)
+    return nullptr;
+
+  if (!_indexed)
+    _buildIndex();
+
+  uint32_t h = koolutils::hash(name);
+
+  for (uint8_t i = 0; i < _indexLength; ++i)
+  {
+    if (_hashes[i] == h && strcmp(_index[i]->name().c_str(), name) == 0)
+      return _index[i];
+  }
+
+  return (_overflow) ? _request->getParam(name, _isPost, _isFile) : nullptr;
+}
+
+bool ApiAsyncParams::serialize(char *buffer, size_t size, size_t &length) const
+{
+  size_t count = _request->params();
+
+  length = 0;
+
+  // In the order sent, so reordered params are not shared
+  for (size_t i = 0; i < count; ++i)
+  {
+    const AsyncWebParameter *p = _request->getParam(i);
+
+    if (p->isPost() != _isPost || p->isFile() != _isFile)
+      continue;
+
+    size_t nameLength = p->name().length() + 1;
+    size_t valueLength = p->value().length() + 1;
+
+    if (length + nameLength + valueLength > size)
+      return false;
+
+    memcpy(buffer + length, p->name().c_str(), nameLength);
+    memcpy(buffer + length + nameLength, p->value().c_str(), valueLength);
+    length += nameLength + valueLength;
+  }
+
+  return true;
+}
+
+std::shared_ptr<ApiAsyncClient> ApiAsyncClient::attach(AsyncWebServerRequest *request)
+{
+  auto client = std::make_shared<ApiAsyncClient>();
+  AsyncWebHeader *header = request->getHeader("If-None-Match");
+  AsyncClient *tcp = request->client();
+  size_t count = request->params();
+  size_t length = 0;
+
+  client->method = request->method();
+  client->version = request->version();
+  client->remoteAddress = (tcp) ? (uint32_t)tcp->remoteIP() : 0;
+  client->url = request->url();
+
+  if (header)
+    client->ifNoneMatch = header->value();
+
+  // Query params only, as ApiAsyncParams reads by default
+  for (size_t i = 0; i < count; ++i)
+  {
+    const AsyncWebParameter *p = request->getParam(i);
+
+    if (!p->isPost() && !p->isFile())
+      length += p->name().length() + p->value().length() + 2;
+  }
+
+  if (length)
+  {
+    client->params.reset(new (std::nothrow) char[length]);
+
+    if (!client->params)
+      return nullptr;
+
+    char *pos = client->params.get();
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      const AsyncWebParameter *p = request->getParam(i);
+
+      if (p->isPost() || p->isFile())
+        continue;
+
+      memcpy(pos, p->name().c_str(), p->name().length() + 1);
+      pos += p->name().length() + 1;
+      memcpy(pos, p->value().c_str(), p->value().length() + 1);
+      pos += p->value().length() + 1;
+      ++client->paramCount;
+    }
+
+    client->paramsLength = length;
+  }
+
+  // Owned by the webserver request from here, which deletes it when it is done
+  client->relay = new ApiAsyncRelayResponse(client);
+  request->send(client->relay);
+
+  return client;
+}
+
+ApiAsyncClient *ApiAsyncClient::of(AsyncWebServerRequest *request)
+{
+  auto body = (ApiAsyncBody *)request->_tempObject;
+  return (body) ? body->client : nullptr;
+}
+
+void ApiAsyncClient::hand(AsyncWebServerResponse *response)
+{
+  {
+    KoolApiLock::Guard guard(lock);
+
+    if (connected && !answer)
+    {
+      answer = response;
+      return;
+    }
+  }
+
+  delete response;
+}
+
+ApiAsyncRelayResponse::~ApiAsyncRelayResponse()
+{
+  AsyncWebServerResponse *unsent;
+
+  {
+    KoolApiLock::Guard guard(_client->lock);
+    _client->connected = false;
+    unsent = _client->answer;
+    _client->answer = nullptr;
+  }
+
+  delete unsent;
+  delete _inner;
+
+  if (_client->onGone)
+    _client->onGone(_client->goneArg);
+}
+
+size_t ApiAsyncRelayResponse::_ack(AsyncWebServerRequest *request, size_t len, uint32_t time)
+{
+  if (_inner)
+    return _inner->_ack(request, len, time);
+
+  {
+    KoolApiLock::Guard guard(_client->lock);
+    std::swap(_inner, _client->answer);
+  }
+
+  if (_inner)
+    _inner->_respond(request);
+
+  return 0;
+}
+
+const char *ApiAsyncRetainedParams::_find(const char *name) const
+{
+  if (!name)
+    return nullptr;
+
+  const char *pos = _client->params.get();
+
+  for (uint8_t i = 0; i < _client->paramCount; ++i)
+  {
+    const char *value = pos + strlen(pos) + 1;
+
+    if (strcmp(pos, name) == 0)
+      return value;
+
+    pos = value + strlen(value) + 1;
+  }
+
+  return nullptr;
+}
+
+bool ApiAsyncRetainedParams::serialize(char *buffer, size_t size, size_t &length) const
+{
+  // Kept in the form ApiAsyncParams writes, so retained and direct requests share
+  if (_client->paramsLength > size)
+    return false;
+
+  // No buffer is allocated when there are no params
+  if (_client->paramsLength)
+    memcpy(buffer, _client->params.get(), _client->paramsLength);
+
+  length = _client->paramsLength;
+  return true;
+}
+
+void ApiAsyncSocketOutbox::push(frame_t *frame, bool binary)
+{
+  frame->next = nullptr;
+  frame->binary = binary;
+
+  {
+    KoolApiLock::Guard guard(lock);
+
+    if (connected)
+    {
+      if (tail)
+        tail->next = frame;
+      else
+        head = frame;
+
+      tail = frame;
+      return;
+    }
+  }
+
+  free(frame);
+}
+
+ApiAsyncSocketOutbox::frame_t *ApiAsyncSocketOutbox::pop()
+{
+  KoolApiLock::Guard guard(lock);
+  frame_t *frame = head;
+
+  if (frame)
+  {
+    head = frame->next;
+
+    if (!head)
+      tail = nullptr;
+  }
+
+  return frame;
+}
+
+void ApiAsyncSocketOutbox::release()
+{
+  KoolApiLock::Guard guard(lock);
+  --senders;
+}
+
+ApiAsyncSocketRelay::~ApiAsyncSocketRelay()
+{
+  ApiAsyncSocketOutbox::frame_t *frame;
+
+  {
+    KoolApiLock::Guard guard(_outbox->lock);
+    _outbox->connected = false;
+    frame = _outbox->head;
+    _outbox->head = _outbox->tail = nullptr;
+  }
+
+  while (frame)
+  {
+    auto next = frame->next;
+    free(frame);
+    frame = next;
+  }
+
+  delete _inner;
+}
+
+size_t ApiAsyncSocketRelay::send(AsyncClient *client)
+{
+  if (_inner && _inner->finished())
+  {
+    delete _inner;
+    _inner = nullptr;
+  }
+
+  if (!_inner)
+  {
+    ApiAsyncSocketOutbox::frame_t *frame = _outbox->pop();
+
+    if (!frame)
+      return 0;
+
+    // Copied by the message, which frames and masks it as the webserver's own do
+    _inner = new AsyncWebSocketBasicMessage((const char *)frame->data(), frame->length, (frame->binary) ? WS_BINARY : WS_TEXT);
+    free(frame);
+  }
+
+  return _inner->send(client);
+}
+
+bool ApiAsyncSocketRelay::finished()
+{
+  if (_inner && !_inner->finished())
+    return false;
+
+  KoolApiLock::Guard guard(_outbox->lock);
+  return !_outbox->senders && !_outbox->head;
+}
+
 void ApiAsyncWebRequest::_dispatch(int code) const
 {
-  auto len = measureJson(outdoc);
+  auto len = measureJson(*outdoc);
 
-  AsyncResponseStream *response = _request->beginResponseStream("application/json", len);
-  response->addHeader("Cache-Control", "no-store");
-  response->addHeader("Access-Control-Allow-Origin", "*");
-  response->addHeader("Access-Control-Allow-Headers", "*");
-  response->addHeader("Access-Control-Allow-Credentials", "true");
+  AsyncResponseStream *response = new AsyncResponseStream("application/json", len);
+  _prepare(response, code);
+  serializeJson(*outdoc, *response);
+  _reply(response);
+}
+
+void ApiAsyncWebRequest::_dispatchRaw(int code, const char *body, size_t length) const
+{
+  AsyncResponseStream *response = new AsyncResponseStream("application/json", length);
+  _prepare(response, code);
+  response->write((const uint8_t *)body, length);
+  _reply(response);
+}
+
+void ApiAsyncWebRequest::_dispatchText(int code, const char *body, size_t length) const
+{
+  // Version of the Prometheus text format
+  AsyncResponseStream *response = new AsyncResponseStream("text/plain; version=0.0.4", length);
+  _prepare(response, code);
+  response->write((const uint8_t *)body, length);
+  _reply(response);
+}
+
+void ApiAsyncWebRequest::_dispatchStream(int code, std::shared_ptr<KoolApiStream> stream)
+{
+  stream->begin(outdoc->as<JsonObject>(), _enveloped);
+
+  // The stream is owned by the response, which outlives this request
+  auto filler = [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t
+  { return stream->read(buffer, maxLen); };
+
+  // As beginChunkedResponse, HTTP/1.0 clients cannot take chunks
+  uint8_t version = (_client) ? _client->version : _request->version();
+  AsyncWebServerResponse *response;
+
+  if (version)
+    response = new AsyncChunkedResponse("application/json", filler);
+  else
+    response = new AsyncCallbackResponse("application/json", 0, filler);
+
+  _prepare(response, code);
+  _reply(response);
+}
+
+void ApiAsyncWebRequest::_dispatchHead(int code, size_t length) const
+{
+  AsyncWebServerResponse *response = new ApiAsyncHeadResponse(code, length);
+
+  _prepare(response, code);
+  _reply(response);
+}
+
+void ApiAsyncWebRequest::_reply(AsyncWebServerResponse *response) const
+{
+  if (_client)
+  {
+    // Written by the relay on the async_tcp task, never from here
+    _client->hand(response);
+    return;
+  }
+
+  // Still in the webserver's callback, a streamed body's relay can start at once
+  ApiAsyncClient *streamed = ApiAsyncClient::of(_request);
+
+  if (streamed)
+  {
+    streamed->hand(response);
+    streamed->relay->_respond(_request);
+    return;
+  }
 
-  response->setCode(code);
-  serializeJson(outdoc, *response);
   _request->send(response);
 }
 
-void ApiAsyncWebRequest::_sendOptions() const
+bool ApiAsyncWebRequest::_matchesETag() const
 {
-  uint8_t optsLen = outdoc["options"].size();
-  uint8_t pos = 0;
+  const char *value;
 
-  auto len = measureJson(outdoc);
-  AsyncResponseStream *resp = _request->beginResponseStream("application/json", len);
+  if (_client)
+  {
+    value = _client->ifNoneMatch.c_str();
+  }
+  else
+  {
+    AsyncWebHeader *header = _request->getHeader("If-None-Match");
+    value = (header) ? header->value().c_str() : "";
+  }
+
+  if (!value[0])
+    return false;
 
-  resp->addHeader("Access-Control-Allow-Origin", "*");
-  resp->addHeader("Access-Control-Allow-Headers", "*");
+  // May be a list, or weak tags
+  return strcmp(value, "*") == 0 || strstr(value, _etag);
+}
 
-  if (optsLen)
+void ApiAsyncWebRequest::_prepare(AsyncWebServerResponse *response, int code) const
+{
+  if (_etag[0])
+  {
+    // Clients must revalidate, which only costs a 304 while unchanged
+    response->addHeader("Cache-Control", "no-cache");
+    response->addHeader("ETag", _etag);
+  }
+  else
   {
-    char optsBuff[optsLen * 10];
-    optsBuff[0] = 0;
+    response->addHeader("Cache-Control", "no-store");
+  }
+
+  _addCors(response);
+  response->setCode(code);
+}
+
+void ApiAsyncWebRequest::_addCors(AsyncWebServerResponse *response) const
+{
+  if (!_cors->origin)
+    return;
+
+  response->addHeader("Access-Control-Allow-Origin", _cors->origin);
+
+  if (_cors->headers)
+    response->addHeader("Access-Control-Allow-Headers", _cors->headers);
 
-    for (uint8_t i = 0; i < optsLen; ++i)
+  if (_cors->credentials)
+    response->addHeader("Access-Control-Allow-Credentials", "true");
+}
+
+void ApiAsyncWebRequest::_sendOptions(const char *body, size_t length, const char *methods) const
+{
+  AsyncResponseStream *resp = new AsyncResponseStream("application/json", length);
+
+  _addCors(resp);
+  resp->addHeader("Access-Control-Allow-Methods", methods);
+
+  if (_cors->maxAge)
+    resp->addHeader("Access-Control-Max-Age", _cors->maxAge);
+
+  resp->setCode(200);
+  resp->write((const uint8_t *)body, length);
+  _reply(resp);
+}
+
+bool ApiAsyncWebRequest::_retainInput()
+{
+  auto body = (ApiAsyncBody *)_request->_tempObject;
+
+  if (_isBody)
+  {
+    // A reassembled body is taken over, the webserver may free the request before processing
+    if (body && _data == body->data())
     {
-      strcat(optsBuff, outdoc["options"][i]);
-      
-      ++pos;
+      _ownedBody = body;
+      _request->_tempObject = nullptr;
+    }
+    else
+    {
+      _data = _retain(_data, _len);
 
-      if (pos < optsLen)
-        strcat(optsBuff, ", ");
+      if (!_data)
+        return false;
     }
+  }
+
+  // A streamed body has been relayed since its first chunk
+  ApiAsyncClient *streamed = ApiAsyncClient::of(_request);
+  _client = (streamed) ? streamed->shared_from_this() : ApiAsyncClient::attach(_request);
 
-    resp->addHeader("Access-Control-Allow-Methods", optsBuff);
+  return _client != nullptr;
+}
+
+ApiRequest *ApiAsyncWebRequest::_detach() const
+{
+  auto detached = new (std::nothrow) ApiAsyncWebRequest(_request);
+
+  if (!detached)
+    return nullptr;
+
+  // A request has one relay, which answers whichever copy replies. Its lock is
+  // only taken to hand over a response, so the copy may answer on the task
+  // still running the handler.
+  if (_client)
+    detached->_client = _client;
+  else if (!detached->_retainInput())
+  {
+    delete detached;
+    return nullptr;
   }
 
-  resp->setCode(200);
-  serializeJson(outdoc, *resp);
-  _request->send(resp);
+  return detached;
 }
 
-int ApiAsyncWebRequest::parse(const char *urlBase, const char *requestKey)
+uint32_t ApiAsyncWebRequest::_remoteAddress() const
 {
-  this->_method = koolApiMethodMap.isValid((api_method_t)_request->method(), API_METHOD_UNKNOWN);
+  if (_client)
+    return _client->remoteAddress;
+
+  AsyncClient *client = _request->client();
+  return (client) ? (uint32_t)client->remoteIP() : 0;
+}
+
+const char *ApiAsyncWebRequest::_peekUri(const char *urlBase, const char *requestKey)
+{
+  return _url().c_str() + strlen(urlBase) + 1;
+}
+
+int ApiAsyncWebRequest::parseEnvelope(const char *urlBase, const char *requestKey)
+{
+  auto method = (_client) ? _client->method : _request->method();
+  this->_method = koolApiMethodMap.isValid((api_method_t)method, API_METHOD_UNKNOWN);
 
   if (this->_method == API_METHOD_UNKNOWN)
   {
     return 405;
   }
 
+  int bl = strlen(urlBase);
+  auto url = _url().c_str();
+
+  this->uri = url + bl + 1;
+
+  return 0;
+}
+
+int ApiAsyncWebRequest::parse(const char *urlBase, const char *requestKey)
+{
+  int err = parseEnvelope(urlBase, requestKey);
+
+  if (err)
+  {
+    return err;
+  }
+
   // Only read json if a body request
   if (_isBody)
   {
-    _deserializationError = deserializeJson(doc, _data, _len);
+    _deserializationError = deserializeJson(*doc, _data, _len);
 
-    if (_deserializationError || doc.isNull() || !doc.is<JsonObject>())
+    if (_deserializationError || doc->isNull() || !doc->is<JsonObject>())
     {
       return 400;
     }
   }
 
-  int bl = strlen(urlBase);
-  auto url = _request->url().c_str();
-
-  this->uri = url + bl + 1;
-
   // Get requests should have no json body
   if (this->_method != API_METHOD_GET)
   {
-    this->json = doc.as<JsonObject>();
+    this->json = doc->as<JsonObject>();
   }
 
-  this->_out = outdoc.to<JsonObject>();
-  this->params = new ApiAsyncParams(_request);
+  this->_out = outdoc->to<JsonObject>();
+
+  if (_client)
+    _emplaceParams<ApiAsyncRetainedParams>(_client.get());
+  else
+    _emplaceParams<ApiAsyncParams>(_request);
 
   return 0;
 };
 
 void ApiAsyncWebSocket::_dispatch(int code) const
 {
-  auto len = measureJson(outdoc);
+  _send(*outdoc);
+}
 
-  if (len)
+void ApiAsyncWebSocket::_dispatchRaw(int code, const char *body, size_t length) const
+{
+  if (format == API_FORMAT_MSGPACK)
   {
-    AsyncWebSocketMessageBuffer *buffer = _ws->makeBuffer(len);
-    serializeJson(outdoc, buffer->get(), len + 1);
-    _client->text(buffer);
+    StaticJsonDocument<128> fallback;
+    JsonDocument *parsed = _rawDocument(body, length, fallback);
+
+    if (parsed)
+      _send(*parsed);
+
+    return;
   }
+
+  _dispatchText(code, body, length);
 }
 
-int ApiAsyncWebSocket::parse(const char *urlBase, const char *requestKey)
+void ApiAsyncWebSocket::_dispatchText(int code, const char *body, size_t length) const
 {
-  _deserializationError = deserializeJson(doc, _data, _len);
+  frame_t frame;
 
-  if (_deserializationError || doc.isNull() || !doc.is<JsonObject>())
+  if (length && _makeFrame(length, frame))
   {
-    return 400;
+    memcpy(frame.data, body, length);
+    _sendFrame(frame, false);
+  }
+}
+
+void ApiAsyncWebSocket::_dispatchEncoded(int code, const char *body, size_t length) const
+{
+  if (format != API_FORMAT_MSGPACK)
+  {
+    _dispatchRaw(code, body, length);
+    return;
   }
 
-  auto jParse = doc.as<JsonObject>();
+  frame_t frame;
+
+  if (_makeFrame(length, frame))
+  {
+    memcpy(frame.data, body, length);
+    _sendFrame(frame, true);
+  }
+}
+
+ApiRequest *ApiAsyncWebSocket::_detach() const
+{
+  auto detached = new (std::nothrow) ApiAsyncWebSocket(_ws, format);
+
+  if (!detached)
+    return nullptr;
 
-  this->_id = jParse["id"];
+  // Copies add to the same outbox, which is sent once all are done
+  if (_outbox)
+  {
+    KoolApiLock::Guard guard(_outbox->lock);
+    ++_outbox->senders;
+    detached->_outbox = _outbox;
+  }
+  else
+  {
+    detached->_outbox = _relay(_client);
+  }
 
-  this->uri = jParse[requestKey];
+  if (!detached->_outbox)
+  {
+    delete detached;
+    return nullptr;
+  }
 
-  const char *methodStr = jParse["method"];
+  return detached;
+}
 
-  this->_method = koolApiMethodMap.textToCode(methodStr, API_METHOD_UNKNOWN);
+uint32_t ApiAsyncWebSocket::_remoteAddress() const
+{
+  return (_outbox) ? _outbox->remoteAddress : (uint32_t)_client->remoteIP();
+}
 
-  // Get requests should have no json body
-  if (_method != API_METHOD_GET)
+std::shared_ptr<ApiAsyncSocketOutbox> ApiAsyncWebSocket::_relay(AsyncWebSocketClient *client)
+{
+  auto outbox = std::make_shared<ApiAsyncSocketOutbox>();
+  outbox->remoteAddress = client->remoteIP();
+
+  // Deleted by the client once finished, or at once if it has gone or its queue is full
+  client->message(new ApiAsyncSocketRelay(outbox));
+
+  return outbox;
+}
+
+bool ApiAsyncWebSocket::_makeFrame(size_t size, frame_t &frame) const
+{
+  if (_outbox)
   {
-    this->json = jParse["body"];
+    // With room for the terminator serializeJson writes, as the server's buffers have
+    frame.queued = (ApiAsyncSocketOutbox::frame_t *)malloc(sizeof(ApiAsyncSocketOutbox::frame_t) + size + 1);
+
+    if (!frame.queued)
+      return false;
+
+    frame.queued->length = size;
+    frame.data = frame.queued->data();
+    return true;
+  }
+
+  frame.buffer = _ws->makeBuffer(size);
+
+  // The buffer is kept by the server, but holds no data when that allocation failed
+  if (!frame.buffer || !frame.buffer->get())
+    return false;
+
+  frame.data = frame.buffer->get();
+  return true;
+}
+
+void ApiAsyncWebSocket::_sendFrame(frame_t &frame, bool binary) const
+{
+  if (_outbox)
+    _outbox->push(frame.queued, binary);
+  else if (binary)
+    _client->binary(frame.buffer);
+  else
+    _client->text(frame.buffer);
+}
+
+void ApiAsyncWebSocket::_send(JsonVariantConst source) const
+{
+  if (format == API_FORMAT_MSGPACK)
+  {
+    auto len = measureMsgPack(source);
+    frame_t frame;
+
+    if (len && _makeFrame(len, frame))
+    {
+      serializeMsgPack(source, frame.data, len);
+      _sendFrame(frame, true);
+    }
+
+    return;
+  }
+
+  auto len = measureJson(source);
+  frame_t frame;
+
+  if (len && _makeFrame(len, frame))
+  {
+    serializeJson(source, frame.data, len + 1);
+    _sendFrame(frame, false);
+  }
+}
+
+void ApiAsyncWebSocket::_dispatchStream(int code, std::shared_ptr<KoolApiStream> stream)
+{
+  // Streams are json text, msgpack output is collected into the output document
+  if (format == API_FORMAT_MSGPACK)
+  {
+    ApiRequest::_dispatchStream(code, stream);
+    return;
+  }
+
+  // Each message is complete json holding as many items as fit, and `"more"`
+  std::unique_ptr<uint8_t[]> frame(new uint8_t[KOOLAPI_STREAM_FRAME_SIZE]);
+  size_t len, required;
+
+  stream->begin(outdoc->as<JsonObject>(), true);
+
+  while (!stream->done())
+  {
+    const uint8_t *message = frame.get();
+    std::unique_ptr<uint8_t[]> large;
+
+    len = stream->readMessage(frame.get(), KOOLAPI_STREAM_FRAME_SIZE, required);
+
+    // An envelope or item larger than a frame is sent in a message of its own. The size
+    // needed grows as each part is fitted, the envelope alone first, so try until it fits.
+    for (size_t size = 0; !len && required > size;)
+    {
+      size = required;
+      large.reset(new (std::nothrow) uint8_t[size]);
+
+      if (!large)
+        break;
+
+      len = stream->readMessage(large.get(), size, required);
+      message = large.get();
+    }
+
+    if (!len)
+    {
+      if (!stream->done())
+        _abortStream(507);
+
+      return;
+    }
+
+    frame_t frame;
+
+    if (!_makeFrame(len, frame))
+    {
+      _abortStream(507);
+      return;
+    }
+
+    memcpy(frame.data, message, len);
+    _sendFrame(frame, false);
+  }
+}
+
+void ApiAsyncWebSocket::_abortStream(int code) const
+{
+  char body[KOOLAPI_ERROR_BODY_SIZE];
+  _dispatchText(code, body, koolApiErrorJson(body, code, _id));
+}
+
+bool ApiAsyncWebSocket::_retainInput()
+{
+  _data = _retain(_data, _len);
+
+  if (!_data)
+    return false;
+
+  // Frames are sent by the relay from now on, the client may be deleted before processing
+  _outbox = _relay(_client);
+  _client = nullptr;
+
+  return _outbox != nullptr;
+}
+
+const char *ApiAsyncWebSocket::_peekUri(const char *urlBase, const char *requestKey)
+{
+  return _peekInput((const char *)_data, _len, requestKey, false);
+}
+
+int ApiAsyncWebSocket::parseEnvelope(const char *urlBase, const char *requestKey)
+{
+  // Already read to queue the request
+  if (_envelopeRead)
+    return 0;
+
+  // Batches are routed item by item, after a full parse
+  if (_len && _isBatchInput((const char *)_data, _len, format))
+  {
+    _parsed = true;
+    return parse(urlBase, requestKey);
+  }
+
+  StaticJsonDocument<JSON_OBJECT_SIZE(4)> envelope;
+  _envelopeFilter(envelope, requestKey);
+
+  // Parsed as const so the frame is left intact for the full parse
+  _deserializationError = _deserializeInput(*outdoc, (const char *)_data, _len, DeserializationOption::Filter(envelope));
+
+  if (_deserializationError || !outdoc->is<JsonObject>())
+  {
+    return 400;
+  }
+
+  _readEnvelope(outdoc->as<JsonObject>(), requestKey);
+
+  return 0;
+}
+
+int ApiAsyncWebSocket::parse(const char *urlBase, const char *requestKey)
+{
+  _deserializationError = _deserializeInput(*doc, _data, _len);
+
+  if (!_deserializationError && doc->is<JsonArray>())
+  {
+    _batch = doc->as<JsonArray>();
+    return 0;
+  }
+
+  if (_deserializationError || doc->isNull() || !doc->is<JsonObject>())
+  {
+    return 400;
   }
 
-  this->_out = outdoc.to<JsonObject>();
+  auto jParse = doc->as<JsonObject>();
 
-  this->params = new ApiJsonParams(jParse["params"].as<JsonObject>());
+  _readEnvelope(jParse, requestKey);
+  _readBody(jParse);
 
   return 0;
 };
@@ -5,6 +5,158 @@
 
 #ifdef _ESPAsyncWebServer_H_
 
+#ifndef KOOLAPI_MAX_BODY_SIZE
+#define KOOLAPI_MAX_BODY_SIZE 4096 // Largest webserver request body accepted, larger are answered 413
+#endif
+
+struct ApiAsyncClient;
+
+/**
+ * @brief Start of the webserver request's `_tempObject` for a body received in several chunks
+ *
+ * Freed by the webserver with the request, so must need no destructor.
+ */
+struct ApiAsyncBody
+{
+  /**
+   * @brief Handler the body is streamed to, nullptr when it is reassembled after this header
+   *
+   */
+  KoolApiPath *streamedTo;
+
+  /**
+   * @brief Connection of a streamed body, which is relayed from its first chunk
+   *
+   */
+  ApiAsyncClient *client;
+
+  uint8_t *data() { return (uint8_t *)(this + 1); }
+};
+
+/**
+ * @brief A webserver request answered outside the webserver's callbacks
+ *
+ * The webserver request can be deleted by the async_tcp task at any time once
+ * its callback returns, so what processing needs is copied from it first. Only
+ * the relay response writes to the connection, requests hand it their answer.
+ */
+struct ApiAsyncClient : public std::enable_shared_from_this<ApiAsyncClient>
+{
+  /**
+   * @brief Guards `answer`, held only to hand it over
+   *
+   */
+  KoolApiLock lock;
+
+  /**
+   * @brief Cleared once the webserver deletes the request
+   *
+   */
+  std::atomic<bool> connected{true};
+
+  /**
+   * @brief Response waiting for the relay to send it
+   *
+   */
+  AsyncWebServerResponse *answer = nullptr;
+
+  /**
+   * @brief The relay response, only to be used from the webserver's callbacks
+   *
+   */
+  AsyncWebServerResponse *relay = nullptr;
+
+  /**
+   * @brief Called on the async_tcp task as the request is deleted, before its `_tempObject` is freed
+   *
+   */
+  void (*onGone)(void *arg) = nullptr;
+  void *goneArg = nullptr;
+
+  WebRequestMethodComposite method = 0;
+  uint8_t version = 0;
+  uint32_t remoteAddress = 0;
+  String url;
+  String ifNoneMatch;
+
+  /**
+   * @brief Query params in the order sent, each name then value null terminated
+   *
+   */
+  std::unique_ptr<char[]> params;
+  size_t paramsLength = 0;
+  uint8_t paramCount = 0;
+
+  /**
+   * @brief Copy what processing needs from `request` and send it the relay response
+   *
+   * Must be called from the webserver's callback.
+   *
+   * @param request
+   * @return std::shared_ptr<ApiAsyncClient> nullptr if out of memory
+   */
+  static std::shared_ptr<ApiAsyncClient> attach(AsyncWebServerRequest *request);
+
+  /**
+   * @brief Client relaying a streamed body, from the webserver's callback
+   *
+   * @param request
+   * @return ApiAsyncClient* nullptr if the request is not relayed
+   */
+  static ApiAsyncClient *of(AsyncWebServerRequest *request);
+
+  /**
+   * @brief Give the relay its answer, deleted instead if the client has gone or is answered
+   *
+   * @param response
+   */
+  void hand(AsyncWebServerResponse *response);
+};
+
+/**
+ * @brief Params of a retained request, read from its `ApiAsyncClient`
+ *
+ */
+class ApiAsyncRetainedParams : public ApiParamBase
+{
+  const ApiAsyncClient *_client;
+
+public:
+  explicit ApiAsyncRetainedParams(const ApiAsyncClient *client) : _client(client) {}
+
+  const int length() const override { return _client->paramCount + _pathLength(); }
+
+  bool has(const char *name) const override { return _pathFind(name) || _find(name); }
+
+  String get(const char *name) const override
+  {
+    auto v = getView(name);
+    return (v) ? String(v.data, v.length) : String();
+  }
+
+  ApiParamView getView(const char *name) const override
+  {
+    auto v = _pathView(name);
+
+    if (v)
+      return v;
+
+    const char *value = _find(name);
+    return (value) ? ApiParamView{value, strlen(value)} : ApiParamView{nullptr, 0};
+  }
+
+  bool serialize(char *buffer, size_t size, size_t &length) const override;
+
+private:
+  /**
+   * @brief Value of the param `name`
+   *
+   * @param name
+   * @return const char* nullptr if not sent
+   */
+  const char *_find(const char *name) const;
+};
+
 class ApiAsyncParams : public ApiParamBase
 {
   AsyncWebServerRequest *_request;
@@ -15,27 +167,237 @@ class ApiAsyncParams : public ApiParamBase
 
 public:
   ApiAsyncParams(AsyncWebServerRequest *request, bool isPost = false, bool isFile = false)
-      : _request(request), _isPost(isPost)
+      : _request(request), _isPost(isPost), _isFile(isFile)
   {}
 
   virtual ~ApiAsyncParams(){};
 
-  const int length() const override { return _request->params(); }
+  const int length() const override { return _request->params() + _pathLength(); }
 
-  bool has(const char *name) const override { return _request->hasParam(name, _isPost, _isFile); }
+  bool has(const char *name) const override { return _pathFind(name) || _find(name); }
 
   String get(const char *name) const override
   {
-    AsyncWebParameter *p = _request->getParam(name, _isPost);
+    auto pp = _pathFind(name);
+
+    if (pp)
+      return String(pp->value, pp->valueLength);
+
+    const AsyncWebParameter *p = _find(name);
     return (p != nullptr) ? p->value() : String();
   }
+
+  ApiParamView getView(const char *name) const override
+  {
+    auto v = _pathView(name);
+
+    if (v)
+      return v;
+
+    const AsyncWebParameter *p = _find(name);
+    return (p) ? ApiParamView{p->value().c_str(), p->value().length()} : ApiParamView{nullptr, 0};
+  }
+
+  bool serialize(char *buffer, size_t size, size_t &length) const override;
+
+private:
+  /**
+   * @brief Params of the request built on first lookup, with their name hashes
+   *
+   */
+  mutable const AsyncWebParameter *_index[KOOLAPI_MAX_QUERY_PARAMS];
+  mutable uint32_t _hashes[KOOLAPI_MAX_QUERY_PARAMS];
+  mutable uint8_t _indexLength = 0;
+  mutable bool _indexed = false;
+
+  /**
+   * @brief Whether params beyond KOOLAPI_MAX_QUERY_PARAMS need searching
+   *
+   */
+  mutable bool _overflow = false;
+
+  void _buildIndex() const;
+
+  const AsyncWebParameter *_find(const char *name) const;
+};
+
+/**
+ * @brief Response sent as a request is retained, which writes the answer handed to it later
+ *
+ * Runs on the async_tcp task like every response, so the connection is only
+ * written from there. The webserver polls it about every 500 ms and on each
+ * ack, so an answer from a worker waits for the next poll. Deleted with the
+ * request, which is how a client that has gone is noticed.
+ *
+ * Forwards to the answer through the members of AsyncWebServerResponse as of
+ * ESPAsyncWebServer 1.2.3, as does ApiAsyncHeadResponse.
+ */
+class ApiAsyncRelayResponse : public AsyncWebServerResponse
+{
+public:
+  explicit ApiAsyncRelayResponse(std::shared_ptr<ApiAsyncClient> client) : _client(client) {}
+
+  ~ApiAsyncRelayResponse() override;
+
+  bool _sourceValid() const override { return true; }
+  bool _started() const override { return _inner && _inner->_started(); }
+  bool _finished() const override { return _inner && _inner->_finished(); }
+  bool _failed() const override { return _inner && _inner->_failed(); }
+
+  void _respond(AsyncWebServerRequest *request) override { _ack(request, 0, 0); }
+
+  size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override;
+
+private:
+  std::shared_ptr<ApiAsyncClient> _client;
+
+  /**
+   * @brief The answer once taken from the client
+   *
+   */
+  AsyncWebServerResponse *_inner = nullptr;
+};
+
+/**
+ * @brief Frames answering a websocket client from outside the webserver's callbacks
+ *
+ */
+struct ApiAsyncSocketOutbox
+{
+  struct frame_t
+  {
+    frame_t *next;
+    size_t length;
+    bool binary;
+
+    uint8_t *data() { return (uint8_t *)(this + 1); }
+  };
+
+  /**
+   * @brief Guards the frames and `senders`, held only to add or take one
+   *
+   */
+  KoolApiLock lock;
+
+  /**
+   * @brief Cleared once the client has gone
+   *
+   */
+  std::atomic<bool> connected{true};
+
+  frame_t *head = nullptr;
+  frame_t *tail = nullptr;
+
+  /**
+   * @brief Requests that can still add frames, the relay finishes once none are left
+   *
+   */
+  uint8_t senders = 1;
+
+  uint32_t remoteAddress = 0;
+
+  /**
+   * @brief Queue a frame, freed instead if the client has gone
+   *
+   * @param frame
+   * @param binary
+   */
+  void push(frame_t *frame, bool binary);
+
+  /**
+   * @brief Take the oldest frame
+   *
+   * @return frame_t* nullptr if none, free it once sent
+   */
+  frame_t *pop();
+
+  /**
+   * @brief A request can no longer add frames
+   *
+   */
+  void release();
+};
+
+/**
+ * @brief Message queued to a websocket client as a request is retained, which sends the frames added later
+ *
+ * `AsyncWebSocketClient` runs its queue on the async_tcp task, on each ack and
+ * about every 500 ms, so frames are only written from there. Later messages to
+ * the client wait behind it until the request is answered.
+ */
+class ApiAsyncSocketRelay : public AsyncWebSocketMessage
+{
+public:
+  explicit ApiAsyncSocketRelay(std::shared_ptr<ApiAsyncSocketOutbox> outbox) : _outbox(outbox) {}
+
+  ~ApiAsyncSocketRelay() override;
+
+  void ack(size_t len, uint32_t time) override
+  {
+    if (_inner)
+      _inner->ack(len, time);
+  }
+
+  size_t send(AsyncClient *client) override;
+
+  bool finished() override;
+
+  bool betweenFrames() const override { return !_inner || _inner->betweenFrames(); }
+
+private:
+  std::shared_ptr<ApiAsyncSocketOutbox> _outbox;
+
+  /**
+   * @brief Frame being sent
+   *
+   */
+  AsyncWebSocketMessage *_inner = nullptr;
+};
+
+/**
+ * @brief Response to a HEAD request, headers with the length of the body a GET would send
+ *
+ * The webserver has no public way to send headers alone, so this uses the
+ * protected members of AsyncWebServerResponse as of ESPAsyncWebServer 1.2.3.
+ * library.json pins that version, check this class before moving it.
+ */
+class ApiAsyncHeadResponse : public AsyncWebServerResponse
+{
+public:
+  ApiAsyncHeadResponse(int code, size_t length)
+  {
+    _code = code;
+    _contentType = "application/json";
+    _contentLength = length;
+  }
+
+  bool _sourceValid() const override { return true; }
+
+  void _respond(AsyncWebServerRequest *request) override
+  {
+    String head = _assembleHead(request->version());
+
+    _headLength = head.length();
+    _writtenLength += request->client()->write(head.c_str(), _headLength);
+    _state = RESPONSE_WAIT_ACK;
+  }
+
+  size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override
+  {
+    _ackedLength += len;
+
+    if (_state == RESPONSE_WAIT_ACK && _ackedLength >= _writtenLength)
+      _state = RESPONSE_END;
+
+    return len;
+  }
 };
 
 class ApiAsyncWebRequest : public ApiRequest
 {
 
 public:
-  virtual ~ApiAsyncWebRequest(){};
+  virtual ~ApiAsyncWebRequest() { free(_ownedBody); };
 
   ApiAsyncWebRequest(AsyncWebServerRequest *request) : _request(request),
                                                        _isBody(false)
@@ -52,12 +414,64 @@ public:
 
 protected:
   void _dispatch(int code) const override;
-  virtual void _sendOptions() const override;
+  void _dispatchRaw(int code, const char *body, size_t length) const override;
+  void _dispatchText(int code, const char *body, size_t length) const override;
+  virtual void _dispatchStream(int code, std::shared_ptr<KoolApiStream> stream) override;
+  virtual void _sendOptions(const char *body, size_t length, const char *methods) const override;
+  virtual void _dispatchHead(int code, size_t length) const override;
+  virtual bool _matchesETag() const override;
   virtual int parse(const char *urlBase, const char *requestKey) override;
+  virtual int parseEnvelope(const char *urlBase, const char *requestKey) override;
+  virtual bool _retainInput() override;
+  virtual const char *_peekUri(const char *urlBase, const char *requestKey) override;
+  virtual bool _connected() const override { return !_client || _client->connected; }
+  virtual size_t _inputLength() const override { return _len; }
+  virtual uint32_t _remoteAddress() const override;
+  virtual ApiRequest *_detach() const override;
 
 private:
   friend class KoolApi;
 
+  /**
+   * @brief Connection of a retained request, which is then answered through its relay
+   *
+   */
+  std::shared_ptr<ApiAsyncClient> _client;
+
+  /**
+   * @brief A reassembled body taken from the webserver request as it is retained
+   *
+   */
+  ApiAsyncBody *_ownedBody = nullptr;
+
+  /**
+   * @brief Send a response, or hand it to the relay of a retained or streamed request
+   *
+   * @param response
+   */
+  void _reply(AsyncWebServerResponse *response) const;
+
+  /**
+   * @brief Url of the request, from the copy once retained
+   *
+   */
+  const String &_url() const { return (_client) ? _client->url : _request->url(); }
+
+  /**
+   * @brief Add the common headers and code to a response
+   *
+   * @param response
+   * @param code
+   */
+  void _prepare(AsyncWebServerResponse *response, int code) const;
+
+  /**
+   * @brief Add the headers of the CORS policy
+   *
+   * @param response
+   */
+  void _addCors(AsyncWebServerResponse *response) const;
+
   /**
    * @brief Pointer to async request
    *
@@ -87,23 +501,119 @@ class ApiAsyncWebSocket : public ApiRequest
 {
 
 public:
-  ApiAsyncWebSocket(AsyncWebSocket *ws, AsyncWebSocketClient *client, uint8_t *data, size_t len)
+  /**
+   * @brief Process a websocket frame
+   *
+   * @param ws
+   * @param client
+   * @param data
+   * @param len
+   * @param format API_FORMAT_MSGPACK to read and reply with binary frames
+   */
+  ApiAsyncWebSocket(AsyncWebSocket *ws, AsyncWebSocketClient *client, uint8_t *data, size_t len, api_format_t format = API_FORMAT_JSON)
       : _ws(ws), _client(client), _data(data), _len(len)
   {
+    this->format = format;
   }
 
-  virtual ~ApiAsyncWebSocket(){};
+  virtual ~ApiAsyncWebSocket()
+  {
+    if (_outbox)
+      _outbox->release();
+  };
 
 protected:
   void _dispatch(int code) const override;
+  void _dispatchRaw(int code, const char *body, size_t length) const override;
+  void _dispatchEncoded(int code, const char *body, size_t length) const override;
+  void _dispatchText(int code, const char *body, size_t length) const override;
+  virtual void _dispatchStream(int code, std::shared_ptr<KoolApiStream> stream) override;
   virtual int parse(const char *urlBase, const char *requestKey) override;
+  virtual int parseEnvelope(const char *urlBase, const char *requestKey) override;
+  virtual bool _retainInput() override;
+  virtual const char *_peekUri(const char *urlBase, const char *requestKey) override;
+  virtual bool _connected() const override { return !_outbox || _outbox->connected; }
+  virtual size_t _inputLength() const override { return _len; }
+  virtual uint32_t _remoteAddress() const override;
+  virtual ApiRequest *_detach() const override;
 
 private:
   friend class KoolApi;
 
+  /**
+   * @brief A detached request, answered through `_outbox`
+   *
+   * @param ws
+   * @param format
+   */
+  ApiAsyncWebSocket(AsyncWebSocket *ws, api_format_t format)
+      : _ws(ws), _client(nullptr)
+  {
+    this->format = format;
+  }
+
+  /**
+   * @brief Room for one frame, in the server's buffers or the outbox once retained
+   *
+   */
+  struct frame_t
+  {
+    AsyncWebSocketMessageBuffer *buffer = nullptr;
+    ApiAsyncSocketOutbox::frame_t *queued = nullptr;
+    uint8_t *data = nullptr;
+  };
+
+  /**
+   * @brief Send `source` to the client, as a binary frame for msgpack
+   *
+   * @param source
+   */
+  void _send(JsonVariantConst source) const;
+
+  /**
+   * @brief Make room for a frame of `size` bytes
+   *
+   * @param size
+   * @param frame
+   * @return bool false if it could not be allocated
+   */
+  bool _makeFrame(size_t size, frame_t &frame) const;
+
+  /**
+   * @brief Send a frame made by `_makeFrame`, dropped if the client has gone
+   *
+   * @param frame
+   * @param binary
+   */
+  void _sendFrame(frame_t &frame, bool binary) const;
+
+  /**
+   * @brief Queue a relay to `client` for the frames of a retained request
+   *
+   * Must be called from the websocket's callback.
+   *
+   * @param client
+   * @return std::shared_ptr<ApiAsyncSocketOutbox> The outbox the relay sends
+   */
+  static std::shared_ptr<ApiAsyncSocketOutbox> _relay(AsyncWebSocketClient *client);
+
+  /**
+   * @brief Tell the client a stream ended early, rather than leave it waiting on `"more"`
+   *
+   * @param code
+   */
+  void _abortStream(int code) const;
+
   AsyncWebSocket *_ws;
+
+  /**
+   * @brief The client, nullptr once retained when frames go through `_outbox` instead
+   *
+   */
   AsyncWebSocketClient *_client;
 
+  std::shared_ptr<ApiAsyncSocketOutbox> _outbox;
+
   /**
      * @brief Data supplied
      *
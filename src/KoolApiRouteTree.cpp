@@ -0,0 +1,132 @@
+#include "KoolApiRouteTree.h"
+
+namespace
+{
+  // Skips separators and returns the length of the segment at `str`
+  size_t nextSegment(const char *&str)
+  {
+    while (*str == '/')
+      ++str;
+
+    const char *end = str;
+
+    while (*end && *end != '/')
+      ++end;
+
+    return end - str;
+  }
+}
+
+KoolApiRouteTree::~KoolApiRouteTree()
+{
+  _free(_root);
+}
+
+bool KoolApiRouteTree::isTemplate(const char *path)
+{
+  return path && strchr(path, '{');
+}
+
+void KoolApiRouteTree::insert(const char *path, KoolApiPath *handler)
+{
+  node_t **level = &_root;
+  node_t *node = nullptr;
+  size_t len;
+
+  while ((len = nextSegment(path)))
+  {
+    bool isParam = (len > 1 && path[0] == '{' && path[len - 1] == '}');
+    const char *segment = (isParam) ? path + 1 : path;
+    uint8_t segLength = (isParam) ? len - 2 : len;
+
+    node = *level;
+
+    while (node && !(node->isParam == isParam && node->length == segLength && strncmp(node->segment, segment, segLength) == 0))
+      node = node->sibling;
+
+    if (!node)
+    {
+      node = new node_t{segment, segLength, isParam, nullptr, nullptr, nullptr};
+
+      // Literals first so they win over captures on the same level
+      if (isParam)
+      {
+        node_t **tail = level;
+
+        while (*tail)
+          tail = &(*tail)->sibling;
+
+        *tail = node;
+      }
+      else
+      {
+        node->sibling = *level;
+        *level = node;
+      }
+    }
+
+    level = &node->child;
+    path += len;
+  }
+
+  if (node)
+    node->handler = handler;
+}
+
+KoolApiPath *KoolApiRouteTree::find(const char *uri, KoolApiPathParams &params) const
+{
+  params._length = 0;
+  return (uri) ? _match(_root, uri, params) : nullptr;
+}
+
+KoolApiPath *KoolApiRouteTree::_match(const node_t *node, const char *uri, KoolApiPathParams &params)
+{
+  size_t len = nextSegment(uri);
+
+  if (!len)
+    return nullptr;
+
+  for (; node; node = node->sibling)
+  {
+    if (node->isParam)
+    {
+      if (params._length >= KOOLAPI_MAX_PATH_PARAMS || len > UINT8_MAX)
+        continue;
+
+      auto &p = params._params[params._length++];
+      p = {node->segment, uri, node->length, (uint8_t)len};
+    }
+    else if (node->length != len || strncmp(node->segment, uri, len) != 0)
+    {
+      continue;
+    }
+
+    const char *rest = uri + len;
+    KoolApiPath *found = nullptr;
+
+    while (*rest == '/')
+      ++rest;
+
+    found = (*rest) ? _match(node->child, rest, params) : node->handler;
+
+    if (found)
+      return found;
+
+    // Backtrack any capture made at this level
+    if (node->isParam)
+      --params._length;
+  }
+
+  return nullptr;
+}
+
+void KoolApiRouteTree::_free(node_t *node)
+{
+  while (node)
+  {
+    node_t *next = node->sibling;
+    _free(node->child);
+    delete node;
+    node = next;
+  }
+}
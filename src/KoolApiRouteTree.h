@@ -0,0 +1,66 @@
+#ifndef __KOOLAPIROUTETREE_H__
+#define __KOOLAPIROUTETREE_H__
+
+#include "KoolApiBases.h"
+
+/**
+ * @brief Prefix tree of path templates such as "relays/{id}/state"
+ *
+ * Each level holds one path segment. Literal segments are tried before
+ * `{name}` segments, which match any single segment and capture it.
+ */
+class KoolApiRouteTree
+{
+public:
+  KoolApiRouteTree() {}
+
+  ~KoolApiRouteTree();
+
+  /**
+   * @brief Checks whether the path is a template
+   *
+   * @param path
+   * @return true if it contains a `{name}` segment
+   */
+  static bool isTemplate(const char *path);
+
+  /**
+   * @brief Add a template route
+   *
+   * @param path Template. Must remain valid for the lifetime of the tree.
+   * @param handler
+   */
+  void insert(const char *path, KoolApiPath *handler);
+
+  /**
+   * @brief Find the handler matching the uri
+   *
+   * @param uri Request uri
+   * @param params Populated with captured segments on success
+   * @return KoolApiPath* nullptr if none match
+   */
+  KoolApiPath *find(const char *uri, KoolApiPathParams &params) const;
+
+private:
+  struct node_t
+  {
+    const char *segment;
+    uint8_t length;
+    bool isParam;
+    KoolApiPath *handler;
+    node_t *child;
+    node_t *sibling;
+  };
+
+  /**
+   * @brief First node of the top level
+   *
+   */
+  node_t *_root = nullptr;
+
+  static void _free(node_t *node);
+
+  static KoolApiPath *_match(const node_t *node, const char *uri, KoolApiPathParams &params);
+};
+
+#endif // __KOOLAPIROUTETREE_H__
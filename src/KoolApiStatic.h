@@ -0,0 +1,94 @@
+#ifndef __KOOLAPISTATIC_H__
+#define __KOOLAPISTATIC_H__
+
+#include "KoolApiPath.h"
+
+/**
+ * @brief Creates a `KoolApiRoute` whose hash is computed at compile time
+ *
+ * @param uri Exact uri string literal, templates are not supported
+ * @param handler KoolApiPath instance with static storage
+ */
+#define KOOLAPI_ROUTE(uri, handler) \
+  KoolApiRoute { koolutils::hashConst(uri), uri, &(handler) }
+
+/**
+ * @brief Fixed route table built at compile time
+ *
+ * Declared `constexpr` it lives in rodata, flash on the ESP32, and costs
+ * nothing to register. Use `koolApiRoutes` to create one.
+ *
+ * @tparam N number of routes
+ */
+template <size_t N>
+struct KoolApiRouteTable
+{
+  KoolApiRoute routes[N];
+
+  /**
+   * @brief Whether routes are ordered by hash so they can be binary searched
+   *
+   */
+  bool sorted;
+
+  constexpr size_t length() const { return N; }
+};
+
+/**
+ * @brief Orders routes as the runtime index does, by hash then path
+ *
+ */
+constexpr bool koolApiRouteBefore(const KoolApiRoute &a, const KoolApiRoute &b)
+{
+  return a.hash < b.hash || (a.hash == b.hash && koolutils::compareConst(a.path, b.path) < 0);
+}
+
+#if __cplusplus >= 201402L
+
+/**
+ * @brief Build a route table, sorted at compile time.
+ *
+ * @code
+ * constexpr auto routes = koolApiRoutes(
+ *     KOOLAPI_ROUTE("hello", helloApiPath),
+ *     KOOLAPI_ROUTE("another", anotherApiPath));
+ *
+ * KoolApi koolApi("/api", routes);
+ * @endcode
+ */
+template <class... R>
+constexpr KoolApiRouteTable<sizeof...(R)> koolApiRoutes(R... route)
+{
+  KoolApiRouteTable<sizeof...(R)> table = {{route...}, true};
+
+  for (size_t i = 1; i < sizeof...(R); ++i)
+  {
+    KoolApiRoute r = table.routes[i];
+    size_t pos = i;
+
+    for (; pos && koolApiRouteBefore(r, table.routes[pos - 1]); --pos)
+      table.routes[pos] = table.routes[pos - 1];
+
+    table.routes[pos] = r;
+  }
+
+  return table;
+}
+
+#else
+
+/**
+ * @brief Build a route table.
+ *
+ * C++11 cannot sort in a constant expression, so the table keeps the order
+ * given and is searched by comparing precomputed hashes.
+ */
+template <class... R>
+constexpr KoolApiRouteTable<sizeof...(R)> koolApiRoutes(R... route)
+{
+  return {{route...}, false};
+}
+
+#endif
+
+#endif // __KOOLAPISTATIC_H__
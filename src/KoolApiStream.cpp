@@ -0,0 +1,213 @@
+#include "KoolApiStream.h"
+
+namespace
+{
+  const char dataKey[] = "\"data\":[";
+  const char moreTail[] = "],\"more\":true}";
+  const char lastTail[] = "],\"more\":false}";
+
+  // Keeps the part of the output between `skip` and `skip + maxLength`
+  class WindowPrint : public Print
+  {
+  public:
+    WindowPrint(uint8_t *buffer, size_t maxLength, size_t skip)
+        : _buffer(buffer), _maxLength(maxLength), _skip(skip) {}
+
+    size_t write(uint8_t c) override
+    {
+      if (_total++ >= _skip && _written < _maxLength)
+        _buffer[_written++] = c;
+
+      return 1;
+    }
+
+    size_t written() const { return _written; }
+    size_t total() const { return _total; }
+
+  private:
+    uint8_t *_buffer;
+    size_t _maxLength;
+    size_t _skip;
+    size_t _written = 0;
+    size_t _total = 0;
+  };
+}
+
+void KoolApiStream::begin(JsonObject envelope, bool wrap)
+{
+  _wrapped = wrap;
+
+  if (!wrap)
+  {
+    _head = new char[2];
+    strcpy(_head, "[");
+    _headLength = 1;
+    return;
+  }
+
+  bool hasKeys = !envelope.isNull() && envelope.size();
+  size_t len = (hasKeys) ? measureJson(envelope) : 1;
+
+  // Envelope without its closing brace, then `,"data":[`
+  _head = new char[len + sizeof(dataKey) + 1];
+
+  if (hasKeys)
+  {
+    serializeJson(envelope, _head, len + 1);
+    _head[len - 1] = ',';
+    _head[len] = 0;
+  }
+  else
+  {
+    strcpy(_head, "{");
+  }
+
+  strcat(_head, dataKey);
+  _headLength = strlen(_head);
+}
+
+bool KoolApiStream::next()
+{
+  if (_finished)
+    return false;
+
+  _item.clear();
+
+  if (!_filler(_index, _item.to<JsonVariant>()))
+  {
+    _finished = true;
+    _hasItem = false;
+    return false;
+  }
+
+  ++_index;
+  _hasItem = true;
+  return true;
+}
+
+bool KoolApiStream::_copyPart(const char *part, size_t length, uint8_t *buffer, size_t maxLength, size_t &written)
+{
+  size_t len = length - _offset;
+
+  if (len > maxLength - written)
+    len = maxLength - written;
+
+  memcpy(buffer + written, part + _offset, len);
+  written += len;
+  _offset += len;
+
+  if (_offset < length)
+    return false;
+
+  _offset = 0;
+  return true;
+}
+
+size_t KoolApiStream::read(uint8_t *buffer, size_t maxLength)
+{
+  size_t written = 0;
+
+  while (written < maxLength && _state != STATE_DONE)
+  {
+    switch (_state)
+    {
+    case STATE_HEAD:
+      if (_copyPart(_head, _headLength, buffer, maxLength, written))
+        _state = STATE_ITEMS;
+      break;
+
+    case STATE_ITEMS:
+    {
+      if (!_hasItem && !next())
+      {
+        _state = STATE_TAIL;
+        break;
+      }
+
+      // Items spanning reads are serialised again, skipping what was sent
+      WindowPrint out(buffer + written, maxLength - written, _offset);
+
+      if (_index > 1)
+        out.write(',');
+
+      serializeJson(_item, out);
+      written += out.written();
+      _offset += out.written();
+
+      if (_offset >= out.total())
+      {
+        _offset = 0;
+        _hasItem = false;
+      }
+    }
+    break;
+
+    case STATE_TAIL:
+      if (_copyPart((_wrapped) ? "]}" : "]", (_wrapped) ? 2 : 1, buffer, maxLength, written))
+        _state = STATE_DONE;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return written;
+}
+
+size_t KoolApiStream::readMessage(uint8_t *buffer, size_t maxLength, size_t &required)
+{
+  const size_t tailLength = sizeof(lastTail) - 1;
+  size_t written = _headLength;
+  size_t count = 0;
+
+  required = 0;
+
+  if (_state == STATE_DONE)
+    return 0;
+
+  if (maxLength < _headLength + tailLength)
+  {
+    required = _headLength + tailLength;
+    return 0;
+  }
+
+  memcpy(buffer, _head, _headLength);
+
+  while (_hasItem || next())
+  {
+    size_t len = measureJson(_item) + (count ? 1 : 0);
+
+    if (written + len + tailLength > maxLength)
+    {
+      if (!count)
+      {
+        required = _headLength + len + tailLength;
+        return 0;
+      }
+
+      break;
+    }
+
+    WindowPrint out(buffer + written, maxLength - written, 0);
+
+    if (count)
+      out.write(',');
+
+    serializeJson(_item, out);
+    written += out.written();
+    _hasItem = false;
+    ++count;
+  }
+
+  const char *tail = (_hasItem) ? moreTail : lastTail;
+  size_t len = strlen(tail);
+
+  memcpy(buffer + written, tail, len);
+  written += len;
+
+  if (!_hasItem)
+    _state = STATE_DONE;
+
+  return written;
+}
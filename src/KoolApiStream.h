@@ -0,0 +1,136 @@
+#ifndef __KOOLAPISTREAM_H__
+#define __KOOLAPISTREAM_H__
+
+#include <functional>
+#include <memory>
+
+#include "KoolApiDocuments.h"
+
+#ifndef KOOLAPI_MAX_STREAM_ITEM_SIZE
+#define KOOLAPI_MAX_STREAM_ITEM_SIZE 256 // Size of the json document holding one streamed item
+#endif
+
+#ifndef KOOLAPI_STREAM_FRAME_SIZE
+#define KOOLAPI_STREAM_FRAME_SIZE 512 // Target size of each streamed websocket message
+#endif
+
+/**
+ * @brief Populates the item at `index` of a streamed response.
+ *
+ * Return false, leaving `item` untouched, when there are no more items.
+ */
+typedef std::function<bool(size_t index, JsonVariant item)> KoolApiStreamFiller;
+
+/**
+ * @brief Receives streamed output of an `ApiCharRequest`
+ *
+ */
+typedef std::function<void(const uint8_t *data, size_t length)> KoolApiStreamSink;
+
+/**
+ * @brief Serialises a json array one item at a time.
+ *
+ * Only one item is held in memory, so output of any length uses
+ * `KOOLAPI_MAX_STREAM_ITEM_SIZE` plus the envelope.
+ */
+class KoolApiStream
+{
+public:
+  KoolApiStream(KoolApiStreamFiller filler) : _filler(filler) {}
+
+  ~KoolApiStream() { delete[] _head; }
+
+  /**
+   * @brief Prepare output
+   *
+   * @param envelope Keys such as uri & id to place beside the items
+   * @param wrap Output `{...envelope, "data": [items]}` rather than a bare array
+   */
+  void begin(JsonObject envelope, bool wrap);
+
+  /**
+   * @brief Write the next bytes of the json output
+   *
+   * @param buffer
+   * @param maxLength
+   * @return size_t bytes written, 0 once complete
+   */
+  size_t read(uint8_t *buffer, size_t maxLength);
+
+  /**
+   * @brief Write the next self contained message: the envelope, whole items and a `"more"` flag.
+   *
+   * Requires `begin` with wrap set.
+   *
+   * @param buffer
+   * @param maxLength
+   * @param required Set to the size needed when the pending item alone does not fit
+   * @return size_t bytes written, 0 once complete or if `required` was set
+   */
+  size_t readMessage(uint8_t *buffer, size_t maxLength, size_t &required);
+
+  /**
+   * @brief Whether all output has been read
+   *
+   */
+  bool done() const { return _state == STATE_DONE; }
+
+  /**
+   * @brief Load the next item, for transports that collect items themselves
+   *
+   * @return false when there are no more items
+   */
+  bool next();
+
+  /**
+   * @brief The current item
+   *
+   */
+  JsonVariant item() { return _item.as<JsonVariant>(); }
+
+private:
+  enum state_t
+  {
+    STATE_HEAD,
+    STATE_ITEMS,
+    STATE_TAIL,
+    STATE_DONE
+  };
+
+  KoolApiStreamFiller _filler;
+  StaticJsonDocument<KOOLAPI_MAX_STREAM_ITEM_SIZE> _item;
+
+  /**
+   * @brief Output up to and including the opening `[`
+   *
+   */
+  char *_head = nullptr;
+  size_t _headLength = 0;
+  bool _wrapped = false;
+
+  state_t _state = STATE_HEAD;
+
+  /**
+   * @brief Number of items produced
+   *
+   */
+  size_t _index = 0;
+
+  /**
+   * @brief Bytes of the current part already written
+   *
+   */
+  size_t _offset = 0;
+
+  bool _hasItem = false;
+  bool _finished = false;
+
+  /**
+   * @brief Copy the unwritten remainder of `part`
+   *
+   * @return true once all of `part` has been written
+   */
+  bool _copyPart(const char *part, size_t length, uint8_t *buffer, size_t maxLength, size_t &written);
+};
+
+#endif // __KOOLAPISTREAM_H__
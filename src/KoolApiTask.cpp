@@ -0,0 +1,73 @@
+#include "KoolApiTask.h"
+
+#ifdef KOOLAPI_HAS_COROUTINES
+
+void KoolTask::promise_type::final_awaiter::await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+{
+  state_t &state = *handle.promise()._state;
+
+  {
+    KoolApiLock::Guard guard(state.lock);
+    state.done = true;
+
+    // Still within the handler, which answers & frees the frame itself
+    if (!state.deferred)
+      return;
+  }
+
+  // Nothing else holds the frame once deferred. Errors send their own body.
+  state.reply.send(state.code, state.doc.as<JsonVariantConst>());
+  handle.destroy();
+}
+
+void KoolTask::_start(state_t *state, ApiRequest *request, JsonObject out)
+{
+  _handle.promise()._state.reset(state);
+  _handle.resume();
+
+  // Held until the frame is given up, so a resuming task cannot finish meanwhile
+  KoolApiLock::Guard guard(state->lock);
+
+  // Returned without suspending, or was resumed & returned already
+  if (state->done)
+  {
+    if (state->code < 400)
+      out.set(state->doc.as<JsonObjectConst>());
+
+    request->send(state->code);
+    return;
+  }
+
+  state->reply = request->defer();
+  state->deferred = true;
+
+  // Batch items & char requests cannot wait, the handler's answer is then dropped
+  if (!state->reply)
+    request->send(503);
+
+  // Freed by the final awaiter from now on
+  _handle = nullptr;
+}
+
+void KoolApiTaskPath::_start(handler_t handler, ApiRequest *request, JsonObject out)
+{
+  std::unique_ptr<KoolTask::state_t> state(new (std::nothrow) KoolTask::state_t);
+
+  if (!state)
+  {
+    request->send(SERVICE_UNAVAILABLE);
+    return;
+  }
+
+  KoolTask task = (this->*handler)(request, state->doc.to<JsonObject>());
+
+  if (!task)
+  {
+    request->send(SERVICE_UNAVAILABLE);
+    return;
+  }
+
+  task._start(state.release(), request, out);
+}
+
+#endif
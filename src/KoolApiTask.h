@@ -0,0 +1,149 @@
+#ifndef __KOOLAPITASK_H__
+#define __KOOLAPITASK_H__
+
+#include "KoolApiEventLoop.h"
+#include "KoolApiPath.h"
+
+#ifdef KOOLAPI_HAS_COROUTINES
+
+#ifndef KOOLAPI_TASK_DOC_SIZE
+#define KOOLAPI_TASK_DOC_SIZE 512 // Output document each coroutine handler keeps while suspended
+#endif
+
+/**
+ * @brief Return type of coroutine handlers, `co_return` the response code.
+ *
+ * Started by `KoolApiTaskPath`. A handler that finishes without suspending
+ * is answered straight away, one that suspends is deferred and answered by
+ * whichever task resumes it last.
+ */
+class KoolTask
+{
+public:
+  /**
+   * @brief What a handler keeps while suspended, allocated before it starts
+   *
+   */
+  struct state_t
+  {
+    StaticJsonDocument<KOOLAPI_TASK_DOC_SIZE> doc;
+    KoolApiLock lock;
+    KoolApiDeferred reply;
+    int code = 500;
+
+    // Set under `lock` once the handler has returned, or been deferred
+    bool done = false;
+    bool deferred = false;
+  };
+
+  class promise_type
+  {
+  public:
+    KoolTask get_return_object() { return KoolTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+    // Frames are allocated without throwing, a handler that cannot start is answered 503
+    static KoolTask get_return_object_on_allocation_failure() { return KoolTask(); }
+
+    // Started by `_start` once its state is set
+    std::suspend_always initial_suspend() { return {}; }
+
+    /**
+     * @brief Answers a deferred request & frees the frame once the handler returns
+     *
+     */
+    struct final_awaiter
+    {
+      bool await_ready() noexcept { return false; }
+      void await_suspend(std::coroutine_handle<promise_type> handle) noexcept;
+      void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept { return {}; }
+
+    void return_value(int code) { _state->code = code; }
+
+    void unhandled_exception() { _state->code = 500; }
+
+  private:
+    friend class KoolTask;
+
+    std::unique_ptr<state_t> _state;
+  };
+
+  KoolTask() {}
+
+  KoolTask(KoolTask &&other) : _handle(other._handle) { other._handle = nullptr; }
+
+  KoolTask &operator=(KoolTask &&other)
+  {
+    std::swap(_handle, other._handle);
+    return *this;
+  }
+
+  KoolTask(const KoolTask &) = delete;
+  KoolTask &operator=(const KoolTask &) = delete;
+
+  ~KoolTask()
+  {
+    if (_handle)
+      _handle.destroy();
+  }
+
+  explicit operator bool() const { return (bool)_handle; }
+
+private:
+  friend class KoolApiTaskPath;
+
+  std::coroutine_handle<promise_type> _handle;
+
+  explicit KoolTask(std::coroutine_handle<promise_type> handle) : _handle(handle) {}
+
+  /**
+   * @brief Run the handler until it returns or first suspends
+   *
+   * @param state Output the handler was given, owned by the frame from now on
+   * @param request
+   * @param out
+   */
+  void _start(state_t *state, ApiRequest *request, JsonObject out);
+};
+
+/**
+ * @brief Endpoint whose handlers are coroutines, for work in several steps.
+ *
+ * Handlers can `co_await` timers & futures of a `KoolApiEventLoop` rather than
+ * blocking, eg to wait for a sensor conversion, then `co_return` the response
+ * code. `out` belongs to the handler, so may be filled in after suspending, but
+ * `request` is only valid until it first suspends, read what is needed before.
+ */
+class KoolApiTaskPath : public KoolApiPath
+{
+public:
+  virtual KoolTask coGet(ApiRequest *request, JsonObject out) { co_return NOT_ALLOWED; }
+  virtual KoolTask coPost(ApiRequest *request, JsonObject out) { co_return NOT_ALLOWED; }
+  virtual KoolTask coPut(ApiRequest *request, JsonObject out) { co_return NOT_ALLOWED; }
+  virtual KoolTask coPatch(ApiRequest *request, JsonObject out) { co_return NOT_ALLOWED; }
+  virtual KoolTask coDel(ApiRequest *request, JsonObject out) { co_return NOT_ALLOWED; }
+
+  void get(ApiRequest *request, JsonObject out) override final { _start(&KoolApiTaskPath::coGet, request, out); }
+  void post(ApiRequest *request, JsonObject out) override final { _start(&KoolApiTaskPath::coPost, request, out); }
+  void put(ApiRequest *request, JsonObject out) override final { _start(&KoolApiTaskPath::coPut, request, out); }
+  void patch(ApiRequest *request, JsonObject out) override final { _start(&KoolApiTaskPath::coPatch, request, out); }
+  void del(ApiRequest *request, JsonObject out) override final { _start(&KoolApiTaskPath::coDel, request, out); }
+
+private:
+  typedef KoolTask (KoolApiTaskPath::*handler_t)(ApiRequest *request, JsonObject out);
+
+  /**
+   * @brief Create the handler's state & run it
+   *
+   * @param handler
+   * @param request
+   * @param out
+   */
+  void _start(handler_t handler, ApiRequest *request, JsonObject out);
+};
+
+#endif
+
+#endif // __KOOLAPITASK_H__
@@ -0,0 +1,3 @@
+#include "KoolApiTrace.h"
+
+void (*KoolApiCallbackTrace::callback)(const ApiTraceEvent &event) = nullptr;
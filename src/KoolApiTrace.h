@@ -0,0 +1,127 @@
+#ifndef __KOOLAPITRACE_H__
+#define __KOOLAPITRACE_H__
+
+#include "KoolApiClock.h"
+#include "KoolUtils.h"
+
+#include <stddef.h>
+
+class ApiRequest;
+
+/**
+ * @brief Points in the life of a request reported to the trace policy
+ *
+ */
+typedef enum
+{
+  API_TRACE_RECEIVE,    // Processing started
+  API_TRACE_PARSED,     // Input, or only its envelope, parsed. `code` is any parse error
+  API_TRACE_ROUTED,     // Route looked up, `route` is nullptr if not found
+  API_TRACE_HANDLED,    // Handler returned
+  API_TRACE_ERROR,      // An error is being answered, `code` is the status
+  API_TRACE_DISPATCHED  // Response sent, `length` is its size in bytes if known
+} api_trace_event_t;
+
+/**
+ * @brief What a trace policy is told about a request
+ *
+ */
+struct ApiTraceEvent
+{
+  api_trace_event_t event;
+
+  /**
+   * @brief Microseconds since start
+   *
+   */
+  uint32_t time;
+
+  /**
+   * @brief Identifies the request while it is processed, not to be used
+   *
+   */
+  const ApiRequest *request;
+
+  const char *uri;
+
+  /**
+   * @brief Path the handler was registered with, nullptr until routed
+   *
+   */
+  const char *route;
+
+  int code;
+  size_t length;
+
+  /**
+   * @brief Identifier of the route, stable between builds
+   *
+   * @return uint32_t 0 if not routed
+   */
+  uint32_t routeId() const { return (route) ? koolutils::hash(route) : 0; }
+};
+
+/**
+ * @brief Default policy, no tracing
+ *
+ */
+struct KoolApiNoTrace
+{
+  static const bool enabled = false;
+
+  static void on(const ApiTraceEvent &event) {}
+};
+
+/**
+ * @brief Policy calling `callback`, when set, for each event
+ *
+ * Called from whichever task processes the request, keep it short.
+ */
+struct KoolApiCallbackTrace
+{
+  static const bool enabled = true;
+
+  static void (*callback)(const ApiTraceEvent &event);
+
+  static void on(const ApiTraceEvent &event)
+  {
+    if (callback)
+      callback(event);
+  }
+};
+
+// Header declaring a policy of your own, set with -D KOOLAPI_TRACE_HEADER=\"MyTrace.h\"
+#ifdef KOOLAPI_TRACE_HEADER
+#include KOOLAPI_TRACE_HEADER
+#endif
+
+#ifndef KOOLAPI_TRACE_POLICY
+#define KOOLAPI_TRACE_POLICY KoolApiNoTrace // Struct with `static const bool enabled` & `static void on(const ApiTraceEvent &)`
+#endif
+
+/**
+ * @brief Reports request events to the policy `P`.
+ *
+ * Chosen at compile time, so with tracing disabled every call compiles away.
+ *
+ * @tparam P trace policy
+ */
+template <class P>
+struct KoolApiTracer
+{
+  static const bool enabled = P::enabled;
+
+  static void trace(api_trace_event_t event, const ApiRequest *request, const char *uri, const char *route,
+                    int code = 0, size_t length = 0)
+  {
+    if (!enabled)
+      return;
+
+    ApiTraceEvent e = {event, koolApiMicros(), request, uri, route, code, length};
+    P::on(e);
+  }
+};
+
+typedef KoolApiTracer<KOOLAPI_TRACE_POLICY> KoolApiTrace;
+
+#endif // __KOOLAPITRACE_H__
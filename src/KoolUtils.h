@@ -3,6 +3,7 @@
 
 
 #include <stddef.h>
+#include <stdint.h>
 namespace koolutils
 {
   typedef enum
@@ -18,6 +19,77 @@ namespace koolutils
     API_METHOD_UNKNOWN = -1
   } api_method_t;
 
+  const uint32_t HASH_SEED = 2166136261u;
+  const uint32_t HASH_PRIME = 16777619u;
+
+  /**
+   * @brief Continue an FNV-1a hash with `len` more bytes of `str`
+   *
+   * @param h Hash so far
+   * @param str
+   * @param len
+   * @return uint32_t
+   */
+  inline uint32_t hashAppend(uint32_t h, const char *str, size_t len)
+  {
+    for (size_t i = 0; i < len; ++i)
+      h = (h ^ (uint8_t)str[i]) * HASH_PRIME;
+
+    return h;
+  }
+
+  /**
+   * @brief FNV-1a hash of `len` bytes of `str`
+   *
+   * @param str
+   * @param len
+   * @return uint32_t
+   */
+  inline uint32_t hash(const char *str, size_t len)
+  {
+    return hashAppend(HASH_SEED, str, len);
+  }
+
+  /**
+   * @brief FNV-1a hash of a null terminated string
+   *
+   * @param str
+   * @return uint32_t
+   */
+  inline uint32_t hash(const char *str)
+  {
+    uint32_t h = HASH_SEED;
+
+    while (*str)
+      h = (h ^ (uint8_t)*str++) * HASH_PRIME;
+
+    return h;
+  }
+
+  /**
+   * @brief FNV-1a hash usable in constant expressions. Matches `hash`
+   *
+   * @param str
+   * @param h
+   * @return constexpr uint32_t
+   */
+  constexpr uint32_t hashConst(const char *str, uint32_t h = HASH_SEED)
+  {
+    return (*str) ? hashConst(str + 1, (h ^ (uint8_t)*str) * HASH_PRIME) : h;
+  }
+
+  /**
+   * @brief strcmp usable in constant expressions
+   *
+   * @param a
+   * @param b
+   * @return constexpr int
+   */
+  constexpr int compareConst(const char *a, const char *b)
+  {
+    return (*a && *a == *b) ? compareConst(a + 1, b + 1) : (uint8_t)*a - (uint8_t)*b;
+  }
+
 };
 
 #endif // __KOOLUTILS_H__
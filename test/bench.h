@@ -0,0 +1,50 @@
+#ifndef __KOOLAPI_BENCH_H__
+#define __KOOLAPI_BENCH_H__
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+/**
+ * @brief Timing helpers shared by the host benchmarks
+ *
+ * Each benchmark takes `--quick` to run a handful of iterations, which is how
+ * ctest runs them so they keep building and working without slowing the suite.
+ */
+namespace bench
+{
+  inline size_t iterations(int argc, char **argv, size_t full)
+  {
+    for (int i = 1; i < argc; ++i)
+      if (!strcmp(argv[i], "--quick"))
+        return full / 1000 + 1;
+
+    return full;
+  }
+
+  /**
+   * @brief Nanoseconds per call of `fn`, run `n` times
+   */
+  template <typename F>
+  double nsPerCall(size_t n, F &&fn)
+  {
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < n; ++i)
+      fn(i);
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / n;
+  }
+
+  /**
+   * @brief Keep the optimiser from dropping a result
+   */
+  template <typename T>
+  inline void keep(T const &value)
+  {
+    asm volatile("" : : "g"(&value) : "memory");
+  }
+}
+
+#endif // __KOOLAPI_BENCH_H__
@@ -0,0 +1,85 @@
+// Error responses: building the body from the prebuilt constants against
+// serialising a document per error as before, then whole requests that fail.
+#include "bench.h"
+#include "KoolApi.h"
+
+class FailingPath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    request->send(NOT_FOUND);
+  }
+};
+
+// Previous error path: fill the output document and serialise it
+static size_t documentError(JsonDocument &doc, char *buffer, int code, uint32_t id)
+{
+  doc.clear();
+
+  if (id)
+    doc["id"] = id;
+
+  doc["error"] = code;
+  doc["message"] = koolApiError(code).message;
+
+  return serializeJson(doc, buffer, KOOLAPI_ERROR_BODY_SIZE);
+}
+
+// Input is parsed in place, so each call gets a fresh copy
+static double perRequest(KoolApi &api, const char *input, size_t times)
+{
+  char buffer[128];
+  char output[128];
+  size_t length = strlen(input);
+
+  return bench::nsPerCall(times, [&](size_t) {
+    memcpy(buffer, input, length + 1);
+    ApiCharRequest request(buffer, output, sizeof(output));
+    api.process(request);
+    bench::keep(output);
+  });
+}
+
+int main(int argc, char **argv)
+{
+  const size_t times = bench::iterations(argc, argv, 2000000);
+  StaticJsonDocument<KOOLAPI_MAX_OUT_SIZE> doc;
+  char body[KOOLAPI_ERROR_BODY_SIZE];
+  size_t written = 0;
+
+  double constant = bench::nsPerCall(times, [&](size_t i) {
+    const KoolApiError &error = koolApiError((i & 1) ? 404 : 405);
+    memcpy(body, error.body, error.length);
+    written += error.length;
+  });
+  double spliced = bench::nsPerCall(times, [&](size_t i) {
+    written += koolApiErrorJson(body, (i & 1) ? 404 : 405, 7);
+  });
+  double msgPack = bench::nsPerCall(times, [&](size_t i) {
+    written += koolApiErrorMsgPack(body, (i & 1) ? 404 : 405, 7);
+  });
+  double document = bench::nsPerCall(times, [&](size_t i) {
+    written += documentError(doc, body, (i & 1) ? 404 : 405, 7);
+  });
+
+  bench::keep(written);
+
+  printf("error body\n");
+  printf("  %-28s %8.1f ns\n", "prebuilt", constant);
+  printf("  %-28s %8.1f ns\n", "prebuilt, id spliced", spliced);
+  printf("  %-28s %8.1f ns\n", "prebuilt msgpack, id", msgPack);
+  printf("  %-28s %8.1f ns\n", "document serialised, id", document);
+
+  KoolApi api("/api");
+  FailingPath failing;
+  api.on("failing", failing);
+
+  const size_t requests = bench::iterations(argc, argv, 200000);
+
+  printf("whole request\n");
+  printf("  %-28s %8.1f ns\n", "unknown uri", perRequest(api, "{\"$_uri\":\"none\",\"method\":\"GET\"}", requests));
+  printf("  %-28s %8.1f ns\n", "unknown uri, id", perRequest(api, "{\"$_uri\":\"none\",\"method\":\"GET\",\"id\":7}", requests));
+  printf("  %-28s %8.1f ns\n", "handler sends 404", perRequest(api, "{\"$_uri\":\"failing\",\"method\":\"GET\"}", requests));
+
+  return 0;
+}
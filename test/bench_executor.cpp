@@ -0,0 +1,142 @@
+// The executor under load: requests a second as workers are added, for a
+// handler that waits (as on a sensor or upstream) and one that computes, then
+// a burst larger than the queue to show how quickly the excess is turned away.
+#include "bench.h"
+#include "KoolApi.h"
+
+#include <atomic>
+#include <thread>
+
+static std::atomic<size_t> answered{0};
+static const char *waitInput = "{\"$_uri\":\"wait\",\"method\":\"GET\"}";
+static const char *workInput = "{\"$_uri\":\"work\",\"method\":\"GET\"}";
+
+class WaitPath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+    request->send(OK);
+    ++answered;
+  }
+};
+
+class WorkPath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    uint32_t h = koolutils::HASH_SEED;
+
+    for (int i = 0; i < 20000; ++i)
+      h = koolutils::hashAppend(h, (const char *)&i, sizeof(i));
+
+    out["hash"] = h;
+    request->send(OK);
+    ++answered;
+  }
+};
+
+// Kept below the queue size, so every request is processed
+static double perSecond(KoolApi &api, KoolApiExecutor &executor, const char *input, size_t requests)
+{
+  auto start = std::chrono::steady_clock::now();
+  answered = 0;
+
+  for (size_t i = 0; i < requests; ++i)
+  {
+    while (executor.stats(API_PRIORITY_NORMAL).pending >= KOOLAPI_QUEUE_SIZE - 1)
+      std::this_thread::yield();
+
+    api.submit(new ApiCharRequest(input));
+  }
+
+  while (answered < requests)
+    std::this_thread::yield();
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  return requests / elapsed.count();
+}
+
+int main(int argc, char **argv)
+{
+  const size_t requests = bench::iterations(argc, argv, 20000);
+  const uint8_t workers[] = {1, 2, 4};
+  double first[2] = {0, 0};
+
+  WaitPath wait;
+  WorkPath work;
+
+  // Computing handlers only scale up to the cores there are
+  printf("%u cores\n", std::thread::hardware_concurrency());
+  printf("%8s %14s %8s %14s %8s\n", "workers", "waiting req/s", "speedup", "working req/s", "speedup");
+
+  for (uint8_t count : workers)
+  {
+    KoolApi api("/api");
+    KoolApiExecutor executor(count);
+
+    api.on("wait", wait).on("work", work);
+    executor.begin();
+    api.setExecutor(executor);
+
+    double waiting = perSecond(api, executor, waitInput, requests);
+    double working = perSecond(api, executor, workInput, requests / 4 + 1);
+
+    if (!first[0])
+    {
+      first[0] = waiting;
+      first[1] = working;
+    }
+
+    printf("%8u %14.0f %7.2fx %14.0f %7.2fx\n", count, waiting, waiting / first[0], working, working / first[1]);
+    executor.end();
+  }
+
+  // A burst four times the queue to one worker, the rest are answered 503 at once
+  KoolApi api("/api");
+  KoolApiExecutor executor(1);
+
+  api.on("wait", wait);
+  executor.begin();
+  api.setExecutor(executor);
+
+  const size_t bursts = bench::iterations(argc, argv, 200);
+  const size_t burst = KOOLAPI_QUEUE_SIZE * 4;
+  size_t refused = 0;
+  double rejectNs = 0;
+
+  answered = 0;
+
+  for (size_t b = 0; b < bursts; ++b)
+  {
+    for (size_t i = 0; i < burst; ++i)
+    {
+      auto start = std::chrono::steady_clock::now();
+      bool accepted = api.submit(new ApiCharRequest(waitInput));
+
+      if (!accepted)
+      {
+        ++refused;
+        rejectNs += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+      }
+    }
+
+    while (answered + refused < (b + 1) * burst)
+      std::this_thread::yield();
+  }
+
+  auto stats = executor.stats(API_PRIORITY_NORMAL);
+
+  if (stats.rejected != refused || stats.processed != answered)
+  {
+    printf("counted %u processed and %u rejected, %zu answered and %zu refused\n", stats.processed, stats.rejected, answered.load(), refused);
+    return 1;
+  }
+
+  printf("burst of %zu to 1 worker\n", burst);
+  printf("  %-28s %8.1f %%\n", "rejected", 100.0 * refused / (bursts * burst));
+  printf("  %-28s %8.1f ns\n", "rejection", (refused) ? rejectNs / refused : 0);
+  printf("  %-28s %8u us\n", "longest wait for a worker", stats.waitMax);
+
+  return 0;
+}
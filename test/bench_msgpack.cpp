@@ -0,0 +1,90 @@
+// The same requests as json and as MessagePack through ApiCharRequest: bytes
+// in and out, and time per request from input to serialised output.
+#include "bench.h"
+#include "KoolApi.h"
+
+class ReadingsPath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    out["id"] = request->params->getInt("id", 0);
+    out["unit"] = "celsius";
+
+    JsonArray values = out.createNestedArray("values");
+
+    for (int i = 0; i < 8; ++i)
+      values.add(20 + i * 0.25);
+
+    request->send(OK);
+  }
+
+  void post(ApiRequest *request, JsonObject out) override
+  {
+    out["stored"] = request->json["values"].size();
+    request->send(CREATED);
+  }
+};
+
+struct result_t
+{
+  size_t in;
+  size_t out;
+  double us;
+};
+
+// Input is parsed in place, so each call gets a fresh copy
+static result_t measure(KoolApi &api, const char *input, size_t length, api_format_t format, size_t times)
+{
+  char buffer[256];
+  char output[512];
+  size_t written = 0;
+
+  double ns = bench::nsPerCall(times, [&](size_t) {
+    memcpy(buffer, input, length);
+    ApiCharRequest request(buffer, output, length, sizeof(output));
+    request.format = format;
+    api.process(request);
+    written = request.outputLength();
+  });
+
+  bench::keep(output);
+  return {length, written, ns / 1000};
+}
+
+int main(int argc, char **argv)
+{
+  const size_t times = bench::iterations(argc, argv, 200000);
+
+  KoolApi api("/api");
+  ReadingsPath readings;
+  api.on("readings", readings);
+
+  const char *requests[][2] = {
+      {"GET", "{\"$_uri\":\"readings\",\"method\":\"GET\",\"params\":{\"id\":7}}"},
+      {"POST", "{\"$_uri\":\"readings\",\"method\":\"POST\",\"body\":{\"values\":[20.5,21,21.25,22]}}"},
+  };
+
+  printf("%6s %9s %9s %9s %9s %11s %11s\n", "", "json in", "mp in", "json out", "mp out", "json", "msgpack");
+
+  for (auto &request : requests)
+  {
+    StaticJsonDocument<512> doc;
+    char packed[256];
+
+    deserializeJson(doc, request[1]);
+    size_t packedLength = serializeMsgPack(doc, packed, sizeof(packed));
+
+    result_t json = measure(api, request[1], strlen(request[1]), API_FORMAT_JSON, times);
+    result_t msgPack = measure(api, packed, packedLength, API_FORMAT_MSGPACK, times);
+
+    if (!json.out || !msgPack.out)
+    {
+      printf("%s produced no output\n", request[0]);
+      return 1;
+    }
+
+    printf("%6s %7zu B %7zu B %7zu B %7zu B %8.2f us %8.2f us\n", request[0], json.in, msgPack.in, json.out, msgPack.out, json.us, msgPack.us);
+  }
+
+  return 0;
+}
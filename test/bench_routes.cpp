@@ -0,0 +1,91 @@
+// Route lookup with 10, 100 and 1000 routes: the hash index KoolApi uses
+// against the linear strcmp scan it replaced.
+#include "bench.h"
+#include "KoolApi.h"
+
+#include <vector>
+
+class RoutesApi : public KoolApi
+{
+public:
+  RoutesApi() : KoolApi("/api") {}
+  using KoolApi::_route;
+};
+
+class Route : public KoolApiPath
+{
+};
+
+struct LinearRoute
+{
+  const char *path;
+  KoolApiPath *handler;
+};
+
+// Previous lookup: compare the path against every route in turn
+static KoolApiPath *linearFind(const std::vector<LinearRoute> &routes, const char *path)
+{
+  for (auto &route : routes)
+    if (strcmp(route.path, path) == 0)
+      return route.handler;
+
+  return nullptr;
+}
+
+int main(int argc, char **argv)
+{
+  const size_t lookups = bench::iterations(argc, argv, 2000000);
+  const size_t sizes[] = {10, 100, 1000};
+
+  printf("%8s %14s %14s %14s %14s\n", "routes", "linear hit", "index hit", "linear miss", "index miss");
+
+  for (size_t count : sizes)
+  {
+    RoutesApi api;
+    std::vector<Route> handlers(count);
+    std::vector<char[32]> paths(count);
+    std::vector<LinearRoute> linear;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+      snprintf(paths[i], sizeof(paths[i]), "/sensors/%u/value", (unsigned)i);
+      api.on(paths[i], handlers[i]);
+      linear.push_back({paths[i], &handlers[i]});
+    }
+
+    // Requests carry their own copy of the uri, never the registered pointer
+    std::vector<char[32]> uris(count);
+
+    for (size_t i = 0; i < count; ++i)
+      memcpy(uris[i], paths[i], sizeof(uris[i]));
+
+    const char *miss = "/sensors/none/value";
+    KoolApiPathParams captures;
+    size_t found = 0;
+
+    double linearHit = bench::nsPerCall(lookups, [&](size_t i) {
+      found += linearFind(linear, uris[i % count]) != nullptr;
+    });
+    double indexHit = bench::nsPerCall(lookups, [&](size_t i) {
+      found += api._route(uris[i % count], captures) != nullptr;
+    });
+    double linearMiss = bench::nsPerCall(lookups, [&](size_t) {
+      found += linearFind(linear, miss) != nullptr;
+    });
+    double indexMiss = bench::nsPerCall(lookups, [&](size_t) {
+      found += api._route(miss, captures) != nullptr;
+    });
+
+    bench::keep(found);
+
+    if (found != 2 * lookups)
+    {
+      printf("lookup mismatch: %zu of %zu found\n", found, 2 * lookups);
+      return 1;
+    }
+
+    printf("%8zu %11.1f ns %11.1f ns %11.1f ns %11.1f ns\n", count, linearHit, indexHit, linearMiss, indexMiss);
+  }
+
+  return 0;
+}
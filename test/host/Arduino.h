@@ -0,0 +1,94 @@
+// Just enough of the Arduino core to build the library on a host.
+// ARDUINO is left undefined so the library takes its host code paths.
+#pragma once
+
+#include <chrono>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <thread>
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size)
+  {
+    size_t n = 0;
+    while (size-- && write(*buffer++))
+      ++n;
+    return n;
+  }
+};
+
+class String
+{
+public:
+  String() {}
+  String(const char *s) { concat(s); }
+  String(const char *s, size_t length) { concat(s, length); }
+  String(const String &other) { concat(other.c_str(), other.length()); }
+  String(String &&other) : _buffer(other._buffer), _length(other._length), _capacity(other._capacity)
+  {
+    other._buffer = nullptr;
+    other._length = other._capacity = 0;
+  }
+  ~String() { free(_buffer); }
+
+  String &operator=(const String &other)
+  {
+    if (this != &other)
+    {
+      _length = 0;
+      concat(other.c_str(), other.length());
+    }
+    return *this;
+  }
+
+  bool concat(const char *s) { return s ? concat(s, strlen(s)) : false; }
+  bool concat(const char *s, size_t length)
+  {
+    if (_length + length + 1 > _capacity)
+    {
+      size_t capacity = (_length + length + 1) * 2;
+      char *grown = (char *)realloc(_buffer, capacity);
+      if (!grown)
+        return false;
+      _buffer = grown;
+      _capacity = capacity;
+    }
+    memcpy(_buffer + _length, s, length);
+    _length += length;
+    _buffer[_length] = 0;
+    return true;
+  }
+
+  const char *c_str() const { return _buffer ? _buffer : ""; }
+  size_t length() const { return _length; }
+  bool operator==(const char *s) const { return !strcmp(c_str(), s); }
+
+private:
+  char *_buffer = nullptr;
+  size_t _length = 0;
+  size_t _capacity = 0;
+};
+
+inline unsigned long millis()
+{
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (unsigned long)duration_cast<milliseconds>(steady_clock::now() - start).count();
+}
+
+inline unsigned long micros()
+{
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (unsigned long)duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+inline void delay(unsigned long ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+inline void yield() { std::this_thread::yield(); }
@@ -0,0 +1,4 @@
+// Host builds have no webserver. _ESPAsyncWebServer_H_ is left undefined so
+// the library compiles without its webserver requests, except for the
+// koolapi_webserver library, which finds test/webserver's declarations first.
+#pragma once
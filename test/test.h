@@ -0,0 +1,32 @@
+#ifndef __KOOLAPI_TEST_H__
+#define __KOOLAPI_TEST_H__
+
+#include <stdio.h>
+
+/**
+ * @brief Checks shared by the host tests, each test's main returns `test::result()`
+ */
+namespace test
+{
+  inline int failures = 0;
+
+  inline int result()
+  {
+    if (failures)
+      printf("%d check(s) failed\n", failures);
+
+    return failures ? 1 : 0;
+  }
+}
+
+#define CHECK(condition)                                                      \
+  do                                                                          \
+  {                                                                           \
+    if (!(condition))                                                         \
+    {                                                                         \
+      printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition);    \
+      ++test::failures;                                                       \
+    }                                                                         \
+  } while (0)
+
+#endif // __KOOLAPI_TEST_H__
@@ -0,0 +1,108 @@
+// KoolApi::process must not touch the heap once warmed up: documents come from
+// the pool, params are built in place and output goes to the caller's buffer.
+#include "test.h"
+#include "KoolApi.h"
+
+#include <atomic>
+#include <stdlib.h>
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static std::atomic<size_t> allocations{0};
+
+// operator new is built on malloc, so these count both
+extern "C" void *malloc(size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(ptr, size);
+}
+
+extern "C" void free(void *ptr)
+{
+  __libc_free(ptr);
+}
+
+class SensorPath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    out["id"] = request->params->getInt("id", 0);
+    out["value"] = 21.5;
+    request->send(OK);
+  }
+
+  void post(ApiRequest *request, JsonObject out) override
+  {
+    out["stored"] = request->json["value"].as<float>();
+    request->send(CREATED);
+  }
+};
+
+// Input is parsed in place, so each call gets a fresh copy
+static size_t run(KoolApi &api, const char *input, char *output, size_t size, size_t times)
+{
+  char buffer[256];
+  size_t before = allocations.load();
+
+  for (size_t i = 0; i < times; ++i)
+  {
+    strcpy(buffer, input);
+    ApiCharRequest request(buffer, output, size);
+    api.process(request);
+  }
+
+  return allocations.load() - before;
+}
+
+int main()
+{
+  KoolApi api("/api");
+  SensorPath sensors;
+  SensorPath other;
+
+  api.on("sensors", sensors);
+  api.on("sensors/{id}", sensors);
+  api.on("other", other);
+
+  const char *get = "{\"$_uri\":\"sensors\",\"method\":\"GET\",\"params\":{\"id\":7}}";
+  const char *getTemplate = "{\"$_uri\":\"sensors/3\",\"method\":\"GET\"}";
+  const char *post = "{\"$_uri\":\"sensors\",\"method\":\"POST\",\"body\":{\"value\":4.5}}";
+  char output[256];
+
+  // Anything set up lazily happens on first use
+  run(api, get, output, sizeof(output), 1);
+  run(api, getTemplate, output, sizeof(output), 1);
+  run(api, post, output, sizeof(output), 1);
+
+  CHECK(run(api, get, output, sizeof(output), 100) == 0);
+  CHECK(strstr(output, "\"value\":21.5") != nullptr);
+  CHECK(strstr(output, "\"id\":7") != nullptr);
+
+  CHECK(run(api, getTemplate, output, sizeof(output), 100) == 0);
+  CHECK(strstr(output, "\"id\":3") != nullptr);
+
+  CHECK(run(api, post, output, sizeof(output), 100) == 0);
+  CHECK(strstr(output, "\"stored\":4.5") != nullptr);
+
+  // Sanity check the counter itself
+  size_t before = allocations.load();
+  free(malloc(16));
+  CHECK(allocations.load() == before + 1);
+
+  return test::result();
+}
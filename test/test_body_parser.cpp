@@ -0,0 +1,105 @@
+// KoolApiBodyParser must accept exactly the json grammar, whole or fed in pieces.
+#include "test.h"
+#include "KoolApiBodyParser.h"
+
+#include <string.h>
+
+namespace
+{
+  struct events_t
+  {
+    int count = 0;
+    api_body_event_t last = API_BODY_ERROR;
+  };
+
+  void onEvent(void *arg, const ApiBodyEvent &event)
+  {
+    auto events = (events_t *)arg;
+    ++events->count;
+    events->last = event.type;
+  }
+
+  /**
+   * @brief Whether `json` parses, fed in chunks of `chunk` bytes
+   */
+  bool parses(const char *json, size_t chunk = 0, events_t *events = nullptr)
+  {
+    events_t ignored;
+    KoolApiBodyParser parser(onEvent, (events) ? events : &ignored);
+    size_t length = strlen(json);
+
+    if (!chunk)
+      chunk = length;
+
+    for (size_t i = 0; i < length; i += chunk)
+    {
+      if (!parser.feed((const uint8_t *)json + i, (length - i < chunk) ? length - i : chunk))
+        return false;
+    }
+
+    return parser.finish();
+  }
+}
+
+int main()
+{
+  const char *valid[] = {
+      "{}",
+      "[]",
+      "\"text\"",
+      "-12.5e+3",
+      "0",
+      "true",
+      "null",
+      " [1, 2.0, \"x\", true, false, null] ",
+      "{\"a\":1,\"b\":{\"c\":[{}, []]},\"d\":\"\\u00e9\\n\"}",
+  };
+
+  const char *invalid[] = {
+      "",
+      "[1 2]",
+      "{\"a\":1 \"b\":2}",
+      "{\"a\" 1}",
+      "{\"a\"::1}",
+      "[1:2]",
+      ":1",
+      "[1,]",
+      "{\"a\":1,}",
+      "[,1]",
+      "{,}",
+      "{1:2}",
+      "{\"a\"}",
+      "[1]]",
+      "[1}",
+      "{} {}",
+      "\"a\" \"b\"",
+      "01",
+      "1.",
+      "-",
+      "1e",
+      "tru",
+      "nul",
+      "\"a\tb\"",
+      "\"open",
+      "[",
+  };
+
+  for (auto json : valid)
+  {
+    CHECK(parses(json));
+    CHECK(parses(json, 1));
+  }
+
+  for (auto json : invalid)
+  {
+    CHECK(!parses(json));
+    CHECK(!parses(json, 1));
+  }
+
+  // A root string is a whole document and reported once
+  events_t events;
+  CHECK(parses("\"text\"", 2, &events));
+  CHECK(events.count == 1 && events.last == API_BODY_STRING);
+
+  return test::result();
+}
@@ -0,0 +1,108 @@
+// Many threads through one KoolApi while routes are added, built with
+// ThreadSanitizer: cached bodies replaced while sent, shared GETs, and the
+// description rebuilt under readers. Any race found fails the run.
+#include "test.h"
+#include "KoolApi.h"
+
+#include <array>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+static std::atomic<uint32_t> version{1};
+
+class CachedPath : public KoolApiPath
+{
+  uint32_t version() override { return ::version.load(); }
+
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    out["version"] = ::version.load();
+    request->send(OK);
+  }
+};
+
+class SlowPath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    // Long enough for identical requests to join the flight
+    std::this_thread::sleep_for(std::chrono::microseconds(100));
+    out["id"] = request->params->getInt("id", 0);
+    request->send(OK);
+  }
+};
+
+class AddedPath : public KoolApiPath
+{
+};
+
+static bool answered(const char *output)
+{
+  return strstr(output, "\"version\"") || strstr(output, "\"id\"") || strstr(output, "\"handlers\"") ||
+         strstr(output, "\"error\":503");
+}
+
+int main()
+{
+  const int readers = 6;
+  const int iterations = 500;
+  const int added = 40;
+
+  KoolApi api("/api");
+  CachedPath cached;
+  SlowPath slow;
+  std::vector<AddedPath> handlers(added);
+  std::vector<std::array<char, 16>> paths(added);
+
+  api.on("cached", cached).on("slow", slow).setDesriberUri("describe").setCoalescing(true);
+
+  std::atomic<int> unanswered{0};
+  std::atomic<bool> writing{true};
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < readers; ++t)
+  {
+    threads.emplace_back([&, t]()
+                         {
+                           const char *inputs[] = {
+                               "{\"$_uri\":\"cached\",\"method\":\"GET\"}",
+                               "{\"$_uri\":\"slow\",\"method\":\"GET\",\"params\":{\"id\":3}}",
+                               "{\"$_uri\":\"describe\",\"method\":\"GET\"}"};
+                           char buffer[128];
+                           char output[8192];
+
+                           for (int i = 0; i < iterations; ++i)
+                           {
+                             strcpy(buffer, inputs[(i + t) % 3]);
+                             output[0] = 0;
+                             ApiCharRequest request(buffer, output, sizeof(output));
+                             api.process(request);
+
+                             if (!answered(output))
+                               ++unanswered;
+                           } });
+  }
+
+  // Routes added and cached bodies invalidated while requests run
+  threads.emplace_back([&]()
+                       {
+                         for (int i = 0; i < added; ++i)
+                         {
+                           snprintf(paths[i].data(), paths[i].size(), "added/%d", i);
+                           api.on(paths[i].data(), handlers[i]);
+                           ++version;
+                           std::this_thread::sleep_for(std::chrono::microseconds(200));
+                         }
+
+                         writing = false; });
+
+  for (auto &thread : threads)
+    thread.join();
+
+  CHECK(!writing);
+  CHECK(unanswered == 0);
+  CHECK(api.uriCount() == (size_t)added + 2);
+
+  return test::result();
+}
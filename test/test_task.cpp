@@ -0,0 +1,114 @@
+// Coroutine handlers on the host: one that returns without suspending, one
+// that sleeps on the event loop and one awaiting a future set by another
+// thread. Suspended handlers are deferred, so char requests are given a copy
+// answering into the same output, as a webserver request's relay would.
+#include "test.h"
+#include "KoolApi.h"
+
+#ifdef KOOLAPI_HAS_COROUTINES
+
+#include <thread>
+
+static KoolApiEventLoop loop;
+
+class DeferrableRequest : public ApiCharRequest
+{
+public:
+  DeferrableRequest(char *jsonIn, char *output, size_t maxLength)
+      : ApiCharRequest(jsonIn, output, maxLength), _out(output), _maxOut(maxLength)
+  {
+  }
+
+protected:
+  ApiRequest *_detach() const override { return new ApiCharRequest("", _out, _maxOut); }
+
+private:
+  char *_out;
+  size_t _maxOut;
+};
+
+class NowPath : public KoolApiTaskPath
+{
+  KoolTask coGet(ApiRequest *request, JsonObject out) override
+  {
+    out["value"] = 1;
+    co_return OK;
+  }
+};
+
+class SleepPath : public KoolApiTaskPath
+{
+  KoolTask coGet(ApiRequest *request, JsonObject out) override
+  {
+    co_await loop.sleep(20);
+    out["value"] = 2;
+    co_return OK;
+  }
+};
+
+class FuturePath : public KoolApiTaskPath
+{
+  KoolTask coGet(ApiRequest *request, JsonObject out) override
+  {
+    KoolApiFuture<int> reading(loop);
+    std::thread sensor([&reading]()
+                       {
+                         std::this_thread::sleep_for(std::chrono::milliseconds(10));
+                         reading.set(3); });
+
+    out["value"] = co_await reading;
+    sensor.join();
+    co_return OK;
+  }
+};
+
+// Input is parsed in place, so each request gets its own copy
+static void process(KoolApi &api, const char *input, char *output, size_t size)
+{
+  char buffer[64];
+
+  strcpy(buffer, input);
+  output[0] = 0;
+  DeferrableRequest request(buffer, output, size);
+  api.process(request);
+}
+
+int main()
+{
+  KoolApi api("/api");
+  NowPath now;
+  SleepPath sleep;
+  FuturePath future;
+  char output[128];
+
+  api.on("now", now).on("sleep", sleep).on("future", future);
+
+  // Answered while processed, nothing is left on the loop
+  process(api, "{\"$_uri\":\"now\",\"method\":\"GET\"}", output, sizeof(output));
+  CHECK(strstr(output, "\"value\":1"));
+  CHECK(loop.idle());
+
+  // Deferred, so answered by the loop once the timer is due
+  process(api, "{\"$_uri\":\"sleep\",\"method\":\"GET\"}", output, sizeof(output));
+  CHECK(output[0] == 0);
+  CHECK(!loop.idle());
+  CHECK(loop.runUntilIdle(1000));
+  CHECK(strstr(output, "\"value\":2"));
+
+  // Resumed on this thread after the sensor thread sets the future
+  process(api, "{\"$_uri\":\"future\",\"method\":\"GET\"}", output, sizeof(output));
+  CHECK(loop.runUntilIdle(1000));
+  CHECK(strstr(output, "\"value\":3"));
+
+  return test::result();
+}
+
+#else
+
+int main()
+{
+  printf("built without coroutines, nothing to test\n");
+  return 0;
+}
+
+#endif
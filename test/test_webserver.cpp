@@ -0,0 +1,175 @@
+// Webserver requests against the ESPAsyncWebServer declarations in
+// test/webserver: answered in the callback, reassembled from body chunks,
+// and queued to an executor, where the answer goes through the relay sent
+// as the request was queued and is dropped if the client has gone. Identical
+// queued GETs are parked on the one running and answered with its response.
+#include "test.h"
+#include "KoolApi.h"
+
+#include <atomic>
+#include <thread>
+
+static std::atomic<int> handled{0};
+static std::atomic<int> started{0};
+
+class ValuePath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    out["value"] = request->params->getInt("id", 1);
+    request->send(OK);
+    ++handled;
+  }
+
+  void post(ApiRequest *request, JsonObject out) override
+  {
+    out["n"] = request->json["n"];
+    request->send(OK);
+    ++handled;
+  }
+};
+
+class SlowPath : public KoolApiPath
+{
+  void get(ApiRequest *request, JsonObject out) override
+  {
+    ++started;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    request->send(OK);
+    ++handled;
+  }
+};
+
+static const char *body(AsyncWebServerRequest &request)
+{
+  auto response = dynamic_cast<AsyncAbstractResponse *>(request.hostResponse());
+  return (response) ? response->hostBody().c_str() : "";
+}
+
+// Acks as the async_tcp task would until the response is sent
+static bool sent(AsyncWebServerRequest &request, uint32_t timeout = 2000)
+{
+  uint32_t start = millis();
+
+  while (!request.hostResponse() || !request.hostResponse()->_finished())
+  {
+    if (millis() - start > timeout)
+      return false;
+
+    request.hostAck();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  return true;
+}
+
+static bool reaches(std::atomic<int> &counter, int count)
+{
+  uint32_t start = millis();
+
+  while (counter < count)
+  {
+    if (millis() - start > 2000)
+      return false;
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  return true;
+}
+
+int main()
+{
+  AsyncWebServer server;
+  KoolApi api("/api");
+  ValuePath value;
+  SlowPath slow;
+
+  api.on("value", value).on("slow", slow).setCoalescing(true);
+  api.registerWith(server);
+
+  // Answered within the callback
+  {
+    AsyncWebServerRequest request(HTTP_GET, "/api/value");
+    request.hostParam("id", "7");
+
+    CHECK(server.hostRequest(&request));
+    CHECK(sent(request));
+    CHECK(request.hostResponse()->hostCode() == 200);
+    CHECK(strstr(body(request), "\"value\":7"));
+  }
+
+  // A body in chunks is reassembled before the handler runs
+  {
+    AsyncWebServerRequest request(HTTP_POST, "/api/value");
+
+    CHECK(server.hostRequest(&request, "{\"n\":5}", 3));
+    CHECK(sent(request));
+    CHECK(strstr(body(request), "\"n\":5"));
+  }
+
+  // Left to the webserver's other handlers
+  {
+    AsyncWebServerRequest request(HTTP_GET, "/other");
+    CHECK(!server.hostRequest(&request));
+  }
+
+  KoolApiExecutor executor(2);
+  executor.begin();
+  api.setExecutor(executor);
+
+  // Queued: the relay is sent at once and writes the worker's answer when acked
+  {
+    AsyncWebServerRequest request(HTTP_GET, "/api/value");
+    request.hostParam("id", "9");
+    int before = handled;
+
+    CHECK(server.hostRequest(&request));
+    CHECK(request.hostResponse() != nullptr);
+    CHECK(sent(request));
+    CHECK(handled == before + 1);
+    CHECK(request.client()->hostWritten > 0);
+  }
+
+  // A queued body is taken over, the webserver may free the request first
+  {
+    AsyncWebServerRequest request(HTTP_POST, "/api/value");
+    int before = handled;
+
+    CHECK(server.hostRequest(&request, "{\"n\":6}", 2));
+    CHECK(sent(request));
+    CHECK(handled == before + 1);
+  }
+
+  // Parked on the running GET, so the handler runs once and frees the second worker
+  {
+    AsyncWebServerRequest first(HTTP_GET, "/api/slow");
+    AsyncWebServerRequest second(HTTP_GET, "/api/slow");
+    int before = handled;
+
+    CHECK(server.hostRequest(&first));
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    CHECK(server.hostRequest(&second));
+    CHECK(sent(first));
+    CHECK(sent(second));
+    CHECK(handled == before + 1);
+    CHECK(second.client()->hostWritten == first.client()->hostWritten);
+  }
+
+  // Deleted while the handler runs, its answer is dropped rather than written
+  {
+    auto request = new AsyncWebServerRequest(HTTP_GET, "/api/slow");
+    int before = handled;
+    int running = started;
+
+    CHECK(server.hostRequest(request));
+    CHECK(reaches(started, running + 1));
+    delete request;
+    CHECK(reaches(handled, before + 1));
+  }
+
+  executor.end();
+  CHECK(executor.stats(API_PRIORITY_NORMAL).rejected == 0);
+
+  return test::result();
+}
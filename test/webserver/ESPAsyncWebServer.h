@@ -0,0 +1,685 @@
+// The parts of ESPAsyncWebServer 1.2.3 (the version pinned in library.json)
+// that the library uses, declared with that release's signatures so the
+// webserver requests, relays and websocket outbox are built on the host.
+//
+// Behaviour is reduced to what the tests need: responses write to an
+// AsyncClient that only counts bytes, and the `host` members stand in for
+// the async_tcp task by dispatching requests and acking what was written.
+#pragma once
+
+#define _ESPAsyncWebServer_H_
+
+#include <Arduino.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+class IPAddress
+{
+public:
+  IPAddress(uint32_t address = 0) : _address(address) {}
+  operator uint32_t() const { return _address; }
+
+private:
+  uint32_t _address;
+};
+
+class AsyncClient
+{
+public:
+  IPAddress remoteIP() { return IPAddress(0x0100007f); }
+  size_t space() { return 1436; }
+  bool canSend() { return true; }
+  bool connected() { return true; }
+  void close(bool now = false) {}
+
+  size_t write(const char *data, size_t size)
+  {
+    hostWritten += size;
+    return size;
+  }
+
+  /**
+   * @brief Bytes written so far, which `AsyncWebServerRequest::hostAck` acks
+   *
+   */
+  size_t hostWritten = 0;
+};
+
+typedef enum
+{
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+  HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+
+typedef uint8_t WebRequestMethodComposite;
+typedef std::function<void(void)> ArDisconnectHandler;
+
+class AsyncWebParameter
+{
+public:
+  AsyncWebParameter(const String &name, const String &value, bool form = false, bool file = false, size_t size = 0)
+      : _name(name), _value(value), _size(size), _isForm(form), _isFile(file) {}
+
+  const String &name() const { return _name; }
+  const String &value() const { return _value; }
+  size_t size() const { return _size; }
+  bool isPost() const { return _isForm; }
+  bool isFile() const { return _isFile; }
+
+private:
+  String _name;
+  String _value;
+  size_t _size;
+  bool _isForm;
+  bool _isFile;
+};
+
+class AsyncWebHeader
+{
+public:
+  AsyncWebHeader(const String &name, const String &value) : _name(name), _value(value) {}
+
+  const String &name() const { return _name; }
+  const String &value() const { return _value; }
+
+private:
+  String _name;
+  String _value;
+};
+
+typedef enum
+{
+  RESPONSE_SETUP,
+  RESPONSE_HEADERS,
+  RESPONSE_CONTENT,
+  RESPONSE_WAIT_ACK,
+  RESPONSE_END,
+  RESPONSE_FAILED
+} WebResponseState;
+
+class AsyncWebServerRequest;
+
+#define RESPONSE_TRY_AGAIN 0xFFFFFFFF
+
+typedef std::function<size_t(uint8_t *, size_t, size_t)> AwsResponseFiller;
+typedef std::function<String(const String &)> AwsTemplateProcessor;
+
+class AsyncWebServerResponse
+{
+protected:
+  int _code = 0;
+  String _contentType;
+  size_t _contentLength = 0;
+  bool _sendContentLength = true;
+  bool _chunked = false;
+  size_t _headLength = 0;
+  size_t _sentLength = 0;
+  size_t _ackedLength = 0;
+  size_t _writtenLength = 0;
+  WebResponseState _state = RESPONSE_SETUP;
+
+public:
+  AsyncWebServerResponse() {}
+  virtual ~AsyncWebServerResponse() {}
+  virtual void setCode(int code) { _code = code; }
+  virtual void setContentLength(size_t len) { _contentLength = len; }
+  virtual void setContentType(const String &type) { _contentType = type; }
+  virtual void addHeader(const String &name, const String &value) {}
+  virtual String _assembleHead(uint8_t version) { return String("HTTP/1.1 200 OK\r\n\r\n"); }
+  virtual bool _started() const { return _state > RESPONSE_SETUP; }
+  virtual bool _finished() const { return _state > RESPONSE_WAIT_ACK; }
+  virtual bool _failed() const { return _state == RESPONSE_FAILED; }
+  virtual bool _sourceValid() const { return false; }
+  virtual void _respond(AsyncWebServerRequest *request);
+  virtual size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) { return 0; }
+
+  int hostCode() const { return _code; }
+};
+
+class AsyncBasicResponse : public AsyncWebServerResponse
+{
+public:
+  AsyncBasicResponse(int code, const String &contentType = String(), const String &content = String()) : _content(content)
+  {
+    _code = code;
+    _contentType = contentType;
+    _contentLength = content.length();
+  }
+
+  bool _sourceValid() const override { return true; }
+  void _respond(AsyncWebServerRequest *request) override;
+  size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override;
+
+private:
+  String _content;
+};
+
+/**
+ * @brief Content pulled through `_fillBuffer`, written whole by `_respond` on the host
+ *
+ */
+class AsyncAbstractResponse : public AsyncWebServerResponse
+{
+public:
+  AsyncAbstractResponse(AwsTemplateProcessor callback = nullptr) {}
+
+  bool _sourceValid() const override { return false; }
+  void _respond(AsyncWebServerRequest *request) override;
+  size_t _ack(AsyncWebServerRequest *request, size_t len, uint32_t time) override;
+  virtual size_t _fillBuffer(uint8_t *buf, size_t maxLen) { return 0; }
+
+  const String &hostBody() const { return _body; }
+
+private:
+  String _body;
+};
+
+class AsyncResponseStream : public AsyncAbstractResponse, public Print
+{
+public:
+  AsyncResponseStream(const String &contentType, size_t bufferSize)
+  {
+    _code = 200;
+    _contentType = contentType;
+  }
+
+  bool _sourceValid() const override { return _state < RESPONSE_END; }
+
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override
+  {
+    size_t length = _buffer.length() - _read;
+
+    if (length > maxLen)
+      length = maxLen;
+
+    memcpy(buf, _buffer.c_str() + _read, length);
+    _read += length;
+    return length;
+  }
+
+  size_t write(const uint8_t *data, size_t len) override
+  {
+    _buffer.concat((const char *)data, len);
+    return len;
+  }
+
+  size_t write(uint8_t data) override { return write(&data, 1); }
+
+private:
+  String _buffer;
+  size_t _read = 0;
+};
+
+class AsyncChunkedResponse : public AsyncAbstractResponse
+{
+public:
+  AsyncChunkedResponse(const String &contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback = nullptr)
+      : _content(callback)
+  {
+    _code = 200;
+    _contentType = contentType;
+    _sendContentLength = false;
+    _chunked = true;
+  }
+
+  bool _sourceValid() const override { return !!(_content); }
+
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override
+  {
+    size_t length = _content(buf, maxLen, _filledLength);
+
+    if (length != RESPONSE_TRY_AGAIN)
+      _filledLength += length;
+
+    return length;
+  }
+
+private:
+  AwsResponseFiller _content;
+  size_t _filledLength = 0;
+};
+
+class AsyncCallbackResponse : public AsyncAbstractResponse
+{
+public:
+  AsyncCallbackResponse(const String &contentType, size_t len, AwsResponseFiller callback, AwsTemplateProcessor templateCallback = nullptr)
+      : _content(callback)
+  {
+    _code = 200;
+    _contentType = contentType;
+    _contentLength = len;
+
+    if (!len)
+      _sendContentLength = false;
+  }
+
+  bool _sourceValid() const override { return !!(_content); }
+
+  size_t _fillBuffer(uint8_t *buf, size_t maxLen) override
+  {
+    size_t length = _content(buf, maxLen, _filledLength);
+
+    if (length != RESPONSE_TRY_AGAIN)
+      _filledLength += length;
+
+    return length;
+  }
+
+private:
+  AwsResponseFiller _content;
+  size_t _filledLength = 0;
+};
+
+class AsyncWebServerRequest
+{
+public:
+  void *_tempObject = nullptr;
+
+  /**
+   * @brief Host only, a request as the webserver would have parsed it
+   *
+   */
+  AsyncWebServerRequest(WebRequestMethodComposite method, const char *url) : _method(method), _url(url) {}
+
+  ~AsyncWebServerRequest()
+  {
+    delete _response;
+
+    if (_onDisconnectfn)
+      _onDisconnectfn();
+
+    free(_tempObject);
+  }
+
+  AsyncWebServerRequest(const AsyncWebServerRequest &) = delete;
+  AsyncWebServerRequest &operator=(const AsyncWebServerRequest &) = delete;
+
+  AsyncClient *client() { return &_client; }
+  uint8_t version() const { return 1; }
+  WebRequestMethodComposite method() const { return _method; }
+  const String &url() const { return _url; }
+  void onDisconnect(ArDisconnectHandler fn) { _onDisconnectfn = fn; }
+
+  void send(AsyncWebServerResponse *response)
+  {
+    delete _response;
+    _response = response;
+
+    if (!_response)
+      return;
+
+    if (!_response->_sourceValid())
+    {
+      delete response;
+      _response = nullptr;
+      send(500);
+    }
+    else
+    {
+      _response->_respond(this);
+    }
+  }
+
+  void send(int code, const String &contentType = String(), const String &content = String())
+  {
+    send(beginResponse(code, contentType, content));
+  }
+
+  AsyncResponseStream *beginResponseStream(const String &contentType, size_t bufferSize = 1460)
+  {
+    return new AsyncResponseStream(contentType, bufferSize);
+  }
+
+  AsyncWebServerResponse *beginResponse(int code, const String &contentType = String(), const String &content = String())
+  {
+    return new AsyncBasicResponse(code, contentType, content);
+  }
+
+  AsyncWebServerResponse *beginChunkedResponse(const String &contentType, AwsResponseFiller callback, AwsTemplateProcessor templateCallback = nullptr)
+  {
+    return new AsyncChunkedResponse(contentType, callback, templateCallback);
+  }
+
+  void addInterestingHeader(const String &name) {}
+
+  AsyncWebHeader *getHeader(const String &name) const
+  {
+    for (auto &header : _headers)
+    {
+      if (strcasecmp(header->name().c_str(), name.c_str()) == 0)
+        return header.get();
+    }
+
+    return nullptr;
+  }
+
+  bool hasHeader(const String &name) const { return getHeader(name) != nullptr; }
+
+  size_t params() const { return _params.size(); }
+
+  AsyncWebParameter *getParam(size_t num) const { return (num < _params.size()) ? _params[num].get() : nullptr; }
+
+  AsyncWebParameter *getParam(const String &name, bool post = false, bool file = false) const
+  {
+    for (auto &param : _params)
+    {
+      if (param->name() == name.c_str() && param->isPost() == post && param->isFile() == file)
+        return param.get();
+    }
+
+    return nullptr;
+  }
+
+  /**
+   * @brief Host only, add a header or query param as the webserver parsed it
+   *
+   */
+  void hostHeader(const char *name, const char *value) { _headers.emplace_back(new AsyncWebHeader(name, value)); }
+  void hostParam(const char *name, const char *value) { _params.emplace_back(new AsyncWebParameter(name, value)); }
+
+  /**
+   * @brief Host only, what the async_tcp task does on an ack or poll: ack the
+   * bytes written since and let the response carry on
+   *
+   */
+  void hostAck()
+  {
+    size_t len = _client.hostWritten - _acked;
+
+    _acked = _client.hostWritten;
+
+    if (_response && !_response->_finished())
+      _response->_ack(this, len, millis());
+  }
+
+  AsyncWebServerResponse *hostResponse() const { return _response; }
+
+private:
+  WebRequestMethodComposite _method;
+  String _url;
+  AsyncClient _client;
+  AsyncWebServerResponse *_response = nullptr;
+  ArDisconnectHandler _onDisconnectfn;
+  std::vector<std::unique_ptr<AsyncWebHeader>> _headers;
+  std::vector<std::unique_ptr<AsyncWebParameter>> _params;
+  size_t _acked = 0;
+};
+
+inline void AsyncWebServerResponse::_respond(AsyncWebServerRequest *request)
+{
+  _state = RESPONSE_END;
+  request->client()->close();
+}
+
+inline void AsyncBasicResponse::_respond(AsyncWebServerRequest *request)
+{
+  String head = _assembleHead(request->version());
+
+  _headLength = head.length();
+  _writtenLength += request->client()->write(head.c_str(), _headLength);
+  _writtenLength += request->client()->write(_content.c_str(), _content.length());
+  _state = RESPONSE_WAIT_ACK;
+}
+
+inline size_t AsyncBasicResponse::_ack(AsyncWebServerRequest *request, size_t len, uint32_t time)
+{
+  _ackedLength += len;
+
+  if (_state == RESPONSE_WAIT_ACK && _ackedLength >= _writtenLength)
+    _state = RESPONSE_END;
+
+  return 0;
+}
+
+inline void AsyncAbstractResponse::_respond(AsyncWebServerRequest *request)
+{
+  String head = _assembleHead(request->version());
+  uint8_t buffer[256];
+  size_t length;
+
+  _headLength = head.length();
+  _writtenLength += request->client()->write(head.c_str(), _headLength);
+
+  // The whole body at once, a real connection is filled a window at a time
+  while ((length = _fillBuffer(buffer, sizeof(buffer))) != 0 && length != RESPONSE_TRY_AGAIN)
+  {
+    _body.concat((const char *)buffer, length);
+    _sentLength += length;
+    _writtenLength += request->client()->write((const char *)buffer, length);
+  }
+
+  _state = RESPONSE_WAIT_ACK;
+}
+
+inline size_t AsyncAbstractResponse::_ack(AsyncWebServerRequest *request, size_t len, uint32_t time)
+{
+  _ackedLength += len;
+
+  if (_state == RESPONSE_WAIT_ACK && _ackedLength >= _writtenLength)
+    _state = RESPONSE_END;
+
+  return 0;
+}
+
+typedef std::function<void(AsyncWebServerRequest *request)> ArRequestHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *request, const String &filename, size_t index, uint8_t *data, size_t len, bool final)> ArUploadHandlerFunction;
+typedef std::function<void(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)> ArBodyHandlerFunction;
+typedef std::function<bool(AsyncWebServerRequest *request)> ArRequestFilterFunction;
+
+class AsyncWebHandler
+{
+public:
+  virtual ~AsyncWebHandler() {}
+
+  AsyncWebHandler &setFilter(ArRequestFilterFunction fn)
+  {
+    _filter = fn;
+    return *this;
+  }
+
+  bool filter(AsyncWebServerRequest *request) { return !_filter || _filter(request); }
+
+protected:
+  ArRequestFilterFunction _filter;
+};
+
+class AsyncCallbackWebHandler : public AsyncWebHandler
+{
+public:
+  AsyncCallbackWebHandler(const String &uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest,
+                          ArUploadHandlerFunction onUpload, ArBodyHandlerFunction onBody)
+      : _uri(uri), _method(method), _onRequest(onRequest), _onUpload(onUpload), _onBody(onBody) {}
+
+  bool canHandle(AsyncWebServerRequest *request)
+  {
+    const char *url = request->url().c_str();
+    size_t length = _uri.length();
+
+    return (_method & request->method()) && strncmp(url, _uri.c_str(), length) == 0 && (url[length] == 0 || url[length] == '/');
+  }
+
+  void handleBody(AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+  {
+    if (_onBody)
+      _onBody(request, data, len, index, total);
+  }
+
+  void handleRequest(AsyncWebServerRequest *request)
+  {
+    if (_onRequest)
+      _onRequest(request);
+    else
+      request->send(500);
+  }
+
+private:
+  String _uri;
+  WebRequestMethodComposite _method;
+  ArRequestHandlerFunction _onRequest;
+  ArUploadHandlerFunction _onUpload;
+  ArBodyHandlerFunction _onBody;
+};
+
+class AsyncWebServer
+{
+public:
+  AsyncCallbackWebHandler &on(const char *uri, WebRequestMethodComposite method, ArRequestHandlerFunction onRequest,
+                              ArUploadHandlerFunction onUpload = nullptr, ArBodyHandlerFunction onBody = nullptr)
+  {
+    _handlers.emplace_back(new AsyncCallbackWebHandler(uri, method, onRequest, onUpload, onBody));
+    return *_handlers.back();
+  }
+
+  /**
+   * @brief Host only, hand a parsed request to the first handler that takes
+   * it, its body in chunks of `chunk` bytes as the webserver would
+   *
+   * @return bool false if no handler took it, the webserver would answer 404
+   */
+  bool hostRequest(AsyncWebServerRequest *request, const char *body = nullptr, size_t chunk = 0)
+  {
+    for (auto &handler : _handlers)
+    {
+      if (!handler->canHandle(request) || !handler->filter(request))
+        continue;
+
+      size_t total = (body) ? strlen(body) : 0;
+
+      for (size_t index = 0; index < total; index += chunk)
+      {
+        size_t len = (chunk && total - index > chunk) ? chunk : total - index;
+        handler->handleBody(request, (uint8_t *)body + index, len, index, total);
+
+        if (!chunk)
+          break;
+      }
+
+      handler->handleRequest(request);
+      return true;
+    }
+
+    return false;
+  }
+
+private:
+  std::vector<std::unique_ptr<AsyncCallbackWebHandler>> _handlers;
+};
+
+class AsyncWebSocketMessageBuffer
+{
+public:
+  AsyncWebSocketMessageBuffer(size_t size) : _data((uint8_t *)malloc(size + 1)), _len(size) {}
+  ~AsyncWebSocketMessageBuffer() { free(_data); }
+
+  uint8_t *get() { return _data; }
+  size_t length() { return _len; }
+
+private:
+  uint8_t *_data;
+  size_t _len;
+};
+
+typedef enum
+{
+  WS_CONTINUATION,
+  WS_TEXT,
+  WS_BINARY,
+  WS_DISCONNECT = 0x08,
+  WS_PING,
+  WS_PONG
+} AwsFrameType;
+
+typedef enum
+{
+  WS_MSG_SENDING,
+  WS_MSG_SENT,
+  WS_MSG_ERROR
+} AwsMessageStatus;
+
+class AsyncWebSocketMessage
+{
+protected:
+  uint8_t _opcode = WS_TEXT;
+  bool _mask = false;
+  AwsMessageStatus _status = WS_MSG_ERROR;
+
+public:
+  virtual ~AsyncWebSocketMessage() {}
+  virtual void ack(size_t len, uint32_t time) {}
+  virtual size_t send(AsyncClient *client) { return 0; }
+  virtual bool finished() { return _status != WS_MSG_SENDING; }
+  virtual bool betweenFrames() const { return false; }
+};
+
+class AsyncWebSocketBasicMessage : public AsyncWebSocketMessage
+{
+public:
+  AsyncWebSocketBasicMessage(const char *data, size_t len, uint8_t opcode = WS_TEXT, bool mask = false) : _len(len)
+  {
+    _opcode = opcode & 0x07;
+    _mask = mask;
+    _status = WS_MSG_SENDING;
+  }
+
+  void ack(size_t len, uint32_t time) override
+  {
+    _acked += len;
+
+    if (_acked >= _len)
+      _status = WS_MSG_SENT;
+  }
+
+  size_t send(AsyncClient *client) override
+  {
+    if (_status != WS_MSG_SENDING)
+      return 0;
+
+    _sent = _len;
+    return client->write("", _len);
+  }
+
+  bool betweenFrames() const override { return _acked == _sent; }
+
+private:
+  size_t _len;
+  size_t _sent = 0;
+  size_t _acked = 0;
+};
+
+class AsyncWebSocketClient
+{
+public:
+  ~AsyncWebSocketClient()
+  {
+    for (auto message : _messages)
+      delete message;
+  }
+
+  void message(AsyncWebSocketMessage *message) { _messages.push_back(message); }
+  uint32_t id() { return 1; }
+  IPAddress remoteIP() { return _client.remoteIP(); }
+  void text(AsyncWebSocketMessageBuffer *buffer) { delete buffer; }
+  void binary(AsyncWebSocketMessageBuffer *buffer) { delete buffer; }
+  bool canSend() { return true; }
+
+private:
+  AsyncClient _client;
+  std::vector<AsyncWebSocketMessage *> _messages;
+};
+
+class AsyncWebSocket
+{
+public:
+  AsyncWebSocketClient *client(uint32_t id) { return nullptr; }
+  void text(uint32_t id, AsyncWebSocketMessageBuffer *buffer) { delete buffer; }
+  void binary(uint32_t id, AsyncWebSocketMessageBuffer *buffer) { delete buffer; }
+  AsyncWebSocketMessageBuffer *makeBuffer(size_t size = 0) { return new AsyncWebSocketMessageBuffer(size); }
+};